@@ -22,10 +22,53 @@ function flushStdout(stdout) {
     }
 }
 
+//drain the ring buffer std::cout writes into.  Its header is a u32 read count, u32 write count, and u32 capacity,
+//followed by the ring's bytes.  The counts only ever increase, so they are masked to find positions in the ring
+function drainStdoutRing(memory, ringAddress, decoder) {
+    const header = new Uint32Array(memory.buffer, ringAddress, 3);
+    const [readCount, writeCount, capacity] = header;
+    const length = (writeCount - readCount) >>> 0;
+    if (length === 0) {
+        return "";
+    }
+
+    const ring = new Uint8Array(memory.buffer, ringAddress + 16, capacity);
+    const start = readCount & (capacity - 1);
+    const end = start + length;
+
+    let bytes;
+    if (end <= capacity) {
+        bytes = ring.subarray(start, end);
+    } else {
+        //the text wraps around the end of the ring, so join both halves before decoding
+        bytes = new Uint8Array(length);
+        bytes.set(ring.subarray(start));
+        bytes.set(ring.subarray(0, end - capacity), capacity - start);
+    }
+
+    header[0] = writeCount;
+
+    //streaming keeps multi-byte characters that are split between two flushes intact
+    return decoder.decode(bytes, {stream: true});
+}
+
 function createImportObject(providedImports) {
     //this is assumed to be assigned externally after this function returns
+    this.memory = null;
     this.memoryUint8 = null;
 
+    //address of the std::cout ring buffer for modules that export one, also assigned externally
+    this.stdoutRingAddress = null;
+    this.stdoutDecoder = new TextDecoder();
+
+    //growing a wasm memory detaches its old buffer, so recreate the view whenever the buffer changes
+    this.getMemoryUint8 = () => {
+        if (this.memoryUint8 === null || this.memoryUint8.buffer !== this.memory.buffer) {
+            this.memoryUint8 = new Uint8Array(this.memory.buffer);
+        }
+        return this.memoryUint8;
+    };
+
     //in the future, all functions will have their input and output pre-processed
     let {stdout, ...env} = providedImports || {};
     stdout = stdout || console.log;
@@ -37,7 +80,7 @@ function createImportObject(providedImports) {
     //for instance, here puts receives from Wasm an address and number
     //of bytes, but the calling code receives a String object instead
     this.env.puts = (address, size) => {
-        const data = this.memoryUint8.subarray(address, address + size);
+        const data = this.getMemoryUint8().subarray(address, address + size);
         const message = UTF8Decoder.decode(data);
         bufferedPuts(message, stdout);
     };
@@ -63,14 +106,22 @@ function createImportObject(providedImports) {
         bufferedPuts(String(u32Num), stdout);
     };
 
-    this.env.flushStdout = function() {
+    this.env.flushStdout = () => {
         flushStdout(stdout);
+
+        if (this.stdoutRingAddress !== null) {
+            const text = drainStdoutRing(this.memory, this.stdoutRingAddress, this.stdoutDecoder);
+            if (text) {
+                stdout(text);
+            }
+        }
     }
 
     //clang is stuborn about extern C, so each type requires its own import
     this.env.putf32 = env.puti32;
     this.env.putf64 = env.puti32;
 
+    //sqrt, floor, abs, min, max and the like compile to wasm instructions, but the rest of Math can still be imported
     this.env = Object.assign(this.env, Math);
 }
 
@@ -87,44 +138,127 @@ export default function getCompiler(language, customImports) {
             WebAssembly.instantiate(bytes, imports)
         ).then(results => {
             const exports = results.instance.exports;
-            imports.memoryUint8 = new Uint8Array(exports.memory.buffer);
-
-            //this object exposes the two public functions but not any internal details
-            const compiler = {
-                compileToWasmBinary(sourceCode) {
-                    sourceCode = cppPreprocessor("cpp", sourceCode);
-                    const strAsUTF8 = UTF8Encoder.encode(sourceCode);
-                
-                    imports.memoryUint8.set(strAsUTF8, exports.__heap_base);
-                
-                    const addr = exports.getWasmFromCpp(exports.__heap_base, strAsUTF8.length);
-
-                    //the number of bytes is stored in the same location that we just wrote the source
-                    //code to, but its stored as a 32 bit integer instead of character data,
-                    //and it's rounded up to the next 4 byte alignment
-                    const size = (new Uint32Array(exports.memory.buffer))[(exports.__heap_base.value + 3) >> 2];
-                
-                    return imports.memoryUint8.subarray(addr, addr + size);
-                },
-                compile(sourceCode, customImports) {
-                    return new Promise((resolve, reject) => {    
-                        const bytes = this.compileToWasmBinary(sourceCode);
-                        const imports = new createImportObject(customImports);
-                    
-                        WebAssembly.instantiate(bytes, imports)
-                        .then((results) => {
-                            const runtimeExports = results.instance.exports;
-                            if (runtimeExports.memory) {
-                                imports.memoryUint8 = new Uint8Array(runtimeExports.memory.buffer);
+            imports.memory = exports.memory;
+
+            //the function bodies of the last compilation, so the next one only writes the functions that changed.
+            //A cpp.wasm built before the code cache or the export roots existed lacks their exports, and every
+            //compilation writes all functions and uses the default roots
+            const hasCodeCache = exports.setCodeCache && exports.getCodeCacheAddress && exports.getCodeCacheSize;
+
+            //a compiler for one compiler context in the instance, where 0 is the instance's own state.  Each keeps
+            //its own code cache, so compilers of different contexts can take turns without undoing each other's work
+            function createContextCompiler(contextAddress) {
+                let codeCache = new Uint8Array(0);
+
+                //this object exposes the public functions but not any internal details
+                return {
+                    //exportNames lists the functions the host calls, which defaults to main and update.  Only the
+                    //functions they call are compiled
+                    compileToWasmBinary(sourceCode, exportNames) {
+                        if (exports.useCompilerContext) {
+                            exports.useCompilerContext(contextAddress);
+                        }
+
+                        if (exportNames && exports.setExportRoots) {
+                            //the names are hashed right away, so the source code can be written over them
+                            const namesAsUTF8 = UTF8Encoder.encode(exportNames.join(","));
+                            const namesEnd = exports.__heap_base.value + namesAsUTF8.length;
+                            if (namesEnd > exports.memory.buffer.byteLength) {
+                                exports.memory.grow(Math.ceil((namesEnd - exports.memory.buffer.byteLength) / 65536));
                             }
-                
-                            resolve(runtimeExports);
-                        }).catch((error) => {
-                            reject(error);
+
+                            imports.getMemoryUint8().set(namesAsUTF8, exports.__heap_base);
+                            exports.setExportRoots(exports.__heap_base, namesAsUTF8.length);
+                        }
+
+                        sourceCode = cppPreprocessor("cpp", sourceCode);
+                        const strAsUTF8 = UTF8Encoder.encode(sourceCode);
+
+                        //the compiler grows its own memory as it needs more, but the source code and the code cache
+                        //after it have to fit before it starts
+                        const sourceEnd = exports.__heap_base.value + strAsUTF8.length + 8;
+                        const codeCacheAddress = (sourceEnd + 7) & ~7;
+                        const bytesMissing = codeCacheAddress + codeCache.length - exports.memory.buffer.byteLength;
+                        if (bytesMissing > 0) {
+                            exports.memory.grow(Math.ceil(bytesMissing / 65536));
+                        }
+
+                        imports.getMemoryUint8().set(strAsUTF8, exports.__heap_base);
+                        if (hasCodeCache) {
+                            imports.getMemoryUint8().set(codeCache, codeCacheAddress);
+                            exports.setCodeCache(codeCacheAddress, codeCache.length);
+                        }
+
+                        const addr = exports.getWasmFromCpp(exports.__heap_base, strAsUTF8.length);
+
+                        //copy the new cache out, since the next compilation writes its source code over it
+                        if (hasCodeCache) {
+                            const newCodeCacheAddress = exports.getCodeCacheAddress();
+                            codeCache = imports.getMemoryUint8().slice(newCodeCacheAddress,
+                                                                       newCodeCacheAddress + exports.getCodeCacheSize());
+                        }
+
+                        //the number of bytes is stored in the same location that we just wrote the source
+                        //code to, but its stored as a 32 bit integer instead of character data,
+                        //and it's rounded up to the next 4 byte alignment
+                        const size = (new Uint32Array(exports.memory.buffer))[(exports.__heap_base.value + 3) >> 2];
+
+                        return imports.getMemoryUint8().subarray(addr, addr + size);
+                    },
+                    compile(sourceCode, customImports, exportNames) {
+                        return new Promise((resolve, reject) => {
+                            const bytes = this.compileToWasmBinary(sourceCode, exportNames);
+                            const imports = new createImportObject(customImports);
+
+                            //a compilation that ran out of memory returns no module at all
+                            if (bytes.length === 0) {
+                                reject(new Error("the compiler ran out of memory"));
+                                return;
+                            }
+
+                            WebAssembly.instantiate(bytes, imports)
+                            .then((results) => {
+                                const runtimeExports = results.instance.exports;
+                                if (runtimeExports.memory) {
+                                    imports.memory = runtimeExports.memory;
+                                }
+
+                                if (runtimeExports.__stdout) {
+                                    imports.stdoutRingAddress = runtimeExports.__stdout.value;
+                                }
+
+                                resolve(runtimeExports);
+                            }).catch((error) => {
+                                reject(error);
+                            });
                         });
-                    });
-                }
+                    }
+                };
             }
+
+            const compiler = createContextCompiler(0);
+
+            //another compiler that shares this instance but none of its state
+            compiler.createContext = () => {
+                if (!exports.createCompilerContext) {
+                    throw new Error("this cpp.wasm was built before compiler contexts existed");
+                }
+
+                const contextAddress = exports.createCompilerContext();
+                if (!contextAddress) {
+                    throw new Error("no more compiler contexts are available in this instance");
+                }
+
+                //destroy gives the context back for a later createContext to reuse, after which this compiler must
+                //not be used
+                const contextCompiler = createContextCompiler(contextAddress);
+                contextCompiler.destroy = () => {
+                    if (exports.destroyCompilerContext) {
+                        exports.destroyCompilerContext(contextAddress);
+                    }
+                };
+                return contextCompiler;
+            };
         
             resolve(compiler);
         }).catch(error => {
@@ -143,6 +277,12 @@ extern "C" void putf64(f64 num);
 extern "C" void flushStdout();
 `;
 
+//drawCircle appends to a draw list that the host replays each frame, or sooner through flushDrawList when the list is full
+const canvas = `\
+extern "C" void drawCircle(float x, float y, float r);
+extern "C" void flushDrawList();
+`;
+
 function cppPreprocessor(language, sourceCode) {
     //back-slashes preceeding a newline nullify the newline
     sourceCode = sourceCode.replace(/\\\n/, "");
@@ -154,7 +294,7 @@ function cppPreprocessor(language, sourceCode) {
     sourceCode = sourceCode.replace(/#include\s*<iostream>$/gm, iostream);
 
     //this line is temporary until I implement custom includable files
-    sourceCode = sourceCode.replace(/#include\s*<canvas>$/gm, "extern \"C\" void drawCircle(float x, float y, float r);");
+    sourceCode = sourceCode.replace(/#include\s*<canvas>$/gm, canvas);
     
     //TODO support pre-processor #DEFINE's
     //for now just remove preprocessors so the compiler doesn't have to detect them
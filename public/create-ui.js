@@ -13,6 +13,7 @@ let activeWasmModule;
 let compileTimestamp;
 let prevTimeStamp;
 let frameRequestId;
+let drawListRuntime;
 
 function playClicked() {
     const sourceCode = editor.getValue();
@@ -22,7 +23,8 @@ function playClicked() {
         sourceCode,
         {
             stdout: printToConsole,
-            drawCircle: drawCircle
+            drawCircle: drawCircle,
+            flushDrawList: flushDrawList
         }
     ).then(executeProgram);
 };
@@ -90,6 +92,14 @@ function printToConsole(value) {
     }
 }
 
+function getFillStyle() {
+    const seconds = performance.now() / 1000 - compileTimestamp;
+    const progress = seconds / 4;
+    const hue = (progress - Math.floor(progress)) * 360;
+    return "hsl(" + hue + ", 100%, 50%)";
+}
+
+//only called by modules compiled without a draw list
 function drawCircle(x, y, r) {
     // printToConsole(`drawCircle(${x}, ${y}, ${r})\n`)
 
@@ -99,15 +109,62 @@ function drawCircle(x, y, r) {
     y = (canvas.height - y * minDim) / 2;
     r = r / 2 * minDim;
 
-    const seconds = performance.now() / 1000 - compileTimestamp;
-    const progress = seconds / 4;
-    const hue = (progress - Math.floor(progress)) * 360;
-    ctx.fillStyle = "hsl(" + hue + ", 100%, 50%)"
+    ctx.fillStyle = getFillStyle();
     ctx.beginPath();
     ctx.arc(x, y, r, 0, Math.PI*2);
     ctx.fill();
 }
 
+//the module calls this when its draw list is full
+function flushDrawList() {
+    replayDrawList(drawListRuntime);
+}
+
+//draw every command the module appended to its draw list since the last replay, then empty the list.
+//The list starts with a u32 command count, and each command is 16 bytes: a u32 command type and its operands
+function replayDrawList(runtime) {
+    if (!runtime || !runtime.__drawList) {
+        return;
+    }
+
+    const address = runtime.__drawList.value;
+    const buffer = runtime.memory.buffer;
+    const header = new Uint32Array(buffer, address, 2);
+    const count = header[0];
+    if (count === 0) {
+        return;
+    }
+
+    const commandTypes = new Uint32Array(buffer, address + 16, count * 4);
+    const operands = new Float32Array(buffer, address + 16, count * 4);
+
+    //every primitive in a replay shares one colour, so they are all added to one path and filled once
+    const halfWidth = canvas.width / 2;
+    const halfHeight = canvas.height / 2;
+    const scale = minDim / 2;
+
+    ctx.fillStyle = getFillStyle();
+    ctx.beginPath();
+
+    for (let i = 0; i < count * 4; i += 4) {
+        switch (commandTypes[i]) {
+            case 0: { //circle
+                const x = halfWidth + operands[i + 1] * scale;
+                const y = halfHeight - operands[i + 2] * scale;
+                const r = operands[i + 3] * scale;
+
+                //without a moveTo, arc would connect each circle to the previous one
+                ctx.moveTo(x + r, y);
+                ctx.arc(x, y, r, 0, Math.PI*2);
+            }
+            break;
+        }
+    }
+
+    ctx.fill();
+    header[0] = 0;
+}
+
 getCompiler("cpp", {
     stdout: printToConsole
 }).then(compilerInstance => {
@@ -129,6 +186,7 @@ function activateMenu() {
 function executeProgram(runtime) {
     //clear the console before running main
     consoleOutput.innerHTML = "";
+    drawListRuntime = runtime;
 
     if (runtime.main) {
         runtime.main();
@@ -171,5 +229,7 @@ function draw(timestamp) {
         activeWasmModule.update(elapsedSeconds, delta);
     }
 
+    replayDrawList(activeWasmModule);
+
     frameRequestId = requestAnimationFrame(draw);
 }
\ No newline at end of file
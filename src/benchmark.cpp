@@ -0,0 +1,433 @@
+/* Compiles synthetic programs of increasing size with the native build and reports how fast each one goes through the
+compiler.  Each shape stresses one part of the compiler: many functions, deeply nested scopes, long expressions, and
+long std::cout chains.  The last tables compile one program on several threads at once, write its function bodies
+on several threads, and recompile it after small edits with the code cache.
+Usage: benchmark [largest scale] [seconds per case] [most threads] */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include <thread>
+#include <vector>
+
+#include "native-host.h"
+
+struct Source
+{
+    char *text;
+    u32 length;
+    u32 capacity;
+    u32 funcCount;
+};
+
+void append(Source *source, const char *format, ...)
+{
+    for (;;)
+    {
+        va_list args;
+        va_start(args, format);
+        u32 available = source->capacity - source->length;
+        u32 written = vsnprintf(source->text + source->length, available, format, args);
+        va_end(args);
+
+        if (written < available)
+        {
+            source->length += written;
+            return;
+        }
+
+        source->capacity = source->capacity * 2 + written;
+        source->text = (char *)realloc(source->text, source->capacity);
+    }
+}
+
+void beginFunction(Source *source, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    char header[64];
+    vsnprintf(header, sizeof(header), format, args);
+    va_end(args);
+
+    append(source, "void %s {\n", header);
+    ++source->funcCount;
+}
+
+//scale functions, each too long to be inlined, and a main that calls every one of them.  The compiler has no else,
+//so the second branch is an if of its own
+void generateFunctions(Source *source, u32 scale)
+{
+    append(source, "#include <iostream>\n");
+    for (u32 i = 0; i < scale; ++i)
+    {
+        append(source, "float g%u;\n", i);
+    }
+
+    for (u32 i = 0; i < scale; ++i)
+    {
+        beginFunction(source, "fn%u(float a, int b)", i);
+        append(source, "    float t = a * 2.0f;\n");
+        append(source, "    g%u = g%u + t;\n", i, i);
+        append(source, "    if (b > 3) {\n        int k = b + %u;\n        float u = t + k;\n", i);
+        append(source, "        g%u = g%u + u / 3.0f;\n    }\n    if (b < 4) {\n", i, i);
+        append(source, "        for (int j = 0; j < b; j = j + 1) {\n            g%u = g%u - j * a;\n        }\n", i, i);
+        append(source, "    }\n    g%u = b > 5 ? g%u * 0.5f : g%u;\n}\n", i, i, i);
+    }
+
+    beginFunction(source, "main()");
+    for (u32 i = 0; i < scale; ++i)
+    {
+        append(source, "    fn%u(1.5f, %u);\n", i, i % 7);
+    }
+    append(source, "    std::cout << g%u << '\\n';\n}\n", scale - 1);
+}
+
+//a few functions whose bodies nest scale scopes deep, declaring and shadowing variables at every level
+void generateScopes(Source *source, u32 scale)
+{
+    append(source, "#include <iostream>\nint total;\n");
+
+    for (u32 f = 0; f < 4; ++f)
+    {
+        beginFunction(source, "nest%u(int n)", f);
+        append(source, "    int x = n;\n");
+        for (u32 depth = 0; depth < scale; ++depth)
+        {
+            switch (depth % 3)
+            {
+            case 0:
+                append(source, "    if (x > %u) {\n", depth);
+                break;
+            case 1:
+                append(source, "    for (int i%u = 0; i%u < 2; i%u = i%u + 1) {\n", depth, depth, depth, depth);
+                break;
+            default:
+                append(source, "    {\n");
+                break;
+            }
+            append(source, "    int x = n + %u;\n    total = total + x;\n", depth);
+        }
+        for (u32 depth = 0; depth < scale; ++depth)
+        {
+            append(source, "    }\n");
+        }
+        append(source, "}\n");
+    }
+
+    beginFunction(source, "main()");
+    append(source, "    nest0(1);\n    nest1(2);\n    nest2(3);\n    nest3(4);\n");
+    append(source, "    std::cout << total << '\\n';\n}\n");
+}
+
+//statements whose expressions have scale terms each, mixing locals, globals and constants
+void generateExpressions(Source *source, u32 scale)
+{
+    append(source, "#include <iostream>\nint a;\nint b;\nfloat c;\n");
+
+    beginFunction(source, "main()");
+    append(source, "    int x = 3;\n    int y = 7;\n    float z = 0.5f;\n");
+    for (u32 statement = 0; statement < 16; ++statement)
+    {
+        append(source, "    a = a");
+        for (u32 term = 0; term < scale; ++term)
+        {
+            static const char *operands[] = {"x", "y", "b", "a", "(x - y)", "(b * 3)"};
+            static const char *operators[] = {" + ", " - ", " * ", " + "};
+            append(source, "%s%s", operators[(term + statement) % 4], operands[(term * 7 + statement) % 6]);
+        }
+        append(source, ";\n    c = c + z * %u.0f - a / (y + 1);\n    b = a < b ? a : b + 1;\n", statement);
+    }
+    append(source, "    std::cout << a << ' ' << b << ' ' << c << '\\n';\n}\n");
+}
+
+//scale lines of std::cout, each chaining strings, integers, floats and characters
+void generateCout(Source *source, u32 scale)
+{
+    append(source, "#include <iostream>\nint count;\nfloat ratio;\n");
+
+    beginFunction(source, "main()");
+    for (u32 line = 0; line < scale; ++line)
+    {
+        append(source, "    count = count + %u;\n    ratio = ratio + 0.25f;\n", line);
+        append(source, "    std::cout << \"line %u: \" << count << ' ' << ratio << \" of \" << %u << '\\n';\n", line, scale);
+    }
+    append(source, "}\n");
+}
+
+struct Shape
+{
+    const char *name;
+    void (*generate)(Source *source, u32 scale);
+    u32 smallestScale;
+};
+
+f64 now()
+{
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+struct ParallelRun
+{
+    u32 compileCount;
+    u32 mismatchCount; //compilations whose output differs from the single threaded output
+};
+
+//compile source over and over until the deadline, comparing each output with expected
+void compileUntil(Source *source, u8 *expected, u32 expectedSize, f64 deadline, ParallelRun *run)
+{
+    do
+    {
+        u8 *module;
+        u32 moduleSize = compileNative(source->text, source->length, &module);
+        if (moduleSize != expectedSize || memcmp(module, expected, expectedSize) != 0)
+        {
+            ++run->mismatchCount;
+        }
+        ++run->compileCount;
+    } while (now() < deadline);
+}
+
+struct Output
+{
+    u32 size;
+    u64 hash;
+};
+
+/* Edit the program of generateFunctions by changing a constant in one function, compile it, and repeat with the next
+function.  Makes as many edits as outputs holds, or keeps adding edits until seconds have passed or MAX_EDITS are
+made if it holds none, and records the size and a hash of each output.  returns the fastest compilation */
+#define MAX_EDITS 4096
+
+f64 recompileAfterEdits(Source *source, u32 scale, f64 seconds, std::vector<Output> *outputs)
+{
+    f64 fastest = 1e30;
+    f64 start = now();
+    u32 editCount = outputs->size();
+
+    bool isTimed = editCount == 0;
+    if (isTimed)
+    {
+        editCount = MAX_EDITS;
+    }
+
+    for (u32 edit = 0; edit < editCount && (!isTimed || edit == 0 || now() - start < seconds); ++edit)
+    {
+        //the first line of every function is float t = a * 2.0f, and each edit flips its constant between 2 and 3
+        char header[32];
+        snprintf(header, sizeof(header), "void fn%u(", edit * 7 % scale);
+        char *function = strstr(source->text, header);
+        char *constant = function ? strstr(function, "a * ") : nullptr;
+        if (constant == nullptr)
+        {
+            fprintf(stderr, "could not find the constant of %s\n", header);
+            exit(1);
+        }
+        constant += 4;
+        *constant = *constant == '2' ? '3' : '2';
+
+        u8 *module;
+        f64 runStart = now();
+        u32 moduleSize = compileNative(source->text, source->length, &module);
+        f64 elapsed = now() - runStart;
+        if (elapsed < fastest)
+        {
+            fastest = elapsed;
+        }
+
+        Output output = {moduleSize, 14695981039346656037ull};
+        for (u32 i = 0; i < moduleSize; ++i)
+        {
+            output.hash = (output.hash ^ module[i]) * 1099511628211ull;
+        }
+
+        if (isTimed)
+        {
+            outputs->push_back(output);
+        }
+        else
+        {
+            (*outputs)[edit] = output;
+        }
+    }
+
+    return fastest;
+}
+
+int main(int argc, char **argv)
+{
+    u32 largestScale = argc > 1 ? atoi(argv[1]) : 1024;
+    f64 secondsPerCase = argc > 2 ? atof(argv[2]) : 0.25;
+
+    Shape shapes[] = {
+        {"functions", generateFunctions, 16},
+        {"scopes", generateScopes, 16},
+        {"expressions", generateExpressions, 16},
+        {"cout", generateCout, 16},
+    };
+
+    printf("%-12s %7s %11s %8s %11s %10s %12s %10s\n", "shape", "scale", "source KB", "runs", "MB/s", "funcs/s",
+           "peak mem KB", "out/src");
+
+    Source source = {};
+    for (Shape &shape : shapes)
+    {
+        for (u32 scale = shape.smallestScale; scale <= largestScale; scale *= 4)
+        {
+            source.length = 0;
+            source.funcCount = 0;
+            shape.generate(&source, scale);
+
+            //repeat the compilation until the case has run long enough to time, keeping the fastest run
+            u8 *module;
+            u32 moduleSize = 0;
+            u32 runs = 0;
+            f64 fastest = 1e30;
+            f64 start = now();
+            do
+            {
+                f64 runStart = now();
+                moduleSize = compileNative(source.text, source.length, &module);
+                f64 elapsed = now() - runStart;
+                if (elapsed < fastest)
+                {
+                    fastest = elapsed;
+                }
+                ++runs;
+            } while (now() - start < secondsPerCase);
+
+            if (module == nullptr || moduleSize == 0)
+            {
+                printf("%-12s %7u failed to compile\n", shape.name, scale);
+                continue;
+            }
+
+            printf("%-12s %7u %11.1f %8u %11.2f %10.0f %12llu %10.3f\n", shape.name, scale, source.length / 1024.0,
+                   runs, source.length / fastest / 1e6, source.funcCount / fastest,
+                   getPeakMemoryUse() / 1024, (f64)moduleSize / source.length);
+        }
+    }
+
+    //compile one program on more and more threads at once.  Each thread has its own compiler state, so the throughput
+    //should grow with the thread count and every output should match
+    source.length = 0;
+    source.funcCount = 0;
+    generateFunctions(&source, 256);
+
+    u8 *module;
+    u32 expectedSize = compileNative(source.text, source.length, &module);
+    u8 *expected = (u8 *)malloc(expectedSize);
+    memcpy(expected, module, expectedSize);
+
+    printf("\n%-8s %10s %11s %10s\n", "threads", "compiles", "MB/s", "mismatches");
+
+    u32 threadLimit = argc > 3 ? atoi(argv[3]) : std::thread::hardware_concurrency();
+    for (u32 threadCount = 1; threadCount <= threadLimit; threadCount *= 2)
+    {
+        std::vector<ParallelRun> runs(threadCount, ParallelRun{});
+        std::vector<std::thread> threads;
+
+        f64 start = now();
+        for (u32 i = 0; i < threadCount; ++i)
+        {
+            threads.emplace_back(compileUntil, &source, expected, expectedSize, start + secondsPerCase, &runs[i]);
+        }
+
+        u32 compileCount = 0;
+        u32 mismatchCount = 0;
+        for (u32 i = 0; i < threadCount; ++i)
+        {
+            threads[i].join();
+            compileCount += runs[i].compileCount;
+            mismatchCount += runs[i].mismatchCount;
+        }
+
+        f64 elapsed = now() - start;
+        printf("%-8u %10u %11.2f %10u\n", threadCount, compileCount, (f64)source.length * compileCount / elapsed / 1e6,
+               mismatchCount);
+    }
+
+    //write the function bodies of one large program on more and more threads
+    source.length = 0;
+    source.funcCount = 0;
+    generateFunctions(&source, largestScale);
+
+    expectedSize = compileNative(source.text, source.length, &module);
+    expected = (u8 *)realloc(expected, expectedSize);
+    memcpy(expected, module, expectedSize);
+
+    printf("\n%-15s %11s %8s %10s\n", "codegen threads", "MB/s", "speedup", "mismatches");
+
+    f64 serialTime = 0;
+    for (u32 threadCount = 1; threadCount <= threadLimit; threadCount *= 2)
+    {
+        setCodegenThreadCount(threadCount);
+
+        u32 mismatchCount = 0;
+        f64 fastest = 1e30;
+        f64 start = now();
+        do
+        {
+            f64 runStart = now();
+            u32 moduleSize = compileNative(source.text, source.length, &module);
+            f64 elapsed = now() - runStart;
+            if (elapsed < fastest)
+            {
+                fastest = elapsed;
+            }
+
+            if (moduleSize != expectedSize || memcmp(module, expected, expectedSize) != 0)
+            {
+                ++mismatchCount;
+            }
+        } while (now() - start < secondsPerCase);
+
+        if (threadCount == 1)
+        {
+            serialTime = fastest;
+        }
+
+        printf("%-15u %11.2f %8.2f %10u\n", threadCount, source.length / fastest / 1e6, serialTime / fastest,
+               mismatchCount);
+    }
+    setCodegenThreadCount(1);
+
+    //recompile the same program after editing one function at a time, first from scratch and then reusing the bodies
+    //of the other functions from the code cache, and compare the outputs of both
+    printf("\n%-15s %11s %8s %10s\n", "edits", "MB/s", "speedup", "mismatches");
+
+    std::vector<Output> outputs;
+    f64 fullTime = recompileAfterEdits(&source, largestScale, secondsPerCase, &outputs);
+
+    source.length = 0;
+    source.funcCount = 0;
+    generateFunctions(&source, largestScale);
+
+    setCodeCacheEnabled(true);
+    compileNative(source.text, source.length, &module);
+    std::vector<Output> cachedOutputs(outputs.size());
+    f64 cachedTime = recompileAfterEdits(&source, largestScale, 0, &cachedOutputs);
+    setCodeCacheEnabled(false);
+
+    u32 mismatchCount = 0;
+    for (u32 i = 0; i < outputs.size(); ++i)
+    {
+        mismatchCount += outputs[i].size != cachedOutputs[i].size || outputs[i].hash != cachedOutputs[i].hash;
+    }
+
+    printf("%-15s %11.2f %8.2f %10s\n", "from scratch", source.length / fullTime / 1e6, 1.0, "");
+    printf("%-15s %11.2f %8.2f %10u\n", "cached", source.length / cachedTime / 1e6, fullTime / cachedTime,
+           mismatchCount);
+
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("max resident set size: %ld KB\n", usage.ru_maxrss);
+
+    free(expected);
+    free(source.text);
+    return 0;
+}
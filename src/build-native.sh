@@ -0,0 +1,18 @@
+# builds the compiler as a native library and links it into the batch compiler cppc and the benchmark
+# usage: bash build-native.sh [output directory]
+cd "$(dirname "$0")"
+out="${1:-.}"
+
+for program in cli:cppc benchmark:benchmark; do
+    ${CXX:-c++} \
+       -std=c++14 \
+       -O3 \
+       -fno-builtin \
+       -pthread \
+       -Wall \
+       -Wextra \
+       -o "$out/${program#*:}" \
+       cpp.cpp \
+       native-host.cpp \
+       "${program%:*}.cpp"
+done
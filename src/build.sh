@@ -3,14 +3,13 @@
    -std=c++14 \
    -O3 \
    -flto \
-   -Ofast \
    -nostdlib \
    -ffreestanding \
    -fno-builtin \
    -Wl,--no-entry \
    -Wl,--allow-undefined \
-   -Wl,--initial-memory=$[65536*10] \
-   -Wl,--max-memory=$[65536*10] \
+   -Wl,--initial-memory=$[65536*2] \
+   -Wl,--max-memory=$[65536*32768] \
    -Wl,--strip-all \
    -Wl,--export-dynamic \
    -Wl,--export=__heap_base \
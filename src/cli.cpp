@@ -0,0 +1,285 @@
+/* Compiles .cpp files to .wasm files outside the browser, on every core.  Each argument is a source file, or a directory
+whose .cpp files are all compiled.  Every worker thread takes the next file, maps it into its own compiler memory,
+compiles it, and writes the module straight from that memory, so the source code and the output are never copied.
+The errors of each file are printed after all of them are compiled, every line prefixed with the file's path.
+Usage: cppc [-j threads] [-o output directory] [-e export,names] files or directories... */
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "native-host.h"
+
+struct Job
+{
+    std::string sourcePath;
+    std::string outputPath;
+    std::string diagnostics;
+    u32 sourceSize;
+    u32 outputSize;
+    f64 seconds;
+    bool succeeded;
+};
+
+struct Options
+{
+    const char *outputDirectory;
+    const char *exportNames;
+    u32 threadCount;
+};
+
+f64 now()
+{
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+bool endsWith(const std::string &text, const char *suffix)
+{
+    size_t length = strlen(suffix);
+    return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+void addJob(std::vector<Job> *jobs, const std::string &sourcePath, const Options *options)
+{
+    Job job = {};
+    job.sourcePath = sourcePath;
+
+    //foo/bar.cpp becomes foo/bar.wasm, or bar.wasm in the output directory
+    std::string name = endsWith(sourcePath, ".cpp") ? sourcePath.substr(0, sourcePath.size() - 4) : sourcePath;
+    if (options->outputDirectory)
+    {
+        size_t slash = name.rfind('/');
+        std::string fileName = slash == std::string::npos ? name : name.substr(slash + 1);
+        name = std::string(options->outputDirectory) + "/" + fileName;
+    }
+    job.outputPath = name + ".wasm";
+
+    jobs->push_back(job);
+}
+
+//the .cpp files directly inside a directory, in name order so the summary is the same from run to run
+void addDirectoryJobs(std::vector<Job> *jobs, const char *path, const Options *options)
+{
+    DIR *directory = opendir(path);
+    if (directory == nullptr)
+    {
+        perror(path);
+        return;
+    }
+
+    std::vector<std::string> names;
+    while (dirent *entry = readdir(directory))
+    {
+        if (endsWith(entry->d_name, ".cpp"))
+        {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(directory);
+
+    std::sort(names.begin(), names.end());
+    for (const std::string &name : names)
+    {
+        addJob(jobs, std::string(path) + "/" + name, options);
+    }
+}
+
+//whether two jobs write the same output, printing each pair that does.  The threads would race on the file
+bool hasOutputCollision(std::vector<Job> *jobs)
+{
+    std::vector<const Job *> sorted;
+    for (const Job &job : *jobs)
+    {
+        sorted.push_back(&job);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const Job *a, const Job *b) { return a->outputPath < b->outputPath; });
+
+    bool hasCollision = false;
+    for (size_t i = 1; i < sorted.size(); ++i)
+    {
+        if (sorted[i]->outputPath == sorted[i - 1]->outputPath)
+        {
+            fprintf(stderr, "%s and %s would both be written to %s\n", sorted[i - 1]->sourcePath.c_str(),
+                    sorted[i]->sourcePath.c_str(), sorted[i]->outputPath.c_str());
+            hasCollision = true;
+        }
+    }
+    return hasCollision;
+}
+
+bool writeOutput(const char *path, u8 *module, u32 size)
+{
+    int file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file == -1)
+    {
+        perror(path);
+        return false;
+    }
+
+    while (size > 0)
+    {
+        ssize_t written = write(file, module, size);
+        if (written <= 0)
+        {
+            perror(path);
+            close(file);
+            return false;
+        }
+        module += written;
+        size -= written;
+    }
+
+    return close(file) == 0;
+}
+
+//print the errors of a job to stderr, beginning each line with the path of its source file
+void printDiagnostics(const Job *job)
+{
+    size_t lineStart = 0;
+    while (lineStart < job->diagnostics.size())
+    {
+        size_t lineEnd = job->diagnostics.find('\n', lineStart);
+        if (lineEnd == std::string::npos)
+        {
+            lineEnd = job->diagnostics.size();
+        }
+
+        fprintf(stderr, "%s: %.*s\n", job->sourcePath.c_str(), (int)(lineEnd - lineStart),
+                job->diagnostics.c_str() + lineStart);
+        lineStart = lineEnd + 1;
+    }
+}
+
+void runJobs(std::vector<Job> *jobs, std::atomic<u32> *nextJob, const Options *options)
+{
+    for (u32 i = (*nextJob)++; i < jobs->size(); i = (*nextJob)++)
+    {
+        Job *job = &(*jobs)[i];
+
+        //the export roots only last for one compilation
+        if (options->exportNames)
+        {
+            setExportRoots((char *)options->exportNames, strlen(options->exportNames));
+        }
+
+        struct stat status;
+        job->sourceSize = stat(job->sourcePath.c_str(), &status) == 0 ? status.st_size : 0;
+
+        f64 start = now();
+        u8 *module;
+        bool hasErrors;
+        job->outputSize = compileFile(job->sourcePath.c_str(), &module, &hasErrors);
+        job->seconds = now() - start;
+        job->diagnostics = getDiagnostics();
+
+        //a module with errors is not written, so an older output is never mistaken for a new one that compiled
+        job->succeeded = !hasErrors && writeOutput(job->outputPath.c_str(), module, job->outputSize);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options = {};
+    options.threadCount = std::thread::hardware_concurrency();
+
+    std::vector<Job> jobs;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        if (strcmp(arg, "-j") == 0 && i + 1 < argc)
+        {
+            options.threadCount = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "-o") == 0 && i + 1 < argc)
+        {
+            options.outputDirectory = argv[++i];
+        }
+        else if (strcmp(arg, "-e") == 0 && i + 1 < argc)
+        {
+            options.exportNames = argv[++i];
+        }
+        else
+        {
+            struct stat status;
+            if (stat(arg, &status) == 0 && S_ISDIR(status.st_mode))
+            {
+                addDirectoryJobs(&jobs, arg, &options);
+            }
+            else
+            {
+                addJob(&jobs, arg, &options);
+            }
+        }
+    }
+
+    if (jobs.empty())
+    {
+        fprintf(stderr, "usage: %s [-j threads] [-o output directory] [-e export,names] files or directories...\n",
+                argv[0]);
+        return 1;
+    }
+
+    //-o puts every output directly in one directory, so a/main.cpp and b/main.cpp would both write main.wasm
+    if (hasOutputCollision(&jobs))
+    {
+        return 1;
+    }
+
+    if (options.threadCount < 1)
+    {
+        options.threadCount = 1;
+    }
+    if (options.threadCount > jobs.size())
+    {
+        options.threadCount = jobs.size();
+    }
+
+    f64 start = now();
+    std::atomic<u32> nextJob(0);
+    std::vector<std::thread> threads;
+    for (u32 i = 0; i < options.threadCount; ++i)
+    {
+        threads.emplace_back(runJobs, &jobs, &nextJob, &options);
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    f64 elapsed = now() - start;
+
+    for (const Job &job : jobs)
+    {
+        printDiagnostics(&job);
+    }
+
+    u64 totalSourceSize = 0;
+    u64 totalOutputSize = 0;
+    u32 failureCount = 0;
+    for (const Job &job : jobs)
+    {
+        printf("%10.3f ms %9u B -> %9u B  %s%s\n", job.seconds * 1e3, job.sourceSize, job.outputSize,
+               job.outputPath.c_str(), job.succeeded ? "" : "  FAILED");
+
+        totalSourceSize += job.sourceSize;
+        totalOutputSize += job.outputSize;
+        failureCount += !job.succeeded;
+    }
+
+    printf("%zu files, %llu B -> %llu B in %.3f ms on %u threads, %.2f MB/s\n", jobs.size(), totalSourceSize,
+           totalOutputSize, elapsed * 1e3, options.threadCount, totalSourceSize / elapsed / 1e6);
+
+    return failureCount != 0;
+}
@@ -1,19 +1,54 @@
-#define EXPORT __attribute__((visibility("default"))) extern "C"
+#define EXPORT extern "C" __attribute__((visibility("default")))
 #define IMPORT extern "C"
 #define PRINT_LIT(lit) puts((char *)lit, sizeof(lit) - 1)
+#define PRINT_ERROR(lit) (++errorCount, PRINT_LIT(lit)) //the first line of each error message
 // #define memcpy __builtin_memcpy
 // #define memset __builtin_memset
 #define HASH(lit) djb_hash((char *)lit)
+#define NONE ((u32)-1) //an index or count that is not there, such as the value of a name lookupSymbol did not find
+#define STDOUT_RING_CAPACITY 4096 //must be a power of 2
+#define DRAW_LIST_CAPACITY 4096 //in commands
+#define ARENA_ALLOC(type, count) ((type *)arenaAlloc(sizeof(type) * (count)))
 #define INSERT_LIT(lit, writePos)           \
     *writePos++ = sizeof(lit) - 1;          \
     memcpy(writePos, lit, sizeof(lit) - 1); \
     writePos += sizeof(lit) - 1;
 
+/* Everything a compilation changes is declared with COMPILER_STATE(type, name), followed by an initializer if it has
+one.  A native host gives each of its threads its own copy, so it can run one compilation per thread at the same time.
+A wasm instance is single threaded and runs one compilation at a time, so there the state is ordinary globals that
+getWasmFromCpp resets at the start of each compilation.  A host that wants several independent compilers in one
+instance or on one thread keeps each in a CompilerContext.  The macro numbers each variable as it declares it, so a
+context copies every variable of the state without a list of them to keep up to date.  The type of an array is a
+typedef, since the macro needs the type and the name apart */
+#ifdef __wasm__
+#define THREAD_STATE
+#else
+#define THREAD_STATE thread_local
+#endif
+
+#define COMPILER_STATE(type, name) DECLARE_COMPILER_STATE(type, name, __COUNTER__)
+#define DECLARE_COMPILER_STATE(type, name, index) \
+    extern THREAD_STATE type name;                \
+    template <> struct CompilerStateVar<index>    \
+    {                                             \
+        static void *address() { return &name; }  \
+        enum : u32                                \
+        {                                         \
+            size = sizeof(type),                  \
+            alignment = alignof(type)             \
+        };                                        \
+    };                                            \
+    THREAD_STATE type name
+
 #include "wasm_definitions.h"
 
+//the variable of the compiler state numbered index by COMPILER_STATE
+template <u32 index> struct CompilerStateVar;
+
 struct Token
 {
-    enum Type
+    enum Type : u8
     {
         Symbol,
         Number,
@@ -22,10 +57,23 @@ struct Token
         StringLit,
     };
 
-    char *start, *end;
+    //tokens are packed into 16 bytes so the whole stream stays small and cache friendly
+    u64 hash;   //djb hash of the token's characters, computed once while lexing
+    u32 offset; //index of the first character of the token within the source code
+    u16 length;
     Token::Type type;
 };
 
+struct FuncHeader
+{
+    u64 nameHash;
+    char *nameStart;
+    u16 nameLength;
+    u32 typeIndex;
+    bool isExported;
+    bool isCalled; //imports: whether a function in the module calls it
+};
+
 struct ParsingMode
 {
     enum Mode
@@ -35,17 +83,48 @@ struct ParsingMode
     };
 };
 
-extern u8 __data_end;
-extern u8 __heap_base;
-
+#ifdef __wasm__
 IMPORT void puts(char *address, u32 size);
 IMPORT void put(u32 character);
 IMPORT void putu32(u32 num);
 IMPORT void puti32(i32 num);
 
-void print(Token token)
+//linear memory begins at address 0, so the end of it is its size in 64 KiB pages
+u8 *getMemoryEnd()
+{
+    return (u8 *)(__builtin_wasm_memory_size(0) << 16);
+}
+
+bool growMemory(u32 pageCount)
+{
+    return __builtin_wasm_memory_grow(0, pageCount) != (u32)-1;
+}
+#else
+//the C library already defines puts, so a native host provides the imports under other names.  See native-host.cpp
+IMPORT void puts(char *address, u32 size) __asm__("hostPuts");
+IMPORT void put(u32 character) __asm__("hostPut");
+IMPORT void putu32(u32 num) __asm__("hostPutu32");
+IMPORT void puti32(i32 num) __asm__("hostPuti32");
+
+//a native host stands in for linear memory with one reservation that grows in place
+IMPORT u8 *getMemoryEnd() __asm__("hostGetMemoryEnd");
+IMPORT bool growMemory(u32 pageCount) __asm__("hostGrowMemory");
+#endif
+
+COMPILER_STATE(char *, sourceStart);
+COMPILER_STATE(char *, sourceEnd);
+
+//how many errors the compilation printed.  The output of a compilation with errors is not a usable module
+COMPILER_STATE(u32, errorCount);
+
+char *getTokenText(Token *token)
+{
+    return sourceStart + token->offset;
+}
+
+void print(Token *token)
 {
-    puts(token.start, token.end - token.start);
+    puts(getTokenText(token), token->length);
 }
 
 //Clang 10 appears to no longer provide a default implementation of memcpy or memset when targeting WebAssembly
@@ -60,28 +139,498 @@ void memcpy(void *destination, const void *source, u32 length)
     }
 }
 
-char *readPos, *endReadPos;
-u8 *writePos;
+void memset(void *destination, u8 value, u32 length)
+{
+    u8 *dest = (u8 *)destination;
+
+    for (u32 i = 0; i < length; ++i)
+    {
+        dest[i] = value;
+    }
+}
+
+i32 memcmp(const void *a, const void *b, u32 length)
+{
+    u8 *lhs = (u8 *)a;
+    u8 *rhs = (u8 *)b;
+
+    for (u32 i = 0; i < length; ++i)
+    {
+        if (lhs[i] != rhs[i])
+        {
+            return lhs[i] - rhs[i];
+        }
+    }
+
+    return 0;
+}
+
+/* Bump allocator over the end of linear memory.  Everything a compilation needs is allocated here, and the whole
+arena is released at once by resetting arenaPos before the next compilation.  Linear memory is only grown when an
+allocation does not fit, so small programs never pay for the memory a large program would need */
+COMPILER_STATE(u8 *, arenaPos);
+COMPILER_STATE(u8 *, arenaEnd);
+
+/* Set once linear memory could not grow.  Nothing is written past arenaEnd after that: every caller of reserveMemory
+and arenaAlloc checks for failure before writing, and getWasmFromCpp stops at its next check and returns an empty
+module instead of a truncated one */
+COMPILER_STATE(bool, isOutOfMemory);
+
+//grow linear memory if needed so every address below end is usable.  Returns false if it could not
+bool reserveMemory(u8 *end)
+{
+    if (end <= arenaEnd)
+    {
+        return true;
+    }
+
+    if (isOutOfMemory)
+    {
+        return false;
+    }
+
+    u32 pagesNeeded = (u32)(end - arenaEnd + 0xFFFF) >> 16;
+
+    //grow in steps of at least 1 MiB so that long outputs do not call memory.grow for every function, but settle for
+    //the pages needed when the memory cannot grow by that much
+    bool isGrown = pagesNeeded < 16 && growMemory(16);
+    if (!isGrown && !growMemory(pagesNeeded))
+    {
+        isOutOfMemory = true;
+        PRINT_ERROR("Out of memory\n");
+        return false;
+    }
+
+    arenaEnd = getMemoryEnd();
+    return true;
+}
+
+//returns nullptr, and allocates nothing, once memory runs out
+void *arenaAlloc(u32 size)
+{
+    //keep every allocation 8 byte aligned so u64 fields can be accessed directly
+    u8 *allocation = (u8 *)(((uptr)arenaPos + 7) & -8);
+    if (!reserveMemory(allocation + size))
+    {
+        return nullptr;
+    }
+
+    arenaPos = allocation + size;
+    return allocation;
+}
+
+//every pass after lexing walks the token stream instead of the source code
+COMPILER_STATE(Token *, readPos);
+COMPILER_STATE(Token *, endReadPos);
+COMPILER_STATE(u8 *, writePos);
+
+/* Open addressing hash table that maps identifier hashes to indexes.  Collisions are resolved by linear probing.
+A key of 0 marks an empty slot, and a value of NONE marks a name that was declared but has since gone out of scope */
+struct SymbolTable
+{
+    u64 *keys;
+    u32 *values;
+    u32 capacity; //must be a power of 2
+    u32 count;
+};
+
+//remembers what a local variable name referred to before it was shadowed, so leaving a scope can restore it
+struct ShadowedSymbol
+{
+    u64 hash;
+    u32 previousValue;
+};
+
+/* Every table below is allocated from the arena once the token stream reveals how large each one needs to be.
+Tables that hold local variables are sized for the largest function and reused by every function */
+COMPILER_STATE(u8 *, varTypes);
+
+COMPILER_STATE(SymbolTable, localVars);
+
+/* Each local variable, promoted global and temporary first gets a local of its own, then allocateLocals assigns
+locals whose live ranges don't overlap to the same slot.  A position in the IR is 2i for the values hoisted before
+instruction i and 2i + 1 for everything else instruction i computes */
+COMPILER_STATE(u32 *, liveRangeStarts);
+COMPILER_STATE(u32 *, liveRangeEnds);
+COMPILER_STATE(u32 *, localsByStart);
+COMPILER_STATE(u32 *, positionCounts);
+COMPILER_STATE(u32 *, allocatedLocals); //slot of each local, then the index of the slot's local in the output
+
+struct LocalSlot
+{
+    u8 wasmType;
+    u32 index; //position among the slots of the same type
+    u32 liveUntil; //end of the live range last assigned to the slot
+};
+COMPILER_STATE(LocalSlot *, localSlots);
+
+COMPILER_STATE(ShadowedSymbol *, shadowedLocalVars);
+COMPILER_STATE(u32, shadowedLocalVarCount);
+
+/* Global variables can't have their address taken, so each one is a mutable wasm global rather than a location in
+memory.  Their indexes in the Global section match their indexes here, and a constant initializer becomes the
+initializer expression of the wasm global, so no code has to run to initialize them */
+COMPILER_STATE(SymbolTable, globalVars);
+
+COMPILER_STATE(u8 *, globalVarTypes);
+COMPILER_STATE(u64 *, globalVarInitialValues); //bits of each global's initial value as its own type
+COMPILER_STATE(u32, globalVarCount);
+
+//parameters and local variables declared so far in the current function, which each have a local of their own until
+//allocateLocals finds which can share one
+COMPILER_STATE(u32, localVarCount);
+
+/* scope bookkeeping used by buildFunctionIR, one entry per level of nested braces.  The initializer of a for loop is a
+scope of its own around the loop's body, so there can be up to twice as many scopes as levels of braces */
+struct ScopeKind
+{
+    enum
+    {
+        Plain,
+        IfBody,
+        LoopBody,
+        DoWhileBody,
+        ForInit,
+        SwitchBody,
+    };
+};
+
+COMPILER_STATE(u32 *, shadowedLocalVarCountAtScopeStart);
+COMPILER_STATE(u8 *, scopeKinds);
+
+//imported and locally defined functions share one index space
+COMPILER_STATE(SymbolTable, funcs);
+
+COMPILER_STATE(u32 *, funcSigs);
+COMPILER_STATE(u32, funcCount); //sum of both imported and locally defined
+
+//store the locations in memory that define the name of the functions, the length of the name, and the corresponding type
+COMPILER_STATE(FuncHeader *, importedFuncs);
+COMPILER_STATE(u32, importedFuncCount);
+
+//record the function signatures of each function defined inside the wasm module, in order
+COMPILER_STATE(FuncHeader *, localFuncs);
+COMPILER_STATE(u32, localFuncCount);
+
+//first token (the return type) of each locally defined function, indexed by local function index
+COMPILER_STATE(Token **, funcDefinitions);
+COMPILER_STATE(u64 *, functionKeys); //code cache key of each local function
+COMPILER_STATE(u32 *, functionBodySizes); //size of each local function's body in the Code section
+
+/* A call statement to a small function is replaced with the function's body, in a scope of its own where each
+parameter is a new local variable initialized with its argument.  A function is inlined when its parameters and body
+are at most MAX_INLINED_BODY_LENGTH tokens once the calls inside it are inlined too, and when it doesn't reach itself
+through any chain of calls.  Every call to an inlined function is inlined, so it is left out of the module unless
+it is exported */
+#define MAX_INLINED_BODY_LENGTH 48
+
+struct InlineState
+{
+    enum
+    {
+        Unmeasured,
+        Measuring,
+        Inlinable,
+        NotInlinable,
+    };
+};
+
+struct InlineCandidate
+{
+    Token *params; //the open parenthesis of the parameter list
+    Token *body; //the open brace of the body
+    Token *bodyEnd; //the close brace of the body
+    u32 expandedLength; //tokens in the parameters and body once the calls inside are inlined
+    u32 expandedDepth; //levels of braces in the body once expanded
+    u32 expandedTypeNames; //type names in the parameters and body once expanded, an upper bound on its variables
+    u32 stackIndex; //position in inlineStack while the function is measured
+    u8 state;
+    bool isRecursive;
+    bool isReachable; //whether an exported function calls it through any chain of calls
+};
+
+COMPILER_STATE(InlineCandidate *, inlineCandidates);
+COMPILER_STATE(SymbolTable, inlineCandidateNames); //index of the candidate defining each function name
+COMPILER_STATE(u32 *, inlineStack); //the functions being measured, each called by the one before it
+COMPILER_STATE(u32, inlineStackDepth);
+
+//variables with a lower index belong to the function an inlined body is lowered into, so the body can't see them
+COMPILER_STATE(u32, firstVisibleLocal);
+
+/* Each function body is lowered to an IR before any code is written.  Statements become a flat list of instructions,
+and the body of each if statement or loop is a block nested inside the block that contains it.
+Expressions are value numbered: every distinct value computed by a function is one ExprNode, so an expression that
+appears twice with the same operands becomes one node with two uses.  Reading a variable produces a different value
+after each store to it, which is tracked with a version number per variable.
+The IR is sized from the longest function body, since each token produces at most two nodes and two instructions,
+plus as many again for moving promoted globals between wasm globals and locals */
+struct ExprNode
+{
+    enum Kind : u8 {
+        Const,
+        LocalVar,
+        GlobalVar,
+        BinaryOp,
+        Intrinsic, //a math function computed by wasm instructions
+        Select, //the ?: operator
+    };
+
+    Kind kind;
+    u8 wasmType; //type of the value this node leaves on the stack
+    u8 operandType; //BinaryOp and Intrinsic: type the operands are converted to before the operation
+    u8 wasmOp; //Intrinsic: the instruction applied to the operands
+    Token *op; //BinaryOp: the operator token
+    ExprNode *lhs; //Select: the value when condition is true
+    ExprNode *rhs; //nullptr for an Intrinsic of one operand.  Select: the value when condition is false
+    ExprNode *condition; //Select: chooses between the operands
+    union {
+        i32 i32Value;
+        i64 i64Value; //also the bits of a Const of any type, since the bits past a 32 bit value are 0
+        f32 f32Value;
+        f64 f64Value;
+        u32 varIndex; //LocalVar and GlobalVar
+    };
+    u32 version; //LocalVar and GlobalVar: which value of the variable is read
+
+    u32 block; //outermost block where the value is available, which is only ever moved outward by hoisting
+    u32 useCount; //number of times the value is consumed by live instructions
+    u32 tempLocal; //local that keeps a value with several uses, or NONE
+    u32 tempBlock; //block where tempLocal was last assigned, or NONE if it hasn't been
+    u32 firstUse; //position in the IR of the first use of the value, or NONE if it has none, see liveRangeStarts
+    u32 lastUse;
+    struct IRInstr *hoistedBefore; //the if statement this value is computed before, or nullptr
+    ExprNode *nextHoisted; //next value computed just before the same if statement
+};
+
+struct IRInstr
+{
+    enum Kind : u8 {
+        StoreLocal,
+        StoreGlobal,
+        Arg, //push a value for the following Call
+        Call,
+        If, //begins the block numbered index
+        End,
+        Loop, //begins the block numbered index, which repeats until value is false.  value is nullptr for do while loops
+        EndLoop, //value is the condition of a do while loop, or nullptr to repeat unconditionally
+        Switch, //begins the block numbered index, and branches on value to one of its cases
+        Case, //begins the block numbered index, a run of statements in a switch that begins at case labels
+        EndCase,
+        EndSwitch,
+        Break, //leaves the loop or switch beginning the block numbered index
+    };
+
+    Kind kind;
+    u8 convertOp; //Arg and Call: instruction applied to the value left on the stack, or 0
+    u8 wasmType; //StoreLocal, StoreGlobal, and Arg: type the value is converted to
+    bool isLive; //stores are only written if they can be observed
+    bool isRead; //StoreGlobal: a load or the end of an if body may observe the stored value
+    u32 index; //variable, function, or block index
+    u32 block; //the block containing this instruction
+    u32 version; //stores: the version of the variable this store creates
+    ExprNode *value; //StoreLocal, StoreGlobal, and Arg: value to store or push.  If, Loop and EndLoop: the condition
+    ExprNode *hoisted; //If, Loop and Switch: values used both inside and after the body, computed before it
+};
+
+struct IRBlock
+{
+    u32 parent;
+    u32 depth;
+    u32 ifInstr; //the If, Loop, Switch or Case instruction that begins this block
+    u32 endInstr; //the instruction that ends this block, or NONE until it is added
+    u32 enclosingLoop; //the innermost loop holding this block, which is itself if it is a loop, or 0 outside loops
+    u32 undoStart; //first entry of the store log made inside this block
+    u32 localVarCountBefore; //locals from this index on are declared inside the block
+    u32 callVersionBefore; //lastCallVersion before the body, to find whether the body made calls
+    u64 staleGlobalsBefore; //promoted globals that were stale before the if
+    u64 dirtyGlobalsBefore; //promoted globals that were dirty before the if
+    u64 globalsInLocals; //loops and switches: promoted globals kept in their locals where paths through the block meet
+    Token *increment; //for loops: the increment expression, which is lowered after the body
+    bool hasBreak; //loops and switches: whether a break leaves the block
+    bool isJumpTable; //switches: whether the cases are dense enough to dispatch with br_table instead of comparisons
+    u32 breakLabel; //loops and switches: nesting depth of the wasm block that a break leaves, while the function is written
+    u32 firstCase; //switches: the case labels are switchCases[firstCase] onward, sorted by value
+    u32 caseCount;
+    u32 segmentCount; //switches: number of cases, counting consecutive labels as one
+    u32 defaultSegment; //switches: the case with the default label, or segmentCount if there isn't one
+};
+
+struct SwitchCase
+{
+    i64 value; //i32 values are sign extended
+    u32 segment;
+};
+
+//every store is logged so that leaving an if body can find which variables may have changed
+struct StoreLogEntry
+{
+    bool isGlobal;
+    u32 varIndex;
+    IRInstr *previousStore;
+};
+
+#define SCRATCH_NODE_COUNT 2 //nodes past the last one, see newCandidate
+COMPILER_STATE(ExprNode *, exprNodes);
+COMPILER_STATE(u32, exprNodeCount);
+COMPILER_STATE(SymbolTable, valueNumbers);
+COMPILER_STATE(u32, maxValueNumbersCapacity);
+
+COMPILER_STATE(IRInstr *, instrs);
+COMPILER_STATE(u32, instrCount);
+
+COMPILER_STATE(IRBlock *, blocks);
+COMPILER_STATE(u32, blockCount);
+COMPILER_STATE(u32, currentBlock);
+
+COMPILER_STATE(StoreLogEntry *, storeLog);
+COMPILER_STATE(u32, storeLogCount);
+
+COMPILER_STATE(SwitchCase *, switchCases);
+COMPILER_STATE(u32, switchCaseCount);
+
+/* Each loop and switch looks at the names used in its body when it begins, which would scan the rest of the function
+again at every level of nesting.  The body of the function being written is indexed once instead.  Every distinct
+use of a name, told apart by whether it is followed by = or (, lists where it occurs, so a long range of the body
+is summarized by looking up each use rather than reading each token.  The matching close of every open brace and
+parenthesis is found in the same pass.
+
+A name can only mean something in a range when it is a parameter, global or function, or when it occurs in the body
+before the range, where it is declared.  Ranges are looked at in order through the body, so the uses that can mean
+something are kept between ranges, each added once its name has occurred and dropped once it cannot occur again.  A
+loop nested in many others then only looks up the names it can see instead of every name used in the function */
+COMPILER_STATE(Token *, indexedBodyStart);
+COMPILER_STATE(Token *, indexedBodyEnd);
+COMPILER_STATE(u32 *, closingOffsets); //offset of the token closing each open token of the body, or NONE
+COMPILER_STATE(SymbolTable, nameUseIndexes); //index of each use, keyed by its name and the token after it
+COMPILER_STATE(u32, maxNameUseIndexesCapacity);
+COMPILER_STATE(u32, nameUseCount);
+COMPILER_STATE(u32 *, nameUseStarts); //the occurrences of use i are nameUsePositions[nameUseStarts[i]] onward
+COMPILER_STATE(u32 *, nameUsePositions); //offsets from indexedBodyStart, in order within each use
+COMPILER_STATE(u32 *, tokenNameUses); //use of each identifier of the body
+COMPILER_STATE(Token **, foundNameUses);
+COMPILER_STATE(u32 *, nameUseOrder); //the uses in the order their names start meaning something
+COMPILER_STATE(u32 *, nameUseVisibleFrom); //offset from which each use can mean something
+COMPILER_STATE(u32 *, visibleNameUses); //the uses that can mean something in the last range looked at
+COMPILER_STATE(u32, visibleNameUseCount);
+COMPILER_STATE(u32, nextVisibleNameUse); //the next entry of nameUseOrder to add to visibleNameUses
+COMPILER_STATE(u32, lastNameUseStart); //offset of the start of the last range looked at
+
+//versions are never reused, so a version number identifies one value of one variable across the whole compilation
+COMPILER_STATE(u32, versionCounter);
+COMPILER_STATE(u32, functionStartVersion);
+COMPILER_STATE(u32, lastCallVersion); //calls may change any global variable
+
+COMPILER_STATE(u32 *, localVersions);
+COMPILER_STATE(IRInstr **, lastLocalStores);
+
+COMPILER_STATE(u32 *, globalVersions);
+COMPILER_STATE(IRInstr **, lastGlobalStores);
+COMPILER_STATE(ExprNode **, globalValues); //value of the last store to each global, so reads after a store don't get_global
+
+/* Globals used more than once in a function are promoted to locals for the duration of the function.
+A promoted global is stale at the start of the function and after every call, meaning the wasm global holds its value.
+Reading a stale global loads it, and the load is reused until the global is stored to.  Stores only write the local
+and make the global dirty, meaning the wasm global is out of date until the local is written back before a call or at
+the end of the function.  Each promoted global is one bit of the stale and dirty masks */
+#define MAX_PROMOTED_GLOBALS 64
+COMPILER_STATE(u32 *, globalLocals); //local holding each global in the current function, or NONE if the global isn't promoted
+COMPILER_STATE(u32 *, globalAccessCounts);
+COMPILER_STATE(u32 *, globalAccessStamps); //which function each count belongs to, so the counts never need to be cleared
+COMPILER_STATE(u32 *, promotedGlobals);
+COMPILER_STATE(u32, promotedGlobalCount);
+COMPILER_STATE(u32, promotedGlobalsStart); //local holding the first promoted global
+COMPILER_STATE(u64, staleGlobals);
+COMPILER_STATE(u64, dirtyGlobals);
+COMPILER_STATE(ExprNode **, promotedValues); //load of each promoted global read since it was last stale, or nullptr if the local holds it
+COMPILER_STATE(ExprNode **, promotedValueStack); //promotedValues from before each enclosing if, by depth
+
+//every distinct string literal is stored once in the Data section, in the Strings region of memory.
+//stringLiterals maps the hash of a literal's token to its index in the offset and length arrays
+COMPILER_STATE(SymbolTable, stringLiterals);
+COMPILER_STATE(u32 *, stringLiteralOffsets);
+COMPILER_STATE(u32 *, stringLiteralLengths);
+COMPILER_STATE(u32, stringLiteralCount);
+COMPILER_STATE(u8 *, stringData);
+COMPILER_STATE(u32, stringDataSize);
+COMPILER_STATE(u32, stringDataAddress);
+
+/* Programs that include <iostream> format their output in wasm and append it to a ring buffer in their own memory.
+The host drains the ring when the module calls flushStdout, which is the only call std::cout makes out of the module.
+The ring starts with a 16 byte header (u32 read count, u32 write count, u32 capacity), followed by the ring's bytes and a
+32 byte scratch area used while formatting numbers */
+struct StdoutFunc
+{
+    enum
+    {
+        PutChar,
+        PutString,
+        PutI32,
+        PutI64,
+        PutF64,
+        Flush,
+        Count,
+    };
+};
+
+COMPILER_STATE(bool, hasStdout);
+COMPILER_STATE(u32, flushStdoutImport);
+COMPILER_STATE(u32, stdoutRingAddress);
+COMPILER_STATE(u32, stdoutFuncs); //function index of the first generated stdout function, in the order of StdoutFunc
+
+/* Programs that include <canvas> append draw commands to a list in their own memory instead of calling drawCircle.
+The host replays the whole list once per frame, or when the module calls flushDrawList because the list is full.
+The list starts with a 16 byte header (u32 command count, u32 capacity), followed by 16 byte commands */
+struct DrawFunc
+{
+    enum
+    {
+        Circle,
+        Count,
+    };
+};
 
-//limitation of max 64 local vars
-u64 varNameHashes[64];
-u8 varTypes[64];
+//the first field of every draw command, followed by that command's operands
+struct DrawCommand
+{
+    enum
+    {
+        Circle, //f32 x, f32 y, f32 radius
+    };
+};
 
-u64 globalVarNameHashes[64];
-u32 globalVarAddresses[64];
-u8 globalVarTypes[64];
-u32 globalVarCount;
+COMPILER_STATE(bool, hasDrawList);
+COMPILER_STATE(u32, flushDrawListImport);
+COMPILER_STATE(u32, drawListAddress);
+COMPILER_STATE(u32, drawFuncs); //function index of the first generated draw function, in the order of DrawFunc
+
+/* Everything the module keeps in memory is one region of a static layout, placed once the size of each is known.
+Regions are placed in order of increasing alignment, so padding is only needed where the alignment increases, and
+the string literals, whose addresses are constants in user code, get the shortest LEB128 encodings.  The address operand
+of every load and store into a region is 0 or a multiple of the region's alignment, so the alignment of a region and
+the offset of an access together give the access its alignment hint */
+struct DataRegion
+{
+    enum
+    {
+        StdoutRing,
+        DrawList,
+        Strings,
+        Count,
+    };
+};
 
-u8 varStartingIndexes[4] = {0};
-u8 varCountByType[4] = {0};
+typedef u32 DataRegionValues[DataRegion::Count];
+COMPILER_STATE(DataRegionValues, dataRegionSizes);
+COMPILER_STATE(DataRegionValues, dataRegionAlignments); //log2 of the alignment of each region
+COMPILER_STATE(DataRegionValues, dataRegionAddresses);
 
-//max 64 total imported and locally defined functions
-u64 funcNameHashes[64];
-u8 funcSigs[64];
-u8 funcCount; //sum of both imported and locally defined
+//functions generated by the compiler that follow the locally defined functions in the function index space
+COMPILER_STATE(u32, generatedFuncCount);
 
-//mapping between type index to encoded function signature
-u64 types[32];
+//mapping between type index to encoded function signature, plus a table to find the index of a signature
+COMPILER_STATE(u64 *, types);
+COMPILER_STATE(u32, typeCount);
+COMPILER_STATE(SymbolTable, signatures);
 
 u8 WASM_HEADER[] = {
     0x00, 0x61, 0x73, 0x6d, //magic numbers
@@ -111,8 +660,84 @@ constexpr u64 djb_hash(char *start, char *end)
     return hash;
 }
 
-constexpr u64 djb_hash(Token token) {
-    return djb_hash(token.start, token.end);
+void clearSymbolTable(SymbolTable *table)
+{
+    memset(table->keys, 0, sizeof(u64) * table->capacity);
+    table->count = 0;
+}
+
+//find the slot holding the given hash, or the empty slot where it belongs
+u32 findSymbolSlot(SymbolTable *table, u64 hash)
+{
+    u32 mask = table->capacity - 1;
+
+    //fold the high bits of the hash into the low bits since only the low bits select a slot
+    u32 slot = (u32)(hash ^ (hash >> 32)) * 0x9E3779B1u;
+
+    while (true)
+    {
+        slot &= mask;
+
+        if (table->keys[slot] == hash || table->keys[slot] == 0)
+        {
+            return slot;
+        }
+
+        ++slot;
+    }
+}
+
+//returns the value associated with the hash, or -1 if the name is not defined
+u32 lookupSymbol(SymbolTable *table, u64 hash)
+{
+    //0 marks empty slots, so remap the (very unlikely) hash of 0
+    hash += hash == 0;
+
+    u32 slot = findSymbolSlot(table, hash);
+    return table->keys[slot] == hash ? table->values[slot] : NONE;
+}
+
+//associate a value with the hash and return the value it replaces, or -1 if it is newly defined
+u32 defineSymbol(SymbolTable *table, u64 hash, u32 value)
+{
+    hash += hash == 0;
+
+    u32 slot = findSymbolSlot(table, hash);
+    if (table->keys[slot] == hash)
+    {
+        u32 previousValue = table->values[slot];
+        table->values[slot] = value;
+        return previousValue;
+    }
+
+    //keep the load factor at or below 1/2 so probe sequences stay short
+    if ((table->count + 1) * 2 > table->capacity)
+    {
+        PRINT_ERROR("Too many names defined, ignoring new name\n");
+        return NONE;
+    }
+
+    table->keys[slot] = hash;
+    table->values[slot] = value;
+    ++table->count;
+    return NONE;
+}
+
+//declare a local variable in the innermost scope, hiding any variable of the same name in an outer scope
+void declareLocalVar(u64 hash, u32 varIndex)
+{
+    u32 previousValue = defineSymbol(&localVars, hash, varIndex);
+    shadowedLocalVars[shadowedLocalVarCount++] = {hash, previousValue};
+}
+
+//forget every local variable declared since the scope began, restoring any names they shadowed
+void popLocalVarScope(u32 scopeStart)
+{
+    while (shadowedLocalVarCount > scopeStart)
+    {
+        ShadowedSymbol shadowed = shadowedLocalVars[--shadowedLocalVarCount];
+        defineSymbol(&localVars, shadowed.hash, shadowed.previousValue);
+    }
 }
 
 constexpr bool isalpha(char c)
@@ -135,95 +760,121 @@ constexpr bool isValidNonLeadingIDChar(char c)
     return isValidLeadingIDChar(c) || isdigit(c);
 }
 
-constexpr i32 stoi(char *start, char *end);
-constexpr f32 stof(char *start, char *end);
+constexpr i64 stol(char *start, char *end);
+f64 stod(char *start, char *end);
 
-//scan forward and find the next complete token
-Token nextToken(char *p)
+//scan through the source code once and append every token to the packed token stream
+Token *tokenize(char *p, char *end, Token *tokens)
 {
-    while (p < endReadPos && (*p == ' ' || *p == '\n' || *p == '\t'))
-    {
-        ++p;
-    }
+    Token *token = tokens;
 
-    Token token;
-    token.start = p;
-
-    if ((*p == '-' && (p[1] == '.' || isdigit(p[1]))) || *p == '.' || isdigit(*p))
+    while (true)
     {
-        //decimal places separate identifiers, but join numeric literals
-        token.type = Token::Number;
-
-        do
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\t' || *p == '\r'))
         {
             ++p;
-        } while (isdigit(*p) || *p == '.' || *p == 'f');
-    }
-    else if (*p == '\'')
-    {
-        token.type = Token::CharLit;
+        }
 
-        ++p;
-        if (*p == '\\')
+        if (p >= end)
         {
-            ++p;
+            break;
         }
-        p += 2;
-    }
-    else if (*p == '"')
-    {
-        token.type = Token::StringLit;
 
-        do
+        char *start = p;
+
+        //the token stream is the newest allocation in the arena, so it can grow in place
+        if (!reserveMemory((u8 *)(token + 1)))
+        {
+            break;
+        }
+
+        if ((*p == '-' && (p[1] == '.' || isdigit(p[1]))) || *p == '.' || isdigit(*p))
+        {
+            //decimal places separate identifiers, but join numeric literals
+            token->type = Token::Number;
+
+            do
+            {
+                ++p;
+            } while (p < end && (isdigit(*p) || *p == '.' || *p == 'f' || *p == 'l' || *p == 'L'));
+        }
+        else if (*p == '\'')
         {
-            //skip over escape sequences
+            token->type = Token::CharLit;
+
+            ++p;
             if (*p == '\\')
             {
                 ++p;
             }
-            ++p;
-        } while (*p != '"');
+            p += 2;
+        }
+        else if (*p == '"')
+        {
+            token->type = Token::StringLit;
 
-        ++p;
-    }
-    else if (isValidLeadingIDChar(*p))
-    {
-        token.type = Token::Identifier;
+            do
+            {
+                //skip over escape sequences
+                if (*p == '\\')
+                {
+                    ++p;
+                }
+                ++p;
+            } while (p < end && *p != '"');
 
-        do
-        {
             ++p;
-        } while (isValidNonLeadingIDChar(*p) || *p == ':'); //the : is to handle namespaces
-    }
-    else
-    {
-        token.type = Token::Symbol;
+        }
+        else if (isValidLeadingIDChar(*p))
+        {
+            token->type = Token::Identifier;
 
-        // check for repeating symbols representing two-character symbols
-        if ((*p == '-' || *p == '+' || *p == '&' || *p == '|' || *p == '<' || *p == '>') && *p == p[1])
+            //a pair of colons joins a namespace and the name in it, but a single colon ends a label
+            do
+            {
+                p += *p == ':' ? 2 : 1;
+            } while (p < end && (isValidNonLeadingIDChar(*p) || (*p == ':' && p + 1 < end && p[1] == ':')));
+        }
+        else
         {
+            token->type = Token::Symbol;
+
+            // check for repeating symbols representing two-character symbols
+            if ((*p == '-' || *p == '+' || *p == '&' || *p == '|' || *p == '<' || *p == '>') && *p == p[1])
+            {
+                ++p;
+            }
+
+            // -> is a valid two-character symbols
+            if (*p == '-' && p[1] == '>')
+            {
+                ++p;
+            }
+
             ++p;
         }
 
-        // -> is a valid two-character symbols
-        if (*p == '-' && *p + 1 == '>')
+        if (p > end)
         {
-            ++p;
+            //an unterminated literal ran off the end of the source code
+            p = end;
         }
 
-        ++p;
+        token->hash = djb_hash(start, p);
+        token->offset = start - sourceStart;
+        token->length = p - start;
+        ++token;
     }
 
-    token.end = p;
     return token;
 }
 
-u8 getWasmOpFromOperator(Token token, u8 wasmType)
+u8 getWasmOpFromOperator(Token *token, u8 wasmType)
 {
     // TODO finish list, recognize remainder of operators, move this into wasm_definitions.h
 
     if (wasmType == wasm::type::f32) {
-        switch (*token.start)
+        switch (*getTokenText(token))
         {
         case '+':
             return wasm::f32_add;
@@ -241,7 +892,7 @@ u8 getWasmOpFromOperator(Token token, u8 wasmType)
     }
 
     if (wasmType == wasm::type::i32) {
-        switch (*token.start)
+        switch (*getTokenText(token))
         {
         case '+':
             return wasm::i32_add;
@@ -258,49 +909,170 @@ u8 getWasmOpFromOperator(Token token, u8 wasmType)
         }
     }
 
-    return wasm::unreachable;
-}
+    if (wasmType == wasm::type::f64) {
+        switch (*getTokenText(token))
+        {
+        case '+':
+            return wasm::f64_add;
+        case '-':
+            return wasm::f64_sub;
+        case '*':
+            return wasm::f64_mul;
+        case '/':
+            return wasm::f64_div;
+        case '<':
+            return wasm::f64_lt;
+        case '>':
+            return wasm::f64_gt;
+        }
+    }
 
-//TODO, obviously
-u8 getWasmLoadInstructionFromType(u8 type) {
-    switch (type) {
-        case wasm::type::i32:
-        return wasm::i32_load;
-        case wasm::type::i64:
-        return wasm::i64_load;
-        case wasm::type::f32:
-        return wasm::f32_load;
-        case wasm::type::f64:
-        return wasm::f64_load;
+    if (wasmType == wasm::type::i64) {
+        switch (*getTokenText(token))
+        {
+        case '+':
+            return wasm::i64_add;
+        case '-':
+            return wasm::i64_sub;
+        case '*':
+            return wasm::i64_mul;
+        case '/':
+            return wasm::i64_div_s;
+        case '<':
+            return wasm::i64_lt_s;
+        case '>':
+            return wasm::i64_gt_s;
+        }
     }
 
     return wasm::unreachable;
 }
 
-u8 getWasmStoreInstructionFromType(u8 type) {
-    switch (type) {
-        case wasm::type::i32:
-        return wasm::i32_store;
-        case wasm::type::i64:
-        return wasm::i64_store;
-        case wasm::type::f32:
-        return wasm::f32_store;
-        case wasm::type::f64:
-        return wasm::f64_store;
-    }
+/* Math functions that are computed by wasm instructions instead of calls to imports.  f32Op applies when an operand
+is a float and i32Op when every operand is an integer.  Functions without one of the two convert their operands to
+the type of the other.  abs, min and max are lowered to select, since wasm has no integer ones and its float min and
+max treat NaN and zeros unlike C++, so their ops are the comparison that select chooses with */
+struct Intrinsic
+{
+    u8 f32Op;
+    u8 i32Op;
+    u8 operandCount;
+    u8 operandType; //type the C function converts its arguments to, or 0 if it's overloaded by argument type
+};
 
-    return wasm::unreachable;
+/* The math function a name calls, or nullptr if the name isn't one.  The entries are static rather than returned by
+value, since the wasm ABI returns structs through memory and the parser would keep one on the stack per parenthesis */
+#define RETURN_INTRINSIC(f32Op, i32Op, operandCount, operandType) { \
+    static Intrinsic intrinsic = {f32Op, i32Op, operandCount, operandType}; \
+    return &intrinsic; \
 }
 
-u8 getWasmTypeFromCppName(u64 hash)
+Intrinsic *getIntrinsic(u64 hash)
 {
-    //for the purposes of this hackathon, assume no unsigned types and well formed programs
     switch (hash)
     {
-    case HASH("int"):
-    case HASH("i32"):
-    case HASH("u32"):
-    case HASH("char"):
+    case HASH("sqrt"):
+    case HASH("std::sqrt"):
+        RETURN_INTRINSIC(wasm::f32_sqrt, 0, 1, 0);
+    case HASH("sqrtf"):
+        RETURN_INTRINSIC(wasm::f32_sqrt, 0, 1, wasm::type::f32);
+    case HASH("floor"):
+    case HASH("std::floor"):
+        RETURN_INTRINSIC(wasm::f32_floor, 0, 1, 0);
+    case HASH("floorf"):
+        RETURN_INTRINSIC(wasm::f32_floor, 0, 1, wasm::type::f32);
+    case HASH("ceil"):
+    case HASH("std::ceil"):
+        RETURN_INTRINSIC(wasm::f32_ceil, 0, 1, 0);
+    case HASH("ceilf"):
+        RETURN_INTRINSIC(wasm::f32_ceil, 0, 1, wasm::type::f32);
+    case HASH("trunc"):
+    case HASH("std::trunc"):
+        RETURN_INTRINSIC(wasm::f32_trunc, 0, 1, 0);
+    case HASH("truncf"):
+        RETURN_INTRINSIC(wasm::f32_trunc, 0, 1, wasm::type::f32);
+    case HASH("rint"):
+    case HASH("std::rint"):
+    case HASH("nearbyint"):
+    case HASH("std::nearbyint"):
+        RETURN_INTRINSIC(wasm::f32_nearest, 0, 1, 0);
+    case HASH("rintf"):
+    case HASH("nearbyintf"):
+        RETURN_INTRINSIC(wasm::f32_nearest, 0, 1, wasm::type::f32);
+    case HASH("fabs"):
+    case HASH("std::fabs"):
+        RETURN_INTRINSIC(wasm::f32_abs, 0, 1, 0);
+    case HASH("fabsf"):
+        RETURN_INTRINSIC(wasm::f32_abs, 0, 1, wasm::type::f32);
+    case HASH("abs"):
+    case HASH("std::abs"):
+        RETURN_INTRINSIC(wasm::f32_abs, wasm::i32_lt_s, 1, 0);
+    case HASH("fmin"):
+    case HASH("std::fmin"):
+        RETURN_INTRINSIC(wasm::f32_lt, 0, 2, 0);
+    case HASH("fminf"):
+        RETURN_INTRINSIC(wasm::f32_lt, 0, 2, wasm::type::f32);
+    case HASH("min"):
+    case HASH("std::min"):
+        RETURN_INTRINSIC(wasm::f32_lt, wasm::i32_lt_s, 2, 0);
+    case HASH("fmax"):
+    case HASH("std::fmax"):
+        RETURN_INTRINSIC(wasm::f32_gt, 0, 2, 0);
+    case HASH("fmaxf"):
+        RETURN_INTRINSIC(wasm::f32_gt, 0, 2, wasm::type::f32);
+    case HASH("max"):
+    case HASH("std::max"):
+        RETURN_INTRINSIC(wasm::f32_gt, wasm::i32_gt_s, 2, 0);
+    case HASH("copysign"):
+    case HASH("std::copysign"):
+        RETURN_INTRINSIC(wasm::f32_copysign, 0, 2, 0);
+    case HASH("copysignf"):
+        RETURN_INTRINSIC(wasm::f32_copysign, 0, 2, wasm::type::f32);
+    case HASH("__builtin_clz"):
+        RETURN_INTRINSIC(0, wasm::i32_clz, 1, wasm::type::i32);
+    case HASH("__builtin_clzll"):
+        RETURN_INTRINSIC(0, wasm::i32_clz, 1, wasm::type::i64);
+    case HASH("__builtin_ctz"):
+        RETURN_INTRINSIC(0, wasm::i32_ctz, 1, wasm::type::i32);
+    case HASH("__builtin_ctzll"):
+        RETURN_INTRINSIC(0, wasm::i32_ctz, 1, wasm::type::i64);
+    case HASH("__builtin_popcount"):
+        RETURN_INTRINSIC(0, wasm::i32_popcnt, 1, wasm::type::i32);
+    case HASH("__builtin_popcountll"):
+        RETURN_INTRINSIC(0, wasm::i32_popcnt, 1, wasm::type::i64);
+    default:
+        return nullptr;
+    }
+}
+
+//whether an Intrinsic node is an abs, min or max, which choose between values with select
+bool isSelectIntrinsic(ExprNode *node)
+{
+    switch (node->wasmOp)
+    {
+    case wasm::i32_lt_s:
+    case wasm::i32_gt_s:
+    case wasm::i64_lt_s:
+    case wasm::i64_gt_s:
+    case wasm::f32_lt:
+    case wasm::f32_gt:
+    case wasm::f64_lt:
+    case wasm::f64_gt:
+        return true;
+    default:
+        return false;
+    }
+}
+
+u8 getWasmTypeFromCppName(u64 hash)
+{
+    //for the purposes of this hackathon, assume no unsigned types and well formed programs
+    switch (hash)
+    {
+    case HASH("int"):
+    case HASH("i32"):
+    case HASH("u32"):
+    case HASH("char"):
         return wasm::type::i32;
     case HASH("long"):
     case HASH("i64"):
@@ -325,678 +1097,5720 @@ void writeF32(f32 val)
     writePos += 4;
 }
 
-void writeSectionSize(u8 *sectionSizePtr)
+void writeF64(f64 val)
 {
-    u32 sectionSize = writePos - sectionSizePtr - 2;
-    sectionSizePtr[0] = (sectionSize & 0x7F) | 0x80;
-    sectionSizePtr[1] = sectionSize >> 7;
+    memcpy(writePos, &val, 8);
+    writePos += 8;
 }
 
-//readPos must be placed at the first character of the return type for a function definition
-void writeFunction();
-u8 writeExpression();
-
-u32 getFuncIndex(u64 funcNameHash);
-u32 getLocalVarIndex(u64 varNameHash);
-u32 getGlobalVarIndex(u64 varNameHash);
+void writeI32Const(i32 value)
+{
+    *writePos++ = wasm::i32_const;
+    writePos += wasm::varint(writePos, value);
+}
 
-u8 writeMetaData();
+void writeI64Const(i64 value)
+{
+    *writePos++ = wasm::i64_const;
+    writePos += wasm::varint64(writePos, value);
+}
 
-EXPORT u32 getWasmFromCpp(char *sourceCode, u32 length)
+void writeF64Const(f64 value)
 {
-    globalVarCount = 0;
+    *writePos++ = wasm::f64_const;
+    writeF64(value);
+}
 
-    //start placing the compiled output 4 bytes after the source code input
-    writePos = (u8 *)(sourceCode + length + 4);
+//get_local, set_local and tee_local
+void writeLocalOp(u8 op, u32 localIndex)
+{
+    *writePos++ = op;
+    writePos += wasm::varuint(writePos, localIndex);
+}
 
-    //begin the output wasm binary with the 8 byte wasm header
-    for (int i = 0; i < 8; ++i)
+//log2 of the number of bytes a load or store accesses
+u32 getAccessSizeLog2(u8 op)
+{
+    switch (op)
     {
-        *writePos++ = WASM_HEADER[i];
+    case wasm::i64_load:
+    case wasm::f64_load:
+    case wasm::i64_store:
+    case wasm::f64_store:
+        return 3;
+
+    case wasm::i32_load:
+    case wasm::f32_load:
+    case wasm::i64_load32_s:
+    case wasm::i64_load32_u:
+    case wasm::i32_store:
+    case wasm::f32_store:
+    case wasm::i64_store32:
+        return 2;
+
+    case wasm::i32_load16_s:
+    case wasm::i32_load16_u:
+    case wasm::i64_load16_s:
+    case wasm::i64_load16_u:
+    case wasm::i32_store16:
+    case wasm::i64_store16:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+/* loads and stores take the log2 of their alignment and a constant offset that is added to the address operand.
+The alignment hint is the size of the access, unless the region or the offset is less aligned than that */
+void writeMemoryOp(u8 op, u32 region, u32 offset)
+{
+    u32 alignment = getAccessSizeLog2(op);
+    if (alignment > dataRegionAlignments[region]) {
+        alignment = dataRegionAlignments[region];
+    }
+    while (offset & ((1 << alignment) - 1)) {
+        --alignment;
     }
 
-    readPos = sourceCode;
-    endReadPos = sourceCode + length;
+    *writePos++ = op;
+    *writePos++ = alignment;
+    writePos += wasm::varuint(writePos, offset);
+}
 
-    //detect source code metadata and write the wasm binary up to just before the Code section
-    u8 localFuncCount = writeMetaData();
+void writeCall(u32 funcIndex)
+{
+    *writePos++ = wasm::call;
+    writePos += wasm::varuint(writePos, funcIndex);
+}
 
-    //reset the read position for the code generation pass
-    readPos = sourceCode;
+//blocks, loops and ifs generated by the compiler never leave a value on the stack
+void writeBlockOp(u8 op)
+{
+    *writePos++ = op;
+    *writePos++ = wasm::type::_void;
+}
 
-    *writePos++ = wasm::section::Code;
-    u8 *codeSectionSize = writePos;
-    writePos += 2;
-    *writePos++ = localFuncCount;
+//sizes are patched in after the contents are written, so 5 bytes (the most a u32 can need) are reserved for the
+//size.  Once the size is known, the contents are shifted back so the size takes only as many bytes as it needs
+void writeSectionSize(u8 *sectionSizePtr)
+{
+    u8 *contents = sectionSizePtr + 5;
+    u32 sectionSize = writePos - contents;
+    u32 sizeLength = wasm::varuint(sectionSizePtr, sectionSize);
 
-    //scan the program looking for each function in-order
-    bool definingExternalResource = false;
-    u32 lhsType = 0;
-    char *identifierStart = nullptr;
-    char *identifierEnd = nullptr;
+    //memcpy copies front to back, so it is safe to shift bytes to a lower address
+    memcpy(sectionSizePtr + sizeLength, contents, sectionSize);
+    writePos -= 5 - sizeLength;
+}
 
-    while (readPos < endReadPos)
-    {
-        Token token = nextToken(readPos);
-        readPos = token.end;
+//number of bytes in the LEB128 number at c
+u32 getVarintLength(u8 *c)
+{
+    u32 length = 1;
+    while (*c++ & 0x80) {
+        ++length;
+    }
+    return length;
+}
 
-        switch (token.type) {
-            case Token::Identifier: {
-                u64 hash = djb_hash(token);
-                u8 wasmType = getWasmTypeFromCppName(hash);
-                if (wasmType) {
-                    Token next = token;
+i32 readVarint(u8 *c)
+{
+    i32 result = 0;
+    u32 shift = 0;
+    u8 byte;
+
+    do {
+        byte = *c++;
+        result |= (i32)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    //sign extend from the last byte read
+    if (shift < 32 && (byte & 0x40)) {
+        result |= ~0u << shift;
+    }
 
-                    //line starts with a type.  Scan ahead for an '{'
-                    while (readPos < endReadPos) {
-                        next = nextToken(next.end);
+    return result;
+}
 
-                        if (*next.start == ';') {
-                            //either a function header or a global var.  Skip this declaration and move on
-                            readPos = next.end;
-                            break;
-                        }
+//number of bytes in the instruction at instr, including its immediates
+u32 getInstructionLength(u8 *instr)
+{
+    u8 op = *instr;
 
-                        if (*next.start == '{') {
-                            //found a function definition
-                            readPos = token.start;
-                            writeFunction();
-                            break;
-                        }
-                    }
-                }
-            } break;
-            default:
-            break;
+    switch (op)
+    {
+    case wasm::block:
+    case wasm::loop:
+    case wasm::_if:
+    case wasm::memory_size:
+    case wasm::memory_grow:
+        return 2;
+
+    case wasm::br:
+    case wasm::br_if:
+    case wasm::call:
+    case wasm::get_local:
+    case wasm::set_local:
+    case wasm::tee_local:
+    case wasm::get_global:
+    case wasm::set_global:
+    case wasm::i32_const:
+    case wasm::i64_const:
+        return 1 + getVarintLength(instr + 1);
+
+    case wasm::call_indirect:
+        return 2 + getVarintLength(instr + 1);
+
+    case wasm::br_table:
+    {
+        //the target count is followed by that many targets and then the default target
+        u8 *c = instr + 1;
+        u32 targetCount = readVarint(c) & 0x0FFFFFFF;
+        c += getVarintLength(c);
+        for (u32 i = 0; i <= targetCount; ++i) {
+            c += getVarintLength(c);
         }
+        return c - instr;
     }
 
-    // PRINT_LIT("Finished Loop Function\n");
+    case wasm::f32_const:
+        return 5;
 
-    writeSectionSize(codeSectionSize);
+    case wasm::f64_const:
+        return 9;
+    }
 
-    // PRINT_LIT("Finished Code section\n");
+    if (op >= wasm::i32_load && op <= wasm::i64_store32) {
+        //alignment then offset
+        u32 alignmentLength = getVarintLength(instr + 1);
+        return 1 + alignmentLength + getVarintLength(instr + 1 + alignmentLength);
+    }
 
-    u32 wasmModuleAddress = (u32)(void *)endReadPos + 4;
-    u32 wasmModuleSize = (u32)(void *)writePos - wasmModuleAddress;
+    return 1;
+}
 
-    //store the length of the generated binary at the same memory location that
-    //the source code was read in, but rounded up to align to 4 bytes
-    u32 *wasmModuleSizeWriteAddress = (u32 *)(((u32)sourceCode + 3) & -4);
-    *wasmModuleSizeWriteAddress = wasmModuleSize;
+//find the else or end that belongs to the block, loop or if beginning at instr
+u8 *findBlockEnd(u8 *instr, u8 *end)
+{
+    u32 depth = 0;
 
-    //until multiple-return is finalized, this is the next best solution to return two i32's
-    return wasmModuleAddress;
+    while (instr < end) {
+        u8 op = *instr;
+
+        if (op == wasm::block || op == wasm::loop || op == wasm::_if) {
+            ++depth;
+        } else if (op == wasm::_else && depth == 1) {
+            return instr;
+        } else if (op == wasm::end && --depth == 0) {
+            return instr;
+        }
+
+        instr += getInstructionLength(instr);
+    }
+
+    return end;
 }
 
+/* Rewrite a function body in place, removing redundant instructions left between separately emitted statements.
+Instructions are copied down from in to out, which never overtakes in since rewrites only remove bytes or first
+check that there is room.
+recent holds the starts of the last few instructions written to out, so patterns can match the results of
+earlier rewrites.  Returns the new end of the function body */
+u8 *optimizeFunctionBody(u8 *start, u8 *end)
+{
+    u8 *in = start;
+    u8 *out = start;
 
+    u8 *recent[4];
+    u32 recentCount = 0;
 
-/* This function must be called with readPos pointing to the first char of the return type of a function.
-writePos must point to the first byte of a function body, where the function body size is encoded */
-void writeFunction() {
-    //write to this address at the end of the function once the body size is known
-    u8* functionBodySize = writePos;
-    writePos += 3; // allocate 2**14 bytes for each function body and skip a byte for parameter entries
+    while (in < end) {
+        u8 *instr = in;
+        u32 length = getInstructionLength(instr);
+        in += length;
+
+        u8 op = *instr;
+        u8 *last = recentCount > 0 ? recent[recentCount - 1] : nullptr;
+        u8 lastOp = last ? *last : (u8)wasm::unreachable;
+
+        //set_local n; get_local n becomes tee_local n
+        if (op == wasm::get_local && lastOp == wasm::set_local &&
+            getInstructionLength(last) == length && memcmp(last + 1, instr + 1, length - 1) == 0)
+        {
+            *last = wasm::tee_local;
+            continue;
+        }
 
-    //token is assumed to be the return type of this function
-    Token token = nextToken(readPos);
-    u8 returnType = getWasmTypeFromCppName(djb_hash(token));
+        if (op == wasm::drop) {
+            //tee_local n; drop becomes set_local n
+            if (lastOp == wasm::tee_local) {
+                *last = wasm::set_local;
+                continue;
+            }
 
-    //Skip function name and open paren, then select type of first param
-    token = nextToken(token.end);
+            //pushing a value only to drop it does nothing
+            if (lastOp == wasm::get_local || lastOp == wasm::get_global || lastOp == wasm::i32_const || lastOp == wasm::i64_const || lastOp == wasm::f32_const || lastOp == wasm::f64_const) {
+                out = last;
+                --recentCount;
+                continue;
+            }
+        }
 
-    token = nextToken(token.end);
-    readPos = token.end;
+        /* get_local n; set_global g; get_global g reads the value that was just set, so the get_global is replaced
+        with a copy of the get_local */
+        if (op == wasm::get_global && lastOp == wasm::set_global && recentCount >= 2 &&
+            *recent[recentCount - 2] == wasm::get_local &&
+            getInstructionLength(last) == length && memcmp(last + 1, instr + 1, length - 1) == 0)
+        {
+            u32 valueLength = last - recent[recentCount - 2];
+            if (valueLength <= (u32)(in - out)) {
+                instr = recent[recentCount - 2];
+                length = valueLength;
+            }
+        }
 
-    u32 paramCount = 0;
+        //an if whose condition is a constant either always runs its body or never does
+        if (op == wasm::_if && lastOp == wasm::i32_const) {
+            i32 condition = readVarint(last + 1);
+            u8 *elseOrEnd = findBlockEnd(instr, end);
 
-    //Parse parameters and their types.  Parameters count as local variables
-    while (readPos < endReadPos) {
-        token = nextToken(readPos);
-        readPos = token.end;
-        
-        if (token.type == Token::Identifier) {
-            u64 hash = djb_hash(token);
-            u8 wasmType = getWasmTypeFromCppName(hash);
-            if (wasmType) {
-                Token paramName = nextToken(token.end);
-                hash = djb_hash(paramName);
-                token = paramName;
+            if (condition == 0) {
+                out = last;
+                --recentCount;
 
-                varTypes[paramCount] = wasmType;
-                varNameHashes[paramCount++] = hash;
+                //only the else body runs, as a plain block so branches inside it still have the same depth
+                if (*elseOrEnd == wasm::_else) {
+                    *out++ = wasm::block;
+                    *out++ = instr[1];
+                    recent[recentCount++] = out - 2;
+                }
 
-                readPos = paramName.end;
-            } else {
-                PRINT_LIT("Unable to find wasm type of paramater type \"");
-                print(token);
-                PRINT_LIT("\"\n");
+                in = elseOrEnd + 1;
+                continue;
             }
-        } else if (*token.start == ')') {
-            break;
-        } else if (*token.start != ',') {
-            PRINT_LIT("Found non-parameter \"");
-            print(token);
-            PRINT_LIT("\" in parameter list\n");
-        }        
+
+            //an if with an else keeps its else body, so only ifs without one are replaced
+            if (*elseOrEnd == wasm::end) {
+                out = last;
+                --recentCount;
+
+                *out++ = wasm::block;
+                *out++ = instr[1];
+                recent[recentCount++] = out - 2;
+                continue;
+            }
+        }
+
+        //memcpy copies front to back, so it is safe to shift bytes to a lower address
+        memcpy(out, instr, length);
+
+        if (recentCount == 4) {
+            recent[0] = recent[1];
+            recent[1] = recent[2];
+            recent[2] = recent[3];
+            recentCount = 3;
+        }
+        recent[recentCount++] = out;
+        out += length;
     }
 
-    char* beginningOfFuncBody = readPos;
-    i32 scopeDepth;
-    u8 varCountByTypeThisScope[64][4];
+    return out;
+}
 
-    //count up the local variables of each type used in each scope so that variables used in
-    //different scopes can be assigned to the same local variable
+u32 nextPowerOf2(u32 value)
+{
+    u32 result = 1;
+    while (result < value)
     {
-        for (u32 i = 0; i < 4; ++i) {
-            varCountByType[i] = 0;
-        }
+        result <<= 1;
+    }
+    return result;
+}
 
-        scopeDepth = -1;
-        u8 maxVarCountByType[4] = {0};
-        
-        while (readPos < endReadPos) {
-            token = nextToken(readPos);
-            readPos = token.end;
+SymbolTable allocateSymbolTable(u32 maxCount)
+{
+    //keep the load factor at or below 1/2
+    SymbolTable table;
+    table.capacity = nextPowerOf2(maxCount * 2 + 2);
+    table.keys = ARENA_ALLOC(u64, table.capacity);
+    table.values = ARENA_ALLOC(u32, table.capacity);
+    if (!isOutOfMemory) {
+        clearSymbolTable(&table);
+    }
+    return table;
+}
+
+//the most IR nodes or instructions a function body of the given number of tokens can need
+u32 getMaxIRSize(u32 bodyLength)
+{
+    return 4 * bodyLength + 4;
+}
 
-            //TODO support declaring vars in for loops
+Token *findClosingToken(Token *open, Token *end);
+void indexBody(Token *body, Token *end);
+u32 findNameUses(Token *start, Token *end);
 
-            if (*token.start == '{') {
-                ++scopeDepth;
-                for (u32 i = 0; i < 4; ++i) {
-                    varCountByTypeThisScope[scopeDepth][i] = 0;
-                }
+//the inlined function called by the call beginning at token, or nullptr if the call isn't inlined
+InlineCandidate *getInlinedCallee(Token *token, Token *end)
+{
+    if (token->type != Token::Identifier || token + 1 >= end || token[1].hash != HASH("(")) {
+        return nullptr;
+    }
+
+    u32 index = lookupSymbol(&inlineCandidateNames, token->hash);
+    if (index == NONE || inlineCandidates[index].state != InlineState::Inlinable) {
+        return nullptr;
+    }
+
+    return &inlineCandidates[index];
+}
+
+/* Find the size of a function once the calls it makes to inlined functions are expanded, measuring each callee
+first.  A callee that is still being measured reaches this function through the ones on the stack, so all of them
+are recursive */
+void measureInlineCandidate(u32 index)
+{
+    InlineCandidate *candidate = &inlineCandidates[index];
+    candidate->state = InlineState::Measuring;
+    candidate->stackIndex = inlineStackDepth;
+    inlineStack[inlineStackDepth++] = index;
+
+    u32 length = candidate->bodyEnd + 1 - candidate->params;
+    u32 depth = 0;
+    u32 maxDepth = 0;
+    u32 typeNames = 0;
+
+    for (Token *token = candidate->params; token < candidate->bodyEnd; ++token) {
+        if (token->hash == HASH("{")) {
+            if (++depth > maxDepth) {
+                maxDepth = depth;
             }
-            else if (*token.start == '}') {
-                for (u32 i = 0; i < 4; ++i) {
-                    //deallocate local vars so the same local var can be reused
-                    varCountByType[i] -= varCountByTypeThisScope[scopeDepth][i];
-                }
-                --scopeDepth;
-                if (scopeDepth < 0) {
-                    break;
-                }
+        } else if (token->hash == HASH("}")) {
+            --depth;
+        } else if (token->type == Token::Identifier && getWasmTypeFromCppName(token->hash)) {
+            ++typeNames;
+        } else if (token->type == Token::Identifier && token[1].hash == HASH("(")) {
+            u32 calleeIndex = lookupSymbol(&inlineCandidateNames, token->hash);
+            if (calleeIndex == NONE) {
+                continue;
             }
-            else if (token.type == Token::Identifier) {
-                u64 hash = djb_hash(token);
-                u8 wasmType = getWasmTypeFromCppName(hash);
-                if (wasmType) {
-                    PRINT_LIT("found local var ");
-                    print(nextToken(token.end));
-                    PRINT_LIT(" of type ");
-                    puti32(wasmType);
-                    put('\n');
-
-                    u32 i = wasmType & 0b11;
-                    ++varCountByTypeThisScope[scopeDepth][i];
-                    ++varCountByType[i];
-
-                    if (maxVarCountByType[i] < varCountByType[i]) {
-                        maxVarCountByType[i] = varCountByType[i];
-                    }
+
+            InlineCandidate *callee = &inlineCandidates[calleeIndex];
+            if (callee->state == InlineState::Unmeasured) {
+                measureInlineCandidate(calleeIndex);
+            }
+
+            if (callee->state == InlineState::Measuring) {
+                for (u32 i = callee->stackIndex; i < inlineStackDepth; ++i) {
+                    inlineCandidates[inlineStack[i]].isRecursive = true;
+                }
+            } else if (callee->state == InlineState::Inlinable) {
+                length += callee->expandedLength;
+                typeNames += callee->expandedTypeNames;
+                if (depth + callee->expandedDepth > maxDepth) {
+                    maxDepth = depth + callee->expandedDepth;
                 }
             }
         }
+    }
+
+    --inlineStackDepth;
+    candidate->expandedLength = length;
+    candidate->expandedDepth = maxDepth;
+    candidate->expandedTypeNames = typeNames;
+    candidate->state = !candidate->isRecursive && length <= MAX_INLINED_BODY_LENGTH ?
+        InlineState::Inlinable : InlineState::NotInlinable;
+}
 
-        //encode local variable metadata at the top of the function body
-        u8 paramEntryCount = 0;
+/* Find the function definitions and which of them are inlined.  Bodies grow by the calls inlined into them, so the
+upper bounds on body length, nesting and variables per function are raised to those of the expanded bodies */
+void findInlineCandidates(Token *tokens, Token *endOfTokens, u32 maxFuncs, u32 *maxBodyLength, u32 *maxScopeDepth,
+    u32 *maxLocals)
+{
+    inlineCandidates = ARENA_ALLOC(InlineCandidate, maxFuncs);
+    inlineCandidateNames = allocateSymbolTable(maxFuncs);
+    inlineStack = ARENA_ALLOC(u32, maxFuncs);
+    inlineStackDepth = 0;
+    if (isOutOfMemory) {
+        return;
+    }
 
-        int j = paramCount;
-        for (u32 i = 0; i < 4; ++i) {
-            if (maxVarCountByType[i] > 0) {
-                ++paramEntryCount;
-                *writePos++ = maxVarCountByType[i]; //# of parameters of the following type
-                *writePos++ = wasm::type::f64 | i; //parameter type
+    u32 candidateCount = 0;
+    u32 scopeDepth = 0;
+    Token *params = nullptr;
 
-                //write out all the local variable types once since they do not change during scope changes
-                for (u32 k = 0; k < maxVarCountByType[i]; ++k) {
-                    varTypes[j++] = wasm::type::f64 | i;
+    for (Token *token = tokens; token < endOfTokens; ++token) {
+        if (scopeDepth == 0 && token->hash == HASH("(")) {
+            params = token;
+        } else if (token->hash == HASH("{")) {
+            if (scopeDepth++ == 0 && params && params > tokens && params[-1].type == Token::Identifier &&
+                token[-1].hash == HASH(")") && candidateCount < maxFuncs)
+            {
+                //a body that is never closed is lowered where it is, but never inlined
+                Token *bodyEnd = findClosingToken(token, endOfTokens);
+                if (bodyEnd < endOfTokens) {
+                    InlineCandidate *candidate = &inlineCandidates[candidateCount];
+                    *candidate = {};
+                    candidate->params = params;
+                    candidate->body = token;
+                    candidate->bodyEnd = bodyEnd;
+                    defineSymbol(&inlineCandidateNames, params[-1].hash, candidateCount++);
                 }
             }
-
-            
-            // PRINT_LIT("WasmType of type ");
-            // puti32(i | wasm::type::f64);
-            // PRINT_LIT(" has # of local vars: ");
-            // puti32(maxVarCountByType[i]);
-            // put('\n');
+        } else if (token->hash == HASH("}") && scopeDepth > 0) {
+            --scopeDepth;
         }
+    }
 
-        functionBodySize[2] = paramEntryCount;
+    for (u32 i = 0; i < candidateCount; ++i) {
+        InlineCandidate *candidate = &inlineCandidates[i];
+        if (candidate->state == InlineState::Unmeasured) {
+            measureInlineCandidate(i);
+        }
 
-        varStartingIndexes[0] = paramCount;
-        for (u32 i = 1; i < 4; ++i) {
-            varStartingIndexes[i] = varStartingIndexes[i-1] + maxVarCountByType[i-1];
+        if (candidate->expandedLength > *maxBodyLength) {
+            *maxBodyLength = candidate->expandedLength;
+        }
+        if (candidate->expandedDepth > *maxScopeDepth) {
+            *maxScopeDepth = candidate->expandedDepth;
+        }
+        if (candidate->expandedTypeNames > *maxLocals) {
+            *maxLocals = candidate->expandedTypeNames;
         }
     }
+}
 
-    readPos = beginningOfFuncBody;
-    u32 varIndexToAssignTo = -1;
-    u32 globalVarIndexToAssignTo = -1;
-    u32 funcIndexToCall = -1;
-    bool isIfStatement = false;
+/* Scan the token stream for upper bounds on the number of functions, global variables, local variables per
+function and nested scopes, then allocate every table from the arena with exactly that much room */
+//the sizes of the tables that hold the state of one function body, which fit every function of a compilation
+struct FunctionTableSizes
+{
+    u32 maxLocals;
+    u32 maxScopeDepth;
+    u32 maxBodyLength;
+    u32 maxGlobals;
+};
 
-    u8 lhsType = 0;
+COMPILER_STATE(FunctionTableSizes, functionTableSizes);
 
-    //don't read past the end of the input string in the event of malformed C++
-    while (readPos < endReadPos) {
-        token = nextToken(readPos);
-        readPos = token.end;
+void allocateFunctionTables()
+{
+    u32 maxLocals = functionTableSizes.maxLocals;
+    u32 maxScopeDepth = functionTableSizes.maxScopeDepth;
+    u32 maxBodyLength = functionTableSizes.maxBodyLength;
+    u32 maxGlobals = functionTableSizes.maxGlobals;
+
+    localVars = allocateSymbolTable(maxLocals);
+    shadowedLocalVars = ARENA_ALLOC(ShadowedSymbol, maxLocals);
+
+    shadowedLocalVarCountAtScopeStart = ARENA_ALLOC(u32, 2 * maxScopeDepth + 1);
+    scopeKinds = ARENA_ALLOC(u8, 2 * maxScopeDepth + 1);
+
+    u32 maxIRSize = getMaxIRSize(maxBodyLength);
+    exprNodes = ARENA_ALLOC(ExprNode, maxIRSize + SCRATCH_NODE_COUNT);
+
+    //every value with several uses may need a temporary local after the variables
+    u32 maxVirtualLocals = maxLocals + maxIRSize;
+    varTypes = ARENA_ALLOC(u8, maxVirtualLocals);
+    liveRangeStarts = ARENA_ALLOC(u32, maxVirtualLocals);
+    liveRangeEnds = ARENA_ALLOC(u32, maxVirtualLocals);
+    localsByStart = ARENA_ALLOC(u32, maxVirtualLocals);
+    allocatedLocals = ARENA_ALLOC(u32, maxVirtualLocals);
+    localSlots = ARENA_ALLOC(LocalSlot, maxVirtualLocals);
+    positionCounts = ARENA_ALLOC(u32, 2 * maxIRSize + 3);
+    valueNumbers = allocateSymbolTable(maxIRSize);
+    maxValueNumbersCapacity = valueNumbers.capacity;
+    instrs = ARENA_ALLOC(IRInstr, maxIRSize);
+    blocks = ARENA_ALLOC(IRBlock, maxBodyLength + 1);
+    storeLog = ARENA_ALLOC(StoreLogEntry, maxIRSize);
+    switchCases = ARENA_ALLOC(SwitchCase, maxBodyLength + 1);
+
+    closingOffsets = ARENA_ALLOC(u32, maxBodyLength);
+    nameUseIndexes = allocateSymbolTable(maxBodyLength);
+    maxNameUseIndexesCapacity = nameUseIndexes.capacity;
+    nameUseStarts = ARENA_ALLOC(u32, maxBodyLength + 1);
+    nameUsePositions = ARENA_ALLOC(u32, maxBodyLength);
+    tokenNameUses = ARENA_ALLOC(u32, maxBodyLength);
+    foundNameUses = ARENA_ALLOC(Token *, maxBodyLength);
+    nameUseOrder = ARENA_ALLOC(u32, maxBodyLength);
+    nameUseVisibleFrom = ARENA_ALLOC(u32, maxBodyLength);
+    visibleNameUses = ARENA_ALLOC(u32, maxBodyLength);
+
+    localVersions = ARENA_ALLOC(u32, maxLocals);
+    lastLocalStores = ARENA_ALLOC(IRInstr *, maxLocals);
+
+    globalVersions = ARENA_ALLOC(u32, maxGlobals);
+    lastGlobalStores = ARENA_ALLOC(IRInstr *, maxGlobals);
+    globalValues = ARENA_ALLOC(ExprNode *, maxGlobals);
+    globalLocals = ARENA_ALLOC(u32, maxGlobals);
+    globalAccessCounts = ARENA_ALLOC(u32, maxGlobals);
+    globalAccessStamps = ARENA_ALLOC(u32, maxGlobals);
+    promotedGlobals = ARENA_ALLOC(u32, MAX_PROMOTED_GLOBALS);
+    promotedValues = ARENA_ALLOC(ExprNode *, MAX_PROMOTED_GLOBALS);
+    //the cases of a switch are blocks inside the switch's block, which is two blocks for one level of braces
+    promotedValueStack = ARENA_ALLOC(ExprNode *, MAX_PROMOTED_GLOBALS * (2 * maxScopeDepth + 1));
+    if (isOutOfMemory) {
+        return;
+    }
 
-        if (*token.start == '{') {
-            ++scopeDepth;
-            
-            for (u32 i = 0; i < 4; ++i) {
-                varCountByTypeThisScope[scopeDepth][i] = 0;
-            }
-        }
-        else if (*token.start == '}') {
-            for (u32 i = 0; i < 4; ++i) {
-                //deallocate local vars so the same local var can be reused
-                varCountByType[i] -= varCountByTypeThisScope[scopeDepth][i];
-            }
-            --scopeDepth;
+    memset(globalVersions, 0, sizeof(u32) * maxGlobals);
+    memset(globalLocals, 0xFF, sizeof(u32) * maxGlobals);
+    memset(globalAccessStamps, 0, sizeof(u32) * maxGlobals);
+}
 
-            if (scopeDepth < 0) {
-                break;
+void allocateTables(Token *tokens, Token *endOfTokens)
+{
+    u32 maxFuncs = 0;
+    u32 maxGlobals = 0;
+    u32 maxLocals = 0;
+    u32 maxScopeDepth = 0;
+    u32 maxBodyLength = 0;
+
+    //each declaration in the global scope is either a global variable or a function, including its parameters and body
+    u32 typeNamesThisDeclaration = 0;
+    u32 scopeDepth = 0;
+    Token *bodyStart = tokens;
+    Token *declarationStart = tokens;
+
+    for (Token *token = tokens; token < endOfTokens; ++token)
+    {
+        if (token->hash == HASH("{"))
+        {
+            if (scopeDepth == 0)
+            {
+                bodyStart = token;
             }
 
-            *writePos++ = wasm::end;
+            if (++scopeDepth > maxScopeDepth)
+            {
+                maxScopeDepth = scopeDepth;
+            }
         }
-        else if (token.type == Token::Identifier) {
-            u64 hash = djb_hash(token);
-            u32 wasmType = getWasmTypeFromCppName(hash);
-            if (wasmType) {
-                //if the identifier on the beginning of the line is a type name, then declare
-                //a variable of that type with the following identifier as its name/hash
-                token = nextToken(readPos);
-                readPos = token.end;
-                hash = djb_hash(token);
-
-                int i = wasmType & 0b11;
-                varIndexToAssignTo = varStartingIndexes[i] + varCountByType[i]++;
-                varNameHashes[varIndexToAssignTo] = hash;
-            } else if (hash == HASH("if")) {
-                // PRINT_LIT("found if statement\n");
-                isIfStatement = true;
-
-                //set read position to one char past the open parenthesis
-                token = nextToken(readPos);
-                readPos = token.end;
-                writeExpression();
-            }
-            else if (hash == HASH("std::cout")) {
-                do {
-                    token = nextToken(readPos);
-                    
-                    if (token.end - token.start == 2 && *token.start == '<') {
-                        //found << operator, move to next token
-                    } else if (*token.start == ';') {
-                        //found end of statement
-                        break;
-                    } else if (token.type == Token::StringLit) {
-                        char *c = token.start + 1;
-
-                        while (c != token.end - 1) {
-                            if (*c == '\\') {
-                                ++c;
-                                if (*c == 'n') {
-                                    *c = '\n';
-                                }
-                            }
+        else if (token->hash == HASH("}"))
+        {
+            if (scopeDepth > 0 && --scopeDepth == 0)
+            {
+                typeNamesThisDeclaration = 0;
+                declarationStart = token + 1;
 
-                            *writePos++ = wasm::i32_const;
-                            writePos += wasm::varint(writePos, (u8)*c);
-                            u8 printFunc = getFuncIndex(HASH("put"));
-                            if (printFunc == (u8)-1) {
-                                PRINT_LIT("Failed to find function 'put'\n");
-                            } else {
-                                *writePos++ = wasm::call;
-                                *writePos++ = printFunc;
-                            }
+                if ((u32)(token - bodyStart) > maxBodyLength)
+                {
+                    maxBodyLength = token - bodyStart;
+                }
+            }
+        }
+        else if (scopeDepth == 0 && token->hash == HASH("("))
+        {
+            ++maxFuncs;
+        }
+        else if (scopeDepth == 0 && token->hash == HASH(";"))
+        {
+            ++maxGlobals;
+            typeNamesThisDeclaration = 0;
 
-                            ++c;
-                        }
-                    } else if (token.type == Token::CharLit) {
-                        u8 c = token.start[2];
+            //the initializer of a global variable is lowered to the IR like a function body
+            if ((u32)(token - declarationStart) > maxBodyLength)
+            {
+                maxBodyLength = token - declarationStart;
+            }
+            declarationStart = token + 1;
+        }
+        else if (token->type == Token::Identifier && getWasmTypeFromCppName(token->hash))
+        {
+            if (++typeNamesThisDeclaration > maxLocals)
+            {
+                maxLocals = typeNamesThisDeclaration;
+            }
+        }
+    }
 
-                        if (token.start[1] == '\\') {
-                            if (c == 'n') {
-                                c = '\n';
-                            }
-                            //TODO support remaining escape sequences
-                        }
+    findInlineCandidates(tokens, endOfTokens, maxFuncs, &maxBodyLength, &maxScopeDepth, &maxLocals);
 
-                        *writePos++ = wasm::i32_const;
-                        writePos += wasm::varint(writePos, c);
-                        u8 printFunc = getFuncIndex(HASH("put"));
-                        if (printFunc == (u8)-1) {
-                            PRINT_LIT("Failed to find function 'put'\n");
-                        } else {
-                            *writePos++ = wasm::call;
-                            *writePos++ = printFunc;
-                        }
-                    } else {
-                        u8 wasmType = writeExpression();
-                        u8 printFunc = -1;
-                        switch(wasmType) {
-                            case wasm::type::i32:
-                                printFunc = getFuncIndex(HASH("puti32"));
-                                break;
-                            case wasm::type::f32:
-                                printFunc = getFuncIndex(HASH("putf32"));
-                                break;
-                            case wasm::type::f64:
-                                printFunc = getFuncIndex(HASH("putf64"));
-                                break;
-                        }
+    //the last function body may not be terminated
+    if (scopeDepth > 0 && (u32)(endOfTokens - bodyStart) > maxBodyLength)
+    {
+        maxBodyLength = endOfTokens - bodyStart;
+    }
 
-                        if (printFunc == (u8)-1) {
-                            PRINT_LIT("Failed to find print function for type ");
-                            puti32(wasmType);
-                            put('\n');
-                        } else {
-                            *writePos++ = wasm::call;
-                            *writePos++ = printFunc;
-                        }
-                    }
-                    
-                    readPos = token.end;
-                } while (readPos < endReadPos);
-            } else {
-                funcIndexToCall = getFuncIndex(hash);
+    //promoted globals are locals of their own after the variables of a function
+    functionTableSizes.maxLocals = maxLocals + MAX_PROMOTED_GLOBALS;
+    functionTableSizes.maxScopeDepth = maxScopeDepth;
+    functionTableSizes.maxBodyLength = maxBodyLength;
+    functionTableSizes.maxGlobals = maxGlobals;
+    allocateFunctionTables();
+
+    globalVars = allocateSymbolTable(maxGlobals);
+    globalVarInitialValues = ARENA_ALLOC(u64, maxGlobals);
+    globalVarTypes = ARENA_ALLOC(u8, maxGlobals);
+
+    funcs = allocateSymbolTable(maxFuncs);
+    funcSigs = ARENA_ALLOC(u32, maxFuncs + StdoutFunc::Count + DrawFunc::Count);
+    importedFuncs = ARENA_ALLOC(FuncHeader, maxFuncs);
+    localFuncs = ARENA_ALLOC(FuncHeader, maxFuncs);
+    funcDefinitions = ARENA_ALLOC(Token *, maxFuncs);
+    functionKeys = ARENA_ALLOC(u64, maxFuncs);
+    functionBodySizes = ARENA_ALLOC(u32, maxFuncs);
+
+    //the functions generated for std::cout and the draw list may each need a signature of their own
+    types = ARENA_ALLOC(u64, maxFuncs + StdoutFunc::Count + DrawFunc::Count);
+    signatures = allocateSymbolTable(maxFuncs + StdoutFunc::Count + DrawFunc::Count);
+}
 
-                if (funcIndexToCall == -1) {
-                    varIndexToAssignTo = getLocalVarIndex(hash);
+//the character represented by the character following a backslash
+u8 decodeEscapeSequence(char c)
+{
+    switch (c)
+    {
+    case 'n':
+        return '\n';
+    case 't':
+        return '\t';
+    case 'r':
+        return '\r';
+    case '0':
+        return '\0';
+    default:
+        //covers \\, \" and \'
+        return c;
+    }
+}
 
-                    if (varIndexToAssignTo == -1) {
-                        globalVarIndexToAssignTo = getGlobalVarIndex(hash);
-                        if (globalVarIndexToAssignTo != -1) {
-                            *writePos++ = wasm::i32_const;
-                            *writePos++ = 0;
-                        }
-                    }
-                }
+//the character of a character literal token
+u8 decodeCharLiteral(Token *token)
+{
+    char *text = getTokenText(token);
+    return text[1] == '\\' ? decodeEscapeSequence(text[2]) : text[1];
+}
 
-                if (funcIndexToCall != -1 || varIndexToAssignTo != -1 || globalVarIndexToAssignTo != -1) {
-                    //skip past '(' or '='
-                    token = nextToken(readPos);
-                    readPos = token.end;
-                }
-            }
+//write the characters of a string literal token with escape sequences resolved and return the number of bytes written
+u32 decodeStringLiteral(Token *token, u8 *dest)
+{
+    char *c = getTokenText(token) + 1;
+    char *end = getTokenText(token) + token->length - 1;
+    u8 *start = dest;
 
-            lhsType = writeExpression();
+    while (c < end)
+    {
+        if (*c == '\\' && c + 1 < end)
+        {
+            ++c;
+            *dest++ = decodeEscapeSequence(*c++);
         }
-        else if (*token.start == ';') {
-            if (funcIndexToCall != -1) {
-                u8 returnType = types[funcSigs[funcIndexToCall]] >> 61;
-                if (returnType != 4) {
-                    lhsType = returnType | wasm::type::f64;
-                }
+        else
+        {
+            *dest++ = *c++;
+        }
+    }
 
-                *writePos++ = wasm::call;
-                *writePos++ = funcIndexToCall;
-                funcIndexToCall = -1;                
-            }
+    return dest - start;
+}
 
-            if (varIndexToAssignTo != -1) {
-                *writePos++ = wasm::set_local;
-                *writePos++ = varIndexToAssignTo;
-                varIndexToAssignTo = -1;
-            } else if (globalVarIndexToAssignTo != -1) {
-                u8 type = globalVarTypes[globalVarIndexToAssignTo];
-                u8 storeInstruction = getWasmStoreInstructionFromType(type);
-                u32 address = globalVarAddresses[globalVarIndexToAssignTo];
+/* Gather every string literal used by the program so they can be placed in the Data section.  This happens before
+any output is written because the output must stay the newest allocation in the arena */
+void collectStringLiterals(Token *tokens, Token *endOfTokens)
+{
+    u32 maxLiteralCount = 0;
+    u32 maxDataSize = 0;
 
-                *writePos++ = storeInstruction;
-                //Alignment: 2 for i32 and f32, 3 for i64 and f64.  Temporary TODO
-                *writePos++ = 3 - (type & 1);
-                writePos += wasm::varuint(writePos, address);
+    for (Token *token = tokens; token < endOfTokens; ++token)
+    {
+        if (token->type == Token::StringLit)
+        {
+            ++maxLiteralCount;
+            maxDataSize += token->length;
+        }
+    }
 
-                globalVarIndexToAssignTo = -1;
-            }
-            // else {
-            //     if (lhsType) {
-            //         *writePos++ = wasm::drop;
-            //     }
-            // }
+    stringLiterals = allocateSymbolTable(maxLiteralCount);
+    stringLiteralOffsets = ARENA_ALLOC(u32, maxLiteralCount);
+    stringLiteralLengths = ARENA_ALLOC(u32, maxLiteralCount);
+    stringData = ARENA_ALLOC(u8, maxDataSize);
+    stringLiteralCount = 0;
+    stringDataSize = 0;
+    if (isOutOfMemory) {
+        return;
+    }
 
-            lhsType = 0;
+    for (Token *token = tokens; token < endOfTokens; ++token)
+    {
+        //the "C" in extern "C" is not data
+        if (token->type != Token::StringLit || (token > tokens && token[-1].hash == HASH("extern")))
+        {
+            continue;
         }
-        
-        if (*token.start == ')' && isIfStatement) {
-            *writePos++ = wasm::_if;
-            *writePos++ = wasm::type::_void;
-            isIfStatement = false;
+
+        //identical literals share the same bytes
+        if (lookupSymbol(&stringLiterals, token->hash) != NONE)
+        {
+            continue;
         }
+
+        defineSymbol(&stringLiterals, token->hash, stringLiteralCount);
+        stringLiteralOffsets[stringLiteralCount] = stringDataSize;
+        stringLiteralLengths[stringLiteralCount] = decodeStringLiteral(token, stringData + stringDataSize);
+        stringDataSize += stringLiteralLengths[stringLiteralCount];
+        ++stringLiteralCount;
+    }
+}
+
+//the most bytes the functions generated for std::cout and the draw list take together, which is about 1.3 KiB
+#define GENERATED_FUNCS_MAX_SIZE 4096
+
+/* begin a generated function body.  Each entry of localTypes declares one local of that type after the parameters.
+The memory for every generated function is reserved at once, before the first */
+u8 *beginGeneratedFunction(u8 *localTypes, u32 localCount)
+{
+    u8 *functionBodySize = writePos;
+    writePos += 5;
+
+    writePos += wasm::varuint(writePos, localCount);
+    for (u32 i = 0; i < localCount; ++i)
+    {
+        *writePos++ = 1;
+        *writePos++ = localTypes[i];
+    }
+
+    return functionBodySize;
+}
+
+void endGeneratedFunction(u8 *functionBodySize)
+{
+    *writePos++ = wasm::end;
+    writeSectionSize(functionBodySize);
+}
+
+void writePutChar(char c)
+{
+    writeI32Const(c);
+    writeCall(stdoutFuncs + StdoutFunc::PutChar);
+}
+
+/* PutI32(i32 value) or PutI64(i64 value), which write the digits to the end of the scratch area and print them from there.
+local 1 points to the most significant digit written so far */
+void writePutInteger(u8 type, u32 scratchEnd)
+{
+    bool isI64 = type == wasm::type::i64;
+    u8 i32Local[] = {wasm::type::i32};
+    u8 *functionBodySize = beginGeneratedFunction(i32Local, 1);
+    {
+        writeLocalOp(wasm::get_local, 0);
+        isI64 ? writeI64Const(0) : writeI32Const(0);
+        *writePos++ = isI64 ? wasm::i64_lt_s : wasm::i32_lt_s;
+        writeBlockOp(wasm::_if);
+        writePutChar('-');
+        isI64 ? writeI64Const(0) : writeI32Const(0);
+        writeLocalOp(wasm::get_local, 0);
+        *writePos++ = isI64 ? wasm::i64_sub : wasm::i32_sub;
+        writeLocalOp(wasm::set_local, 0);
+        *writePos++ = wasm::end;
+
+        //digits are written back to front, treating the magnitude as unsigned so that the minimum value works
+        writeI32Const(scratchEnd);
+        writeLocalOp(wasm::set_local, 1);
+        writeBlockOp(wasm::loop);
+        writeLocalOp(wasm::get_local, 1);
+        writeI32Const(1);
+        *writePos++ = wasm::i32_sub;
+        writeLocalOp(wasm::tee_local, 1);
+        writeLocalOp(wasm::get_local, 0);
+        isI64 ? writeI64Const(10) : writeI32Const(10);
+        *writePos++ = isI64 ? wasm::i64_rem_u : wasm::i32_rem_u;
+        if (isI64) {
+            *writePos++ = wasm::i32_wrap_from_i64;
+        }
+        writeI32Const('0');
+        *writePos++ = wasm::i32_add;
+        writeMemoryOp(wasm::i32_store8, DataRegion::StdoutRing, 0);
+        writeLocalOp(wasm::get_local, 0);
+        isI64 ? writeI64Const(10) : writeI32Const(10);
+        *writePos++ = isI64 ? wasm::i64_div_u : wasm::i32_div_u;
+        writeLocalOp(wasm::tee_local, 0);
+        if (isI64) {
+            writeI64Const(0);
+            *writePos++ = wasm::i64_ne;
+        }
+        *writePos++ = wasm::br_if;
+        *writePos++ = 0;
+        *writePos++ = wasm::end;
+
+        writeLocalOp(wasm::get_local, 1);
+        writeI32Const(scratchEnd);
+        writeLocalOp(wasm::get_local, 1);
+        *writePos++ = wasm::i32_sub;
+        writeCall(stdoutFuncs + StdoutFunc::PutString);
+    }
+    endGeneratedFunction(functionBodySize);
+}
+
+//set local high to the high 26 bits of the f64 in local value, so that value minus high holds the low 27 bits exactly
+void writeSplitHigh(u32 value, u32 high)
+{
+    writeLocalOp(wasm::get_local, value);
+    writeF64Const(134217729.0); //2^27 + 1
+    *writePos++ = wasm::f64_mul;
+    writeLocalOp(wasm::tee_local, high);
+    writeLocalOp(wasm::get_local, high);
+    writeLocalOp(wasm::get_local, value);
+    *writePos++ = wasm::f64_sub;
+    *writePos++ = wasm::f64_sub;
+    writeLocalOp(wasm::set_local, high);
+}
+
+/* For PutF64: set local 12 to a value with the sign of value - (digits + half * 0.5) * 10^(exponent - 5), where value
+is local 5, the digits local 2, the exponent local 1, and 10^|exponent - 5| is local 6 with its high half in local 11.
+Both sides are doubled into a product and a double that are close to each other, so the difference of the product's
+rounded high part and the double is exact, and Dekker's product adds the low part the rounding dropped.
+Locals 7 to 10 hold the factor, the double, the product's high part and the factor's high half */
+void writeHalfwayComparison(i32 half)
+{
+    //2 * digits + half, negated with the doubled value when the power of 10 multiplies the digits rather than the value
+    writeLocalOp(wasm::get_local, 2);
+    writeI32Const(1);
+    *writePos++ = wasm::i32_shl;
+    writeI32Const(half);
+    *writePos++ = wasm::i32_add;
+    *writePos++ = wasm::f64_convert_s_from_i32;
+    writeLocalOp(wasm::set_local, 7);
+
+    writeLocalOp(wasm::get_local, 1);
+    writeI32Const(5);
+    *writePos++ = wasm::i32_ge_s;
+    writeBlockOp(wasm::_if);
+    writeLocalOp(wasm::get_local, 7);
+    *writePos++ = wasm::f64_neg;
+    writeLocalOp(wasm::set_local, 7);
+    writeLocalOp(wasm::get_local, 5);
+    writeF64Const(-2.0);
+    *writePos++ = wasm::f64_mul;
+    writeLocalOp(wasm::set_local, 8);
+    *writePos++ = wasm::_else;
+    writeLocalOp(wasm::get_local, 7);
+    writeLocalOp(wasm::set_local, 8);
+    writeLocalOp(wasm::get_local, 5);
+    writeF64Const(2.0);
+    *writePos++ = wasm::f64_mul;
+    writeLocalOp(wasm::set_local, 7);
+    *writePos++ = wasm::end;
+
+    writeSplitHigh(7, 10);
+    writeLocalOp(wasm::get_local, 7);
+    writeLocalOp(wasm::get_local, 6);
+    *writePos++ = wasm::f64_mul;
+    writeLocalOp(wasm::set_local, 9);
+
+    //(high - double) + (((factorHigh * powerHigh - high) + factorHigh * powerLow) + factorLow * powerHigh) +
+    //factorLow * powerLow
+    writeLocalOp(wasm::get_local, 9);
+    writeLocalOp(wasm::get_local, 8);
+    *writePos++ = wasm::f64_sub;
+
+    writeLocalOp(wasm::get_local, 10);
+    writeLocalOp(wasm::get_local, 11);
+    *writePos++ = wasm::f64_mul;
+    writeLocalOp(wasm::get_local, 9);
+    *writePos++ = wasm::f64_sub;
+
+    writeLocalOp(wasm::get_local, 10);
+    writeLocalOp(wasm::get_local, 6);
+    writeLocalOp(wasm::get_local, 11);
+    *writePos++ = wasm::f64_sub;
+    *writePos++ = wasm::f64_mul;
+    *writePos++ = wasm::f64_add;
+
+    writeLocalOp(wasm::get_local, 7);
+    writeLocalOp(wasm::get_local, 10);
+    *writePos++ = wasm::f64_sub;
+    writeLocalOp(wasm::get_local, 11);
+    *writePos++ = wasm::f64_mul;
+    *writePos++ = wasm::f64_add;
+
+    writeLocalOp(wasm::get_local, 7);
+    writeLocalOp(wasm::get_local, 10);
+    *writePos++ = wasm::f64_sub;
+    writeLocalOp(wasm::get_local, 6);
+    writeLocalOp(wasm::get_local, 11);
+    *writePos++ = wasm::f64_sub;
+    *writePos++ = wasm::f64_mul;
+    *writePos++ = wasm::f64_add;
+
+    *writePos++ = wasm::f64_add;
+    writeLocalOp(wasm::set_local, 12);
+}
+
+/* Write the bodies of the functions std::cout uses to format text into the stdout ring, in the order of StdoutFunc.
+Every address used here is a constant, so the address operand of each load and store is 0 and the address is the offset */
+void writeStdoutFunctions()
+{
+    u32 readCount = stdoutRingAddress;
+    u32 writeCount = stdoutRingAddress + 4;
+    u32 ringData = stdoutRingAddress + 16;
+    u32 scratch = ringData + STDOUT_RING_CAPACITY;
+    u32 scratchEnd = scratch + 32;
+
+    u8 i32Local[] = {wasm::type::i32};
+    u8 putF64Locals[] = {wasm::type::i32, wasm::type::i32, wasm::type::i32, wasm::type::i32, wasm::type::f64,
+                         wasm::type::f64, wasm::type::f64, wasm::type::f64, wasm::type::f64, wasm::type::f64,
+                         wasm::type::f64, wasm::type::f64};
+    u8 *functionBodySize;
+
+    //PutChar(i32 c), local 1 holds the write count
+    functionBodySize = beginGeneratedFunction(i32Local, 1);
+    {
+        //let the host drain the ring if it is full
+        writeI32Const(0);
+        writeMemoryOp(wasm::i32_load, DataRegion::StdoutRing, writeCount);
+        writeLocalOp(wasm::tee_local, 1);
+        writeI32Const(0);
+        writeMemoryOp(wasm::i32_load, DataRegion::StdoutRing, readCount);
+        *writePos++ = wasm::i32_sub;
+        writeI32Const(STDOUT_RING_CAPACITY);
+        *writePos++ = wasm::i32_ge_u;
+        writeBlockOp(wasm::_if);
+        writeCall(flushStdoutImport);
+        *writePos++ = wasm::end;
+
+        writeLocalOp(wasm::get_local, 1);
+        writeI32Const(STDOUT_RING_CAPACITY - 1);
+        *writePos++ = wasm::i32_and;
+        writeLocalOp(wasm::get_local, 0);
+        writeMemoryOp(wasm::i32_store8, DataRegion::StdoutRing, ringData);
+
+        writeI32Const(0);
+        writeLocalOp(wasm::get_local, 1);
+        writeI32Const(1);
+        *writePos++ = wasm::i32_add;
+        writeMemoryOp(wasm::i32_store, DataRegion::StdoutRing, writeCount);
+    }
+    endGeneratedFunction(functionBodySize);
+
+    //PutString(i32 address, i32 length)
+    functionBodySize = beginGeneratedFunction(nullptr, 0);
+    {
+        writeBlockOp(wasm::block);
+        writeBlockOp(wasm::loop);
+        writeLocalOp(wasm::get_local, 1);
+        *writePos++ = wasm::i32_eqz;
+        *writePos++ = wasm::br_if;
+        *writePos++ = 1;
+
+        writeLocalOp(wasm::get_local, 0);
+        writeMemoryOp(wasm::i32_load8_u, DataRegion::Strings, 0);
+        writeCall(stdoutFuncs + StdoutFunc::PutChar);
+
+        writeLocalOp(wasm::get_local, 0);
+        writeI32Const(1);
+        *writePos++ = wasm::i32_add;
+        writeLocalOp(wasm::set_local, 0);
+        writeLocalOp(wasm::get_local, 1);
+        writeI32Const(1);
+        *writePos++ = wasm::i32_sub;
+        writeLocalOp(wasm::set_local, 1);
+        *writePos++ = wasm::br;
+        *writePos++ = 0;
+        *writePos++ = wasm::end;
+        *writePos++ = wasm::end;
+    }
+    endGeneratedFunction(functionBodySize);
+
+    writePutInteger(wasm::type::i32, scratchEnd);
+    writePutInteger(wasm::type::i64, scratchEnd);
+
+    /* PutF64(f64 value) prints like std::cout's default formatting (printf's %g): 6 significant digits with trailing
+    zeros removed, in scientific notation when the exponent is below -4 or above 5.  The digits are rounded exactly,
+    ties to even, whenever 10 to the power of the position of the last digit is an exact double.  That covers every
+    value from 1e-17 to 1e28, and every value that can be exactly halfway.  Outside it the last digit comes from the
+    value scaled by repeated division or multiplication, and can differ from printf's within about 1e-13 of halfway.
+    local 1 is the decimal exponent, local 2 the 6 significant digits, local 3 the number of digits left after
+    trailing zeros are removed, and local 4 is a counter.  Local 5 keeps the unscaled value, and locals 6 to 12 are
+    used by writeHalfwayComparison */
+    functionBodySize = beginGeneratedFunction(putF64Locals, sizeof(putF64Locals));
+    {
+        //test the sign bit, so -0 and a negative nan print their sign like printf does
+        writeLocalOp(wasm::get_local, 0);
+        *writePos++ = wasm::i64_reinterpret_from_f64;
+        writeI64Const(0);
+        *writePos++ = wasm::i64_lt_s;
+        writeBlockOp(wasm::_if);
+        writePutChar('-');
+        writeLocalOp(wasm::get_local, 0);
+        *writePos++ = wasm::f64_neg;
+        writeLocalOp(wasm::set_local, 0);
+        *writePos++ = wasm::end;
+
+        writeLocalOp(wasm::get_local, 0);
+        writeLocalOp(wasm::get_local, 0);
+        *writePos++ = wasm::f64_ne;
+        writeBlockOp(wasm::_if);
+        writePutChar('n');
+        writePutChar('a');
+        writePutChar('n');
+        *writePos++ = wasm::_return;
+        *writePos++ = wasm::end;
+
+        //anything larger than the largest finite double is infinity
+        writeLocalOp(wasm::get_local, 0);
+        writeF64Const(1.7976931348623157e308);
+        *writePos++ = wasm::f64_gt;
+        writeBlockOp(wasm::_if);
+        writePutChar('i');
+        writePutChar('n');
+        writePutChar('f');
+        *writePos++ = wasm::_return;
+        *writePos++ = wasm::end;
+
+        writeLocalOp(wasm::get_local, 0);
+        writeF64Const(0.0);
+        *writePos++ = wasm::f64_eq;
+        writeBlockOp(wasm::_if);
+        writePutChar('0');
+        *writePos++ = wasm::_return;
+        *writePos++ = wasm::end;
+
+        writeLocalOp(wasm::get_local, 0);
+        writeLocalOp(wasm::set_local, 5);
+
+        //scale the value into [1, 10) while counting the decimal exponent
+        writeBlockOp(wasm::block);
+        writeBlockOp(wasm::loop);
+        writeLocalOp(wasm::get_local, 0);
+        writeF64Const(10.0);
+        *writePos++ = wasm::f64_lt;
+        *writePos++ = wasm::br_if;
+        *writePos++ = 1;
+        writeLocalOp(wasm::get_local, 0);
+        writeF64Const(10.0);
+        *writePos++ = wasm::f64_div;
+        writeLocalOp(wasm::set_local, 0);
+        writeLocalOp(wasm::get_local, 1);
+        writeI32Const(1);
+        *writePos++ = wasm::i32_add;
+        writeLocalOp(wasm::set_local, 1);
+        *writePos++ = wasm::br;
+        *writePos++ = 0;
+        *writePos++ = wasm::end;
+        *writePos++ = wasm::end;
+
+        writeBlockOp(wasm::block);
+        writeBlockOp(wasm::loop);
+        writeLocalOp(wasm::get_local, 0);
+        writeF64Const(1.0);
+        *writePos++ = wasm::f64_ge;
+        *writePos++ = wasm::br_if;
+        *writePos++ = 1;
+        writeLocalOp(wasm::get_local, 0);
+        writeF64Const(10.0);
+        *writePos++ = wasm::f64_mul;
+        writeLocalOp(wasm::set_local, 0);
+        writeLocalOp(wasm::get_local, 1);
+        writeI32Const(1);
+        *writePos++ = wasm::i32_sub;
+        writeLocalOp(wasm::set_local, 1);
+        *writePos++ = wasm::br;
+        *writePos++ = 0;
+        *writePos++ = wasm::end;
+        *writePos++ = wasm::end;
+
+        //round to 6 significant digits.  The scaled value is not exact, so the digits can be off by one here
+        writeLocalOp(wasm::get_local, 0);
+        writeF64Const(100000.0);
+        *writePos++ = wasm::f64_mul;
+        *writePos++ = wasm::f64_nearest;
+        *writePos++ = wasm::i32_trunc_s_from_f64;
+        writeLocalOp(wasm::set_local, 2);
+
+        //correct the digits exactly if the exponent of the last digit, exponent - 5, is within [-22, 22]
+        writeLocalOp(wasm::get_local, 1);
+        writeI32Const(17);
+        *writePos++ = wasm::i32_add;
+        writeI32Const(44);
+        *writePos++ = wasm::i32_le_u;
+        writeBlockOp(wasm::_if);
+        {
+            //local 6 is 10 to the power of the distance of the last digit from the ones digit, which is exact
+            writeF64Const(1.0);
+            writeLocalOp(wasm::set_local, 6);
+            writeLocalOp(wasm::get_local, 1);
+            writeI32Const(5);
+            *writePos++ = wasm::i32_sub;
+            writeLocalOp(wasm::tee_local, 4);
+            writeI32Const(0);
+            *writePos++ = wasm::i32_lt_s;
+            writeBlockOp(wasm::_if);
+            writeI32Const(0);
+            writeLocalOp(wasm::get_local, 4);
+            *writePos++ = wasm::i32_sub;
+            writeLocalOp(wasm::set_local, 4);
+            *writePos++ = wasm::end;
+
+            writeBlockOp(wasm::block);
+            writeBlockOp(wasm::loop);
+            writeLocalOp(wasm::get_local, 4);
+            *writePos++ = wasm::i32_eqz;
+            *writePos++ = wasm::br_if;
+            *writePos++ = 1;
+            writeLocalOp(wasm::get_local, 6);
+            writeF64Const(10.0);
+            *writePos++ = wasm::f64_mul;
+            writeLocalOp(wasm::set_local, 6);
+            writeLocalOp(wasm::get_local, 4);
+            writeI32Const(1);
+            *writePos++ = wasm::i32_sub;
+            writeLocalOp(wasm::set_local, 4);
+            *writePos++ = wasm::br;
+            *writePos++ = 0;
+            *writePos++ = wasm::end;
+            *writePos++ = wasm::end;
+            writeSplitHigh(6, 11);
+
+            //step the digits up while the value is above the upper halfway point, or on it with odd digits, and
+            //down while it is below the lower halfway point, or on it with odd digits
+            writeBlockOp(wasm::loop);
+            writeHalfwayComparison(1);
+            writeLocalOp(wasm::get_local, 12);
+            writeF64Const(0.0);
+            *writePos++ = wasm::f64_gt;
+            writeLocalOp(wasm::get_local, 12);
+            writeF64Const(0.0);
+            *writePos++ = wasm::f64_eq;
+            writeLocalOp(wasm::get_local, 2);
+            writeI32Const(1);
+            *writePos++ = wasm::i32_and;
+            *writePos++ = wasm::i32_and;
+            *writePos++ = wasm::i32_or;
+            writeBlockOp(wasm::_if);
+            writeLocalOp(wasm::get_local, 2);
+            writeI32Const(1);
+            *writePos++ = wasm::i32_add;
+            writeLocalOp(wasm::set_local, 2);
+            *writePos++ = wasm::br;
+            *writePos++ = 1;
+            *writePos++ = wasm::end;
+
+            writeHalfwayComparison(-1);
+            writeLocalOp(wasm::get_local, 12);
+            writeF64Const(0.0);
+            *writePos++ = wasm::f64_lt;
+            writeLocalOp(wasm::get_local, 12);
+            writeF64Const(0.0);
+            *writePos++ = wasm::f64_eq;
+            writeLocalOp(wasm::get_local, 2);
+            writeI32Const(1);
+            *writePos++ = wasm::i32_and;
+            *writePos++ = wasm::i32_and;
+            *writePos++ = wasm::i32_or;
+            writeBlockOp(wasm::_if);
+            writeLocalOp(wasm::get_local, 2);
+            writeI32Const(1);
+            *writePos++ = wasm::i32_sub;
+            writeLocalOp(wasm::set_local, 2);
+            *writePos++ = wasm::br;
+            *writePos++ = 1;
+            *writePos++ = wasm::end;
+            *writePos++ = wasm::end;
+        }
+        *writePos++ = wasm::end;
+
+        //rounding up to 1000000 moves the value into the next decade
+        writeLocalOp(wasm::get_local, 2);
+        writeI32Const(1000000);
+        *writePos++ = wasm::i32_ge_s;
+        writeBlockOp(wasm::_if);
+        writeI32Const(100000);
+        writeLocalOp(wasm::set_local, 2);
+        writeLocalOp(wasm::get_local, 1);
+        writeI32Const(1);
+        *writePos++ = wasm::i32_add;
+        writeLocalOp(wasm::set_local, 1);
+        *writePos++ = wasm::end;
+
+        //write the 6 digits to the start of the scratch area, back to front
+        writeI32Const(6);
+        writeLocalOp(wasm::set_local, 4);
+        writeBlockOp(wasm::loop);
+        writeLocalOp(wasm::get_local, 4);
+        writeI32Const(1);
+        *writePos++ = wasm::i32_sub;
+        writeLocalOp(wasm::tee_local, 4);
+        writeLocalOp(wasm::get_local, 2);
+        writeI32Const(10);
+        *writePos++ = wasm::i32_rem_u;
+        writeI32Const('0');
+        *writePos++ = wasm::i32_add;
+        writeMemoryOp(wasm::i32_store8, DataRegion::StdoutRing, scratch);
+        writeLocalOp(wasm::get_local, 2);
+        writeI32Const(10);
+        *writePos++ = wasm::i32_div_u;
+        writeLocalOp(wasm::set_local, 2);
+        writeLocalOp(wasm::get_local, 4);
+        *writePos++ = wasm::br_if;
+        *writePos++ = 0;
+        *writePos++ = wasm::end;
+
+        //drop trailing zeros, keeping at least one digit
+        writeI32Const(6);
+        writeLocalOp(wasm::set_local, 3);
+        writeBlockOp(wasm::block);
+        writeBlockOp(wasm::loop);
+        writeLocalOp(wasm::get_local, 3);
+        writeI32Const(1);
+        *writePos++ = wasm::i32_le_u;
+        *writePos++ = wasm::br_if;
+        *writePos++ = 1;
+        writeLocalOp(wasm::get_local, 3);
+        writeMemoryOp(wasm::i32_load8_u, DataRegion::StdoutRing, scratch - 1);
+        writeI32Const('0');
+        *writePos++ = wasm::i32_ne;
+        *writePos++ = wasm::br_if;
+        *writePos++ = 1;
+        writeLocalOp(wasm::get_local, 3);
+        writeI32Const(1);
+        *writePos++ = wasm::i32_sub;
+        writeLocalOp(wasm::set_local, 3);
+        *writePos++ = wasm::br;
+        *writePos++ = 0;
+        *writePos++ = wasm::end;
+        *writePos++ = wasm::end;
+
+        //scientific notation: d.ddddde+XX
+        writeLocalOp(wasm::get_local, 1);
+        writeI32Const(-4);
+        *writePos++ = wasm::i32_lt_s;
+        writeLocalOp(wasm::get_local, 1);
+        writeI32Const(6);
+        *writePos++ = wasm::i32_ge_s;
+        *writePos++ = wasm::i32_or;
+        writeBlockOp(wasm::_if);
+        {
+            writeI32Const(0);
+            writeMemoryOp(wasm::i32_load8_u, DataRegion::StdoutRing, scratch);
+            writeCall(stdoutFuncs + StdoutFunc::PutChar);
+
+            writeLocalOp(wasm::get_local, 3);
+            writeI32Const(1);
+            *writePos++ = wasm::i32_gt_u;
+            writeBlockOp(wasm::_if);
+            writePutChar('.');
+            writeI32Const(scratch + 1);
+            writeLocalOp(wasm::get_local, 3);
+            writeI32Const(1);
+            *writePos++ = wasm::i32_sub;
+            writeCall(stdoutFuncs + StdoutFunc::PutString);
+            *writePos++ = wasm::end;
+
+            writePutChar('e');
+            writeLocalOp(wasm::get_local, 1);
+            writeI32Const(0);
+            *writePos++ = wasm::i32_lt_s;
+            writeBlockOp(wasm::_if);
+            writePutChar('-');
+            writeI32Const(0);
+            writeLocalOp(wasm::get_local, 1);
+            *writePos++ = wasm::i32_sub;
+            writeLocalOp(wasm::set_local, 1);
+            *writePos++ = wasm::_else;
+            writePutChar('+');
+            *writePos++ = wasm::end;
+
+            //the exponent always has at least 2 digits
+            writeLocalOp(wasm::get_local, 1);
+            writeI32Const(10);
+            *writePos++ = wasm::i32_lt_s;
+            writeBlockOp(wasm::_if);
+            writePutChar('0');
+            *writePos++ = wasm::end;
+
+            writeLocalOp(wasm::get_local, 1);
+            writeCall(stdoutFuncs + StdoutFunc::PutI32);
+            *writePos++ = wasm::_return;
+        }
+        *writePos++ = wasm::end;
+
+        writeLocalOp(wasm::get_local, 1);
+        writeI32Const(0);
+        *writePos++ = wasm::i32_ge_s;
+        writeBlockOp(wasm::_if);
+        {
+            //the first exponent + 1 digits are the integer part, and the rest is the fraction
+            writeI32Const(scratch);
+            writeLocalOp(wasm::get_local, 1);
+            writeI32Const(1);
+            *writePos++ = wasm::i32_add;
+            writeLocalOp(wasm::tee_local, 4);
+            writeCall(stdoutFuncs + StdoutFunc::PutString);
+
+            writeLocalOp(wasm::get_local, 3);
+            writeLocalOp(wasm::get_local, 4);
+            *writePos++ = wasm::i32_gt_u;
+            writeBlockOp(wasm::_if);
+            writePutChar('.');
+            writeI32Const(scratch);
+            writeLocalOp(wasm::get_local, 4);
+            *writePos++ = wasm::i32_add;
+            writeLocalOp(wasm::get_local, 3);
+            writeLocalOp(wasm::get_local, 4);
+            *writePos++ = wasm::i32_sub;
+            writeCall(stdoutFuncs + StdoutFunc::PutString);
+            *writePos++ = wasm::end;
+        }
+        *writePos++ = wasm::_else;
+        {
+            //0. followed by -exponent - 1 zeros and then the digits
+            writePutChar('0');
+            writePutChar('.');
+            writeI32Const(-1);
+            writeLocalOp(wasm::get_local, 1);
+            *writePos++ = wasm::i32_sub;
+            writeLocalOp(wasm::set_local, 4);
+
+            writeBlockOp(wasm::block);
+            writeBlockOp(wasm::loop);
+            writeLocalOp(wasm::get_local, 4);
+            *writePos++ = wasm::i32_eqz;
+            *writePos++ = wasm::br_if;
+            *writePos++ = 1;
+            writePutChar('0');
+            writeLocalOp(wasm::get_local, 4);
+            writeI32Const(1);
+            *writePos++ = wasm::i32_sub;
+            writeLocalOp(wasm::set_local, 4);
+            *writePos++ = wasm::br;
+            *writePos++ = 0;
+            *writePos++ = wasm::end;
+            *writePos++ = wasm::end;
+
+            writeI32Const(scratch);
+            writeLocalOp(wasm::get_local, 3);
+            writeCall(stdoutFuncs + StdoutFunc::PutString);
+        }
+        *writePos++ = wasm::end;
+    }
+    endGeneratedFunction(functionBodySize);
+
+    //Flush() only calls out to the host when there is something in the ring
+    functionBodySize = beginGeneratedFunction(nullptr, 0);
+    {
+        writeI32Const(0);
+        writeMemoryOp(wasm::i32_load, DataRegion::StdoutRing, writeCount);
+        writeI32Const(0);
+        writeMemoryOp(wasm::i32_load, DataRegion::StdoutRing, readCount);
+        *writePos++ = wasm::i32_ne;
+        writeBlockOp(wasm::_if);
+        writeCall(flushStdoutImport);
+        *writePos++ = wasm::end;
+    }
+    endGeneratedFunction(functionBodySize);
+}
+
+/* Write the bodies of the functions that append commands to the draw list, in the order of DrawFunc.
+Each takes the same parameters as the import it replaces */
+void writeDrawFunctions()
+{
+    u32 commandCount = drawListAddress;
+    u32 commands = drawListAddress + 16;
+
+    //local 3 holds the command count and local 4 the offset of the new command
+    u8 circleLocals[] = {wasm::type::i32, wasm::type::i32};
+    u8 *functionBodySize = beginGeneratedFunction(circleLocals, 2);
+    {
+        //the host draws and empties a full list
+        writeI32Const(0);
+        writeMemoryOp(wasm::i32_load, DataRegion::DrawList, commandCount);
+        writeLocalOp(wasm::tee_local, 3);
+        writeI32Const(DRAW_LIST_CAPACITY);
+        *writePos++ = wasm::i32_ge_u;
+        writeBlockOp(wasm::_if);
+        writeCall(flushDrawListImport);
+        writeI32Const(0);
+        writeLocalOp(wasm::set_local, 3);
+        *writePos++ = wasm::end;
+
+        writeLocalOp(wasm::get_local, 3);
+        writeI32Const(4);
+        *writePos++ = wasm::i32_shl;
+        writeLocalOp(wasm::tee_local, 4);
+        writeI32Const(DrawCommand::Circle);
+        writeMemoryOp(wasm::i32_store, DataRegion::DrawList, commands);
+
+        for (u32 i = 0; i < 3; ++i)
+        {
+            writeLocalOp(wasm::get_local, 4);
+            writeLocalOp(wasm::get_local, i);
+            writeMemoryOp(wasm::f32_store, DataRegion::DrawList, commands + 4 + 4 * i);
+        }
+
+        writeI32Const(0);
+        writeLocalOp(wasm::get_local, 3);
+        writeI32Const(1);
+        *writePos++ = wasm::i32_add;
+        writeMemoryOp(wasm::i32_store, DataRegion::DrawList, commandCount);
+    }
+    endGeneratedFunction(functionBodySize);
+}
+
+//readPos must be placed at the return type token of a function definition
+void writeFunction();
+void buildFunctionIR(u32 bodyTokenCount, u32 localCount);
+void allocateLocals(u32 paramCount, u32 localCount, u32 *slotCountByType);
+void writeFunctionIR();
+
+u32 getFuncIndex(u64 funcNameHash);
+u32 getLocalVarIndex(u64 varNameHash);
+u32 getGlobalVarIndex(u64 varNameHash);
+
+void writeMetaData();
+
+/* Only the functions named by the export roots are exported, and only the functions they reach through calls and the
+imports those call are in the module.  Without roots set for a compilation, the roots are main, which the host calls
+once, and update, which it calls every frame */
+#define MAX_EXPORT_ROOTS 16
+typedef u64 ExportRootHashes[MAX_EXPORT_ROOTS];
+COMPILER_STATE(ExportRootHashes, exportRoots);
+COMPILER_STATE(u32, exportRootCount) = NONE;
+
+//set the export roots of the next compilation to the function names in names, separated by commas or spaces
+EXPORT void setExportRoots(char *names, u32 length)
+{
+    exportRootCount = 0;
+
+    char *end = names + length;
+    char *start = names;
+    for (char *c = names; c <= end; ++c) {
+        if (c == end || *c == ',' || *c == ' ' || *c == '\n') {
+            if (c > start && exportRootCount < MAX_EXPORT_ROOTS) {
+                exportRoots[exportRootCount++] = djb_hash(start, c);
+            }
+            start = c + 1;
+        }
+    }
+}
+
+bool isExportRoot(u64 hash)
+{
+    if (exportRootCount == NONE) {
+        return hash == HASH("main") || hash == HASH("update");
+    }
+
+    for (u32 i = 0; i < exportRootCount; ++i) {
+        if (exportRoots[i] == hash) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* A host that compiles the same program after every edit can keep the function bodies of the previous compilation, so
+only the functions that changed are written again.  The bytes of a function body depend only on its own tokens, the
+tokens of the calls inlined into it, and the module layout writeMetaData fixes: the index and type of every function
+and global, the string literals, and the data addresses.  Each body is cached under a hash of all of them, and a
+body whose hash is in the cache is copied into the Code section instead of being written.  The cache is a header,
+an entry for each body, and the bodies one after another, each beginning with its size */
+struct CodeCacheHeader
+{
+    u32 entryCount;
+    u32 size; //of the whole cache, including the header
+};
+
+struct CodeCacheEntry
+{
+    u64 key;
+    u32 offset; //from the start of the cache
+    u32 size;
+};
+
+COMPILER_STATE(u8 *, codeCache); //the cache the next compilation reads, or nullptr
+COMPILER_STATE(u32, codeCacheSize);
+COMPILER_STATE(bool, isWritingCodeCache); //whether the next compilation writes a new cache after its module
+COMPILER_STATE(SymbolTable, cachedBodies); //entry index of each key in codeCache
+COMPILER_STATE(u8 *, newCodeCache);
+COMPILER_STATE(u32, newCodeCacheSize);
+
+//reuse the function bodies of cache, which an earlier compilation wrote, in the next compilation, and write a new
+//cache after its module.  cache may be nullptr to only write a cache.  A host that places the cache in the compiler's
+//memory puts it after the source code, and the compilation allocates past it
+EXPORT void setCodeCache(u8 *cache, u32 size)
+{
+    codeCache = size >= sizeof(CodeCacheHeader) ? cache : nullptr;
+    codeCacheSize = codeCache ? size : 0;
+    isWritingCodeCache = true;
+}
+
+//the cache the last compilation wrote, or 0 if it wrote none
+EXPORT uptr getCodeCacheAddress()
+{
+    return (uptr)newCodeCache;
+}
+
+EXPORT u32 getCodeCacheSize()
+{
+    return newCodeCacheSize;
+}
+
+//mix value into hash like FNV does, folding the high bits back down so the low bits depend on all of them
+u64 mixHash(u64 hash, u64 value)
+{
+    hash = (hash ^ value) * 0x100000001B3ull;
+    return hash ^ (hash >> 29);
+}
+
+//hash the entries of a symbol table independently of the order they were defined in
+u64 hashSymbolTable(SymbolTable *table)
+{
+    u64 hash = 0;
+    for (u32 slot = 0; slot < table->capacity; ++slot) {
+        if (table->keys[slot] != 0) {
+            hash += mixHash(table->keys[slot], table->values[slot]);
+        }
+    }
+    return hash;
+}
+
+u64 hashWords(u64 hash, u32 *words, u32 count)
+{
+    for (u32 i = 0; i < count; ++i) {
+        hash = mixHash(hash, words[i]);
+    }
+    return hash;
+}
+
+//everything outside a function body that the bytes of the body depend on
+u64 hashModuleLayout()
+{
+    u64 hash = mixHash(funcCount, generatedFuncCount);
+    hash = mixHash(hash, hashSymbolTable(&funcs));
+    //the generated functions have the same types in every module
+    for (u32 i = 0; i < funcCount; ++i) {
+        hash = mixHash(hash, types[funcSigs[i]]);
+    }
+
+    hash = mixHash(hash, globalVarCount);
+    hash = mixHash(hash, hashSymbolTable(&globalVars));
+    for (u32 i = 0; i < globalVarCount; ++i) {
+        hash = mixHash(hash, globalVarTypes[i]);
+        hash = mixHash(hash, globalVarInitialValues[i]);
+    }
+
+    hash = mixHash(hash, hashSymbolTable(&stringLiterals));
+    hash = hashWords(hash, stringLiteralOffsets, stringLiteralCount);
+    hash = hashWords(hash, stringLiteralLengths, stringLiteralCount);
+    hash = mixHash(hash, stringDataAddress);
+
+    u32 generated[] = {hasStdout, flushStdoutImport, stdoutRingAddress, stdoutFuncs,
+                       hasDrawList, flushDrawListImport, drawListAddress, drawFuncs};
+    hash = hashWords(hash, generated, sizeof(generated) / sizeof(generated[0]));
+    return hashWords(hash, dataRegionAddresses, DataRegion::Count);
+}
+
+//hash the characters of the tokens from token to end, and of the body of every call inlined among them
+u64 hashTokens(Token *token, Token *end, u64 hash)
+{
+    for (; token < end; ++token) {
+        char *text = getTokenText(token);
+        for (u32 i = 0; i < token->length; ++i) {
+            hash = (hash ^ (u8)text[i]) * 0x100000001B3ull;
+        }
+        hash = mixHash(hash, token->type);
+
+        //which calls are inlined depends on the callee, so an inlined body is part of the caller's key
+        InlineCandidate *callee = getInlinedCallee(token, endReadPos);
+        if (callee) {
+            hash = hashTokens(callee->params, callee->bodyEnd + 1, mixHash(hash, 1));
+        }
+    }
+    return hash;
+}
+
+//find the entry of every body in the cache the host set for this compilation
+void findCachedBodies()
+{
+    CodeCacheHeader *header = (CodeCacheHeader *)codeCache;
+    u32 entryCount = codeCache && header->size == codeCacheSize ? header->entryCount : 0;
+    CodeCacheEntry *entries = (CodeCacheEntry *)(header + 1);
+
+    cachedBodies = allocateSymbolTable(entryCount);
+    if (isOutOfMemory) {
+        return;
+    }
+
+    for (u32 i = 0; i < entryCount; ++i) {
+        defineSymbol(&cachedBodies, entries[i].key, i);
+    }
+}
+
+//the cache key of each local function, once writeMetaData has fixed the module layout
+void hashFunctions()
+{
+    u64 layout = hashModuleLayout();
+
+    for (u32 i = 0; i < localFuncCount; ++i) {
+        Token *body = funcDefinitions[i];
+        while (body < endReadPos && body->hash != HASH("{")) {
+            ++body;
+        }
+
+        //a body that is not terminated runs to the end of the source code
+        Token *bodyEnd = body < endReadPos ? findClosingToken(body, endReadPos) : endReadPos;
+        functionKeys[i] = hashTokens(funcDefinitions[i], bodyEnd + (bodyEnd < endReadPos), layout);
+    }
+}
+
+//write the body of a local function, or copy it from the cache if it has not changed
+void writeFunctionOrCached(u32 funcIndex)
+{
+    u8 *bodyStart = writePos;
+
+    u32 entryIndex = isWritingCodeCache ? lookupSymbol(&cachedBodies, functionKeys[funcIndex]) : NONE;
+    if (entryIndex != NONE) {
+        CodeCacheEntry *entry = (CodeCacheEntry *)(codeCache + sizeof(CodeCacheHeader)) + entryIndex;
+        if (reserveMemory(writePos + entry->size)) {
+            memcpy(writePos, codeCache + entry->offset, entry->size);
+            writePos += entry->size;
+        }
+    } else {
+        readPos = funcDefinitions[funcIndex];
+        writeFunction();
+    }
+
+    if (isWritingCodeCache) {
+        functionBodySizes[funcIndex] = writePos - bodyStart;
+    }
+}
+
+//write the cache of this compilation after the module, from the local function bodies beginning at bodies
+void writeCodeCache(u8 *bodies)
+{
+    u32 headerSize = sizeof(CodeCacheHeader) + localFuncCount * sizeof(CodeCacheEntry);
+    u32 size = headerSize;
+    for (u32 i = 0; i < localFuncCount; ++i) {
+        size += functionBodySizes[i];
+    }
+
+    u8 *cache = (u8 *)(((uptr)writePos + 7) & -8);
+    if (!reserveMemory(cache + size)) {
+        return;
+    }
+
+    CodeCacheHeader *header = (CodeCacheHeader *)cache;
+    header->entryCount = localFuncCount;
+    header->size = size;
+
+    CodeCacheEntry *entries = (CodeCacheEntry *)(header + 1);
+    u32 offset = headerSize;
+    for (u32 i = 0; i < localFuncCount; ++i) {
+        entries[i].key = functionKeys[i];
+        entries[i].offset = offset;
+        entries[i].size = functionBodySizes[i];
+
+        memcpy(cache + offset, bodies, functionBodySizes[i]);
+        bodies += functionBodySizes[i];
+        offset += functionBodySizes[i];
+    }
+
+    newCodeCache = cache;
+    newCodeCacheSize = size;
+}
+
+#ifndef __wasm__
+/* Once writeMetaData has fixed the function indexes, types and data layout, writing a function body only reads that
+module state.  A native host can then write ranges of function bodies on several threads at once.  Each worker copies
+the module state into its own compiler state, allocates function tables of its own, and writes its bodies to its own
+memory, and the bodies are copied into the Code section in order afterwards */
+#define MAX_CODEGEN_THREADS 64
+COMPILER_STATE(u32, codegenThreadCount) = 1;
+
+IMPORT void runInParallel(void (*task)(void *context, u32 worker), void *context, u32 workerCount)
+    __asm__("hostRunInParallel");
+
+//set how many threads write function bodies.  1 writes them in order on the compiling thread
+EXPORT void setCodegenThreadCount(u32 threadCount)
+{
+    codegenThreadCount = threadCount < 1 ? 1 : threadCount > MAX_CODEGEN_THREADS ? MAX_CODEGEN_THREADS : threadCount;
+}
+
+//everything writeFunction reads but does not change
+#define MODULE_STATE(X)                                                                                              \
+    X(sourceStart) X(sourceEnd) X(endReadPos) X(versionCounter) X(functionTableSizes)                                \
+    X(funcs) X(funcSigs) X(funcCount) X(importedFuncs) X(importedFuncCount) X(localFuncs) X(localFuncCount)          \
+    X(funcDefinitions) X(inlineCandidates) X(inlineCandidateNames) X(types) X(typeCount) X(signatures)               \
+    X(globalVars) X(globalVarTypes) X(globalVarInitialValues) X(globalVarCount)                                      \
+    X(stringLiterals) X(stringLiteralOffsets) X(stringLiteralLengths) X(stringLiteralCount)                          \
+    X(stringData) X(stringDataSize) X(stringDataAddress)                                                             \
+    X(hasStdout) X(flushStdoutImport) X(stdoutRingAddress) X(stdoutFuncs)                                            \
+    X(hasDrawList) X(flushDrawListImport) X(drawListAddress) X(drawFuncs) X(generatedFuncCount)                      \
+    X(dataRegionSizes) X(dataRegionAlignments) X(dataRegionAddresses)                                               \
+    X(codeCache) X(isWritingCodeCache) X(cachedBodies) X(functionKeys) X(functionBodySizes)
+
+struct ModuleState
+{
+#define DECLARE_MODULE_STATE(name) decltype(::name) name;
+    MODULE_STATE(DECLARE_MODULE_STATE)
+#undef DECLARE_MODULE_STATE
+};
+
+struct ParallelCodegen
+{
+    ModuleState module;
+    u32 firstFuncs[MAX_CODEGEN_THREADS + 1]; //each worker writes the functions from its first to the next worker's
+    u8 *bodies[MAX_CODEGEN_THREADS];
+    u32 bodySizes[MAX_CODEGEN_THREADS];
+    u32 errorCounts[MAX_CODEGEN_THREADS];
+    bool wasOutOfMemory[MAX_CODEGEN_THREADS];
+};
+
+//runs on each worker's thread
+void writeFunctionRange(void *context, u32 worker)
+{
+    ParallelCodegen *codegen = (ParallelCodegen *)context;
+
+#define LOAD_MODULE_STATE(name) memcpy(&name, &codegen->module.name, sizeof(name));
+    MODULE_STATE(LOAD_MODULE_STATE)
+#undef LOAD_MODULE_STATE
+
+    //the host gives every worker memory of its own, which begins empty
+    errorCount = 0;
+    isOutOfMemory = false;
+    arenaPos = getMemoryEnd();
+    arenaEnd = arenaPos;
+    allocateFunctionTables();
+
+    writePos = (u8 *)arenaAlloc(0);
+    codegen->bodies[worker] = writePos;
+    for (u32 i = codegen->firstFuncs[worker]; i < codegen->firstFuncs[worker + 1] && !isOutOfMemory; ++i)
+    {
+        writeFunctionOrCached(i);
+    }
+    codegen->bodySizes[worker] = writePos - codegen->bodies[worker];
+    codegen->errorCounts[worker] = errorCount;
+    codegen->wasOutOfMemory[worker] = isOutOfMemory;
+}
+
+void writeFunctionsInParallel()
+{
+    ParallelCodegen codegen;
+
+#define SAVE_MODULE_STATE(name) memcpy(&codegen.module.name, &name, sizeof(name));
+    MODULE_STATE(SAVE_MODULE_STATE)
+#undef SAVE_MODULE_STATE
+
+    //split the functions into runs of about the same number of tokens, counting each function to the next definition
+    u32 workerCount = codegenThreadCount < localFuncCount ? codegenThreadCount : localFuncCount;
+    u32 tokensPerWorker = (endReadPos - funcDefinitions[0]) / workerCount + 1;
+    u32 worker = 0;
+    codegen.firstFuncs[0] = 0;
+    for (u32 i = 1; i < localFuncCount && worker + 1 < workerCount; ++i)
+    {
+        if (funcDefinitions[i] - funcDefinitions[0] >= tokensPerWorker * (worker + 1))
+        {
+            codegen.firstFuncs[++worker] = i;
+        }
+    }
+    workerCount = worker + 1;
+    codegen.firstFuncs[workerCount] = localFuncCount;
+
+    runInParallel(writeFunctionRange, &codegen, workerCount);
+
+    for (u32 i = 0; i < workerCount; ++i)
+    {
+        errorCount += codegen.errorCounts[i];
+        isOutOfMemory |= codegen.wasOutOfMemory[i];
+        if (!isOutOfMemory && reserveMemory(writePos + codegen.bodySizes[i])) {
+            memcpy(writePos, codegen.bodies[i], codegen.bodySizes[i]);
+            writePos += codegen.bodySizes[i];
+        }
+    }
+}
+#endif
+
+//write the body of every local function in order, which the metadata pass found the beginning of
+void writeFunctions()
+{
+    if (isWritingCodeCache)
+    {
+        hashFunctions();
+    }
+
+#ifndef __wasm__
+    if (codegenThreadCount > 1 && localFuncCount > 1)
+    {
+        writeFunctionsInParallel();
+        return;
+    }
+#endif
+
+    for (u32 i = 0; i < localFuncCount && !isOutOfMemory; ++i)
+    {
+        writeFunctionOrCached(i);
+    }
+}
+
+//how many errors the last compilation printed
+EXPORT u32 getErrorCount()
+{
+    return errorCount;
+}
+
+/* store the length of the generated binary at the same memory location that the source code was read in, but rounded
+up to align to 4 bytes, and forget what only lasts for one compilation.  A length of 0 means there is no module */
+void endCompilation(char *sourceCode, u32 wasmModuleSize)
+{
+    u32 *wasmModuleSizeWriteAddress = (u32 *)(((uptr)sourceCode + 3) & -4);
+    *wasmModuleSizeWriteAddress = wasmModuleSize;
+
+    //the export roots and the code cache only last for one compilation
+    exportRootCount = NONE;
+    codeCache = nullptr;
+    codeCacheSize = 0;
+    isWritingCodeCache = false;
+}
+
+EXPORT uptr getWasmFromCpp(char *sourceCode, u32 length)
+{
+    globalVarCount = 0;
+    versionCounter = 0;
+    errorCount = 0;
+    isOutOfMemory = false;
+
+    sourceStart = sourceCode;
+    sourceEnd = sourceCode + length;
+
+    //everything allocated by the previous compilation is discarded.  The arena begins just after the source code,
+    //leaving room for the module size that is written over the start of the source code at the end
+    arenaPos = (u8 *)sourceEnd + 8;
+    arenaEnd = getMemoryEnd();
+    if (codeCache >= (u8 *)sourceEnd && codeCache < arenaEnd && codeCache + codeCacheSize > arenaPos)
+    {
+        arenaPos = codeCache + codeCacheSize;
+    }
+    newCodeCache = nullptr;
+    newCodeCacheSize = 0;
+
+    //lex the whole source code once.  The token stream is the first allocation in the arena, and it grows as it is lexed
+    Token *tokens = (Token *)arenaAlloc(0);
+    Token *endOfTokens = tokenize(sourceStart, sourceEnd, tokens);
+    arenaPos = (u8 *)endOfTokens;
+    if (isOutOfMemory)
+    {
+        endCompilation(sourceCode, 0);
+        return 0;
+    }
+
+    allocateTables(tokens, endOfTokens);
+    collectStringLiterals(tokens, endOfTokens);
+    if (isWritingCodeCache)
+    {
+        findCachedBodies();
+    }
+
+    writePos = (u8 *)arenaAlloc(0);
+    if (isOutOfMemory || !reserveMemory(writePos + 8))
+    {
+        endCompilation(sourceCode, 0);
+        return 0;
+    }
+
+    //the compiled output is the last thing in the arena, so it can keep growing until compilation finishes
+    u8 *wasmModuleStart = writePos;
+
+    //begin the output wasm binary with the 8 byte wasm header
+    for (int i = 0; i < 8; ++i)
+    {
+        *writePos++ = WASM_HEADER[i];
+    }
+
+    readPos = tokens;
+    endReadPos = endOfTokens;
+
+    //detect source code metadata and write the wasm binary up to just before the Code section
+    writeMetaData();
+    if (isOutOfMemory || !reserveMemory(writePos + 16))
+    {
+        endCompilation(sourceCode, 0);
+        return 0;
+    }
+
+    *writePos++ = wasm::section::Code;
+    u8 *codeSectionSize = writePos;
+    writePos += 5;
+    writePos += wasm::varuint(writePos, localFuncCount + generatedFuncCount);
+
+    u8 *functionBodies = writePos;
+    writeFunctions();
+    if (isOutOfMemory || !reserveMemory(writePos + GENERATED_FUNCS_MAX_SIZE))
+    {
+        endCompilation(sourceCode, 0);
+        return 0;
+    }
+
+    if (hasStdout) {
+        writeStdoutFunctions();
+    }
+
+    if (hasDrawList) {
+        writeDrawFunctions();
+    }
+
+    // PRINT_LIT("Finished Loop Function\n");
+
+    writeSectionSize(codeSectionSize);
+
+    //writing the section size in fewer than 5 bytes moved the function bodies back
+    functionBodies -= 5 - getVarintLength(codeSectionSize);
+
+    // PRINT_LIT("Finished Code section\n");
+
+    if (stringDataSize > 0 || hasStdout || hasDrawList)
+    {
+        if (!reserveMemory(writePos + 64 + stringDataSize))
+        {
+            endCompilation(sourceCode, 0);
+            return 0;
+        }
+
+        *writePos++ = wasm::section::Data;
+        u8 *dataSectionSize = writePos;
+        writePos += 5;
+        *writePos++ = (stringDataSize > 0) + hasStdout + hasDrawList; //# of segments
+
+        if (stringDataSize > 0)
+        {
+            //one segment holding every string literal
+            *writePos++ = 0; //memory index
+
+            //initializer expression for the address of the segment
+            *writePos++ = wasm::i32_const;
+            writePos += wasm::varint(writePos, stringDataAddress);
+            *writePos++ = wasm::end;
+
+            writePos += wasm::varuint(writePos, stringDataSize);
+            memcpy(writePos, stringData, stringDataSize);
+            writePos += stringDataSize;
+        }
+
+        if (hasStdout)
+        {
+            //the capacity field of the stdout ring header.  The read and write counts start at 0
+            *writePos++ = 0; //memory index
+            *writePos++ = wasm::i32_const;
+            writePos += wasm::varint(writePos, stdoutRingAddress + 8);
+            *writePos++ = wasm::end;
+
+            u32 capacity = STDOUT_RING_CAPACITY;
+            *writePos++ = 4;
+            memcpy(writePos, &capacity, 4);
+            writePos += 4;
+        }
+
+        if (hasDrawList)
+        {
+            //the capacity field of the draw list header.  The command count starts at 0
+            *writePos++ = 0; //memory index
+            *writePos++ = wasm::i32_const;
+            writePos += wasm::varint(writePos, drawListAddress + 4);
+            *writePos++ = wasm::end;
+
+            u32 capacity = DRAW_LIST_CAPACITY;
+            *writePos++ = 4;
+            memcpy(writePos, &capacity, 4);
+            writePos += 4;
+        }
+
+        writeSectionSize(dataSectionSize);
+    }
+
+    //a body with errors must not be reused without printing them again, so a compilation with errors writes no cache
+    if (isWritingCodeCache && errorCount == 0)
+    {
+        writeCodeCache(functionBodies);
+    }
+
+    //until multiple-return is finalized, this is the next best solution to return two i32's
+    endCompilation(sourceCode, isOutOfMemory ? 0 : writePos - wasmModuleStart);
+    return isOutOfMemory ? 0 : (uptr)wasmModuleStart;
+}
+
+//what writeFunction finds in a body before lowering it, including the bodies of the calls inlined into it
+struct BodyCounts
+{
+    u32 declarationCount; //local variables, including the parameters of inlined bodies
+    u32 callAndIfCount;
+    u32 inlinedTokenCount;
+    u32 inlinedCharCount;
+    u32 accessStamp; //marks the access counts of globals that belong to this function
+};
+
+/* Count the local variables of the body beginning with the open brace at body, which each get a local of their own
+until allocateLocals finds which can share one, and find the globals used more than once.  Returns the token after
+the body's close brace */
+Token *countBody(Token *body, BodyCounts *counts)
+{
+    i32 scopeDepth = 0;
+
+    for (Token *token = body; token < endReadPos; ++token) {
+        if (token->hash == HASH("{")) {
+            ++scopeDepth;
+        }
+        else if (token->hash == HASH("}")) {
+            if (--scopeDepth == 0) {
+                return token + 1;
+            }
+        }
+        else if (token->type == Token::Identifier) {
+            u8 wasmType = getWasmTypeFromCppName(token->hash);
+            InlineCandidate *callee = getInlinedCallee(token, endReadPos);
+            if (wasmType) {
+                // PRINT_LIT("found local var ");
+                // print(token + 1);
+                // PRINT_LIT(" of type ");
+                // puti32(wasmType);
+                // put('\n');
+
+                ++counts->declarationCount;
+            } else if (callee) {
+                //the parameters are variables of the inlined body
+                for (Token *param = callee->params; param < callee->body; ++param) {
+                    counts->declarationCount += param->type == Token::Identifier && getWasmTypeFromCppName(param->hash);
+                }
+
+                counts->inlinedTokenCount += callee->bodyEnd + 1 - callee->params;
+                counts->inlinedCharCount += callee->bodyEnd->offset - callee->params->offset;
+                countBody(callee->body, counts);
+            } else if (token->hash == HASH("if") || getFuncIndex(token->hash) != NONE) {
+                ++counts->callAndIfCount;
+            } else if (token->hash == HASH("while") || token->hash == HASH("for") || token->hash == HASH("do")) {
+                //before the loop and at the end of every iteration
+                counts->callAndIfCount += 2;
+            } else if (token->hash == HASH("switch") || token->hash == HASH("case") || token->hash == HASH("default") ||
+                token->hash == HASH("break"))
+            {
+                //before the switch, at the end of every case, and before every break
+                ++counts->callAndIfCount;
+            } else {
+                //names of locals that shadow a global are counted too, which at worst promotes a global for nothing
+                u32 globalVarIndex = getGlobalVarIndex(token->hash);
+                if (globalVarIndex != NONE) {
+                    if (globalAccessStamps[globalVarIndex] != counts->accessStamp) {
+                        globalAccessStamps[globalVarIndex] = counts->accessStamp;
+                        globalAccessCounts[globalVarIndex] = 0;
+                    }
+
+                    if (++globalAccessCounts[globalVarIndex] == 2 && promotedGlobalCount < MAX_PROMOTED_GLOBALS) {
+                        promotedGlobals[promotedGlobalCount++] = globalVarIndex;
+                    }
+                }
+            }
+        }
+    }
+
+    return endReadPos;
+}
+
+/* This function must be called with readPos pointing to the return type token of a function.
+writePos must point to the first byte of a function body, where the function body size is encoded */
+void writeFunction() {
+    //write to this address at the end of the function once the body size is known
+    u8* functionBodySize = writePos;
+    writePos += 5;
+
+    //readPos is assumed to be at the return type of this function, which the Function section already declared.
+    //Skip return type, function name and open paren
+    readPos += 3;
+
+    u32 paramCount = 0;
+
+    //names from the previous function are no longer visible
+    clearSymbolTable(&localVars);
+    shadowedLocalVarCount = 0;
+
+    //Parse parameters and their types.  Parameters count as local variables
+    while (readPos < endReadPos) {
+        Token *token = readPos++;
+        
+        if (token->type == Token::Identifier) {
+            u8 wasmType = getWasmTypeFromCppName(token->hash);
+            if (wasmType) {
+                Token *paramName = readPos++;
+
+                varTypes[paramCount] = wasmType;
+                declareLocalVar(paramName->hash, paramCount++);
+            } else {
+                PRINT_ERROR("Unable to find wasm type of paramater type \"");
+                print(token);
+                PRINT_LIT("\"\n");
+            }
+        } else if (token->hash == HASH(")")) {
+            break;
+        } else if (token->hash != HASH(",")) {
+            PRINT_ERROR("Found non-parameter \"");
+            print(token);
+            PRINT_LIT("\" in parameter list\n");
+        }        
+    }
+
+    Token *beginningOfFuncBody = readPos;
+
+    //promoted globals are moved between wasm globals and locals around calls, if statements, and loops
+    BodyCounts counts = {};
+    counts.accessStamp = ++versionCounter;
+    promotedGlobalCount = 0;
+    readPos = countBody(beginningOfFuncBody, &counts);
+    indexBody(beginningOfFuncBody, readPos);
+
+    //every token of the body emits a bounded number of bytes, with string literals emitting a few per character
+    u32 bodyTokenCount = readPos - beginningOfFuncBody + counts.inlinedTokenCount;
+    u32 bodyCharCount = readPos[-1].offset - beginningOfFuncBody->offset + counts.inlinedCharCount;
+    if (!reserveMemory(writePos + 64 + 16 * bodyTokenCount + 8 * bodyCharCount)) {
+        return;
+    }
+
+    /* every call, if statement and loop may write back or reload each promoted global, so fewer are promoted in bodies
+    with many of them for the IR to stay within its size.  Promoted globals have locals of their own after the
+    local variables */
+    u32 maxPromotedGlobals = bodyTokenCount / (counts.callAndIfCount + 1);
+    if (promotedGlobalCount > maxPromotedGlobals) {
+        promotedGlobalCount = maxPromotedGlobals;
+    }
+
+    promotedGlobalsStart = paramCount + counts.declarationCount;
+    u32 localCount = promotedGlobalsStart;
+    for (u32 i = 0; i < promotedGlobalCount; ++i) {
+        //the bit of each promoted global is its local's position after the local variables
+        u32 globalVarIndex = promotedGlobals[i];
+        globalLocals[globalVarIndex] = localCount;
+        varTypes[localCount++] = globalVarTypes[globalVarIndex];
+    }
+
+    //declarations set the start of their variable's live range
+    for (u32 i = paramCount; i < localCount; ++i) {
+        liveRangeStarts[i] = NONE;
+        liveRangeEnds[i] = 0;
+    }
+
+    //lower the body to IR, which value numbers expressions and finds dead stores
+    readPos = beginningOfFuncBody;
+    localVarCount = paramCount;
+    buildFunctionIR(bodyTokenCount, localCount);
+
+    //values used more than once get a local of their own, after every local variable
+    for (u32 i = 0; i < exprNodeCount; ++i) {
+        ExprNode *node = &exprNodes[i];
+        if (node->useCount > 1 && node->kind != ExprNode::Const && node->kind != ExprNode::LocalVar) {
+            node->tempLocal = localCount;
+            liveRangeStarts[localCount] = NONE;
+            liveRangeEnds[localCount] = 0;
+            varTypes[localCount++] = node->wasmType;
+        }
+    }
+
+    //locals whose live ranges don't overlap share a slot, and the slots are declared as one run of locals per type
+    u32 slotCountByType[4] = {0};
+    allocateLocals(paramCount, localCount, slotCountByType);
+
+    //encode local variable metadata at the top of the function body
+    u32 localEntryCount = 0;
+    for (u32 i = 0; i < 4; ++i) {
+        localEntryCount += slotCountByType[i] != 0;
+    }
+
+    writePos += wasm::varuint(writePos, localEntryCount);
+    for (u32 i = 0; i < 4; ++i) {
+        if (slotCountByType[i] != 0) {
+            writePos += wasm::varuint(writePos, slotCountByType[i]); //# of locals of the following type
+            *writePos++ = wasm::type::f64 | i; //local type
+        }
+    }
+
+    u8 *code = writePos;
+    writeFunctionIR();
+
+    //end of function
+    if (hasStdout) {
+        writeCall(stdoutFuncs + StdoutFunc::Flush);
+    }
+    *writePos++ = wasm::end;
+
+    writePos = optimizeFunctionBody(code, writePos);
+
+    //patch in the body size of the function earlier in the output
+    writeSectionSize(functionBodySize);
+
+    for (u32 i = 0; i < promotedGlobalCount; ++i) {
+        globalLocals[promotedGlobals[i]] = NONE;
+    }
+
+    //the index belongs to this body
+    indexedBodyStart = nullptr;
+    indexedBodyEnd = nullptr;
+}
+
+bool isAncestorBlock(u32 ancestor, u32 block)
+{
+    //constants and local variables belong to the function's block, which every block is in
+    if (ancestor == 0) {
+        return true;
+    }
+
+    while (blocks[block].depth > blocks[ancestor].depth) {
+        block = blocks[block].parent;
+    }
+    return block == ancestor;
+}
+
+IRInstr *addInstr(IRInstr::Kind kind, u32 index, ExprNode *value)
+{
+    IRInstr *instr = &instrs[instrCount++];
+    instr->kind = kind;
+    instr->convertOp = 0;
+    instr->isLive = true;
+    instr->isRead = false;
+    instr->index = index;
+    instr->block = currentBlock;
+    instr->version = 0;
+    instr->wasmType = value ? value->wasmType : 0;
+    instr->value = value;
+    instr->hoisted = nullptr;
+    return instr;
+}
+
+u64 getValueNumberKey(ExprNode *node)
+{
+    u64 key = node->kind | node->wasmType << 8 | node->operandType << 16 | (u64)node->wasmOp << 32;
+    if (node->kind == ExprNode::BinaryOp) {
+        key |= (u64)*getTokenText(node->op) << 24;
+    }
+
+    key = key * 0x9E3779B97F4A7C15ull ^ node->i64Value;
+    key = key * 0x9E3779B97F4A7C15ull ^ node->version;
+    key = key * 0x9E3779B97F4A7C15ull ^ (node->lhs ? node->lhs - exprNodes + 1 : 0);
+    key = key * 0x9E3779B97F4A7C15ull ^ (node->rhs ? node->rhs - exprNodes + 1 : 0);
+    key = key * 0x9E3779B97F4A7C15ull ^ (node->condition ? node->condition - exprNodes + 1 : 0);
+    return key;
+}
+
+bool isSameValue(ExprNode *a, ExprNode *b)
+{
+    return a->kind == b->kind && a->wasmType == b->wasmType && a->operandType == b->operandType && a->wasmOp == b->wasmOp &&
+        a->i64Value == b->i64Value && a->version == b->version && a->lhs == b->lhs && a->rhs == b->rhs && a->condition == b->condition &&
+        (a->kind != ExprNode::BinaryOp || *getTokenText(a->op) == *getTokenText(b->op));
+}
+
+/* The nodes past the last one are scratch space, which keeps ExprNodes off the stack: the wasm build has a 1 KiB stack
+and the parser recurses once per parenthesis.  A new value is built in the first and becomes a node unless it's a
+duplicate, and constants are converted in copies since other expressions may share them.
+This returns an empty first scratch node, to fill in and pass to internNode */
+ExprNode *newCandidate()
+{
+    ExprNode *candidate = &exprNodes[exprNodeCount];
+    memset(candidate, 0, sizeof(ExprNode));
+    return candidate;
+}
+
+//a copy of a node in scratch node index, which the next candidate overwrites when index is 0
+ExprNode *copyToScratch(ExprNode *node, u32 index)
+{
+    ExprNode *copy = &exprNodes[exprNodeCount + index];
+    *copy = *node;
+    return copy;
+}
+
+void convertConst(ExprNode *node, u8 wasmType);
+
+//whether node is an integer division that could trap, which is any without a constant divisor other than 0 and -1
+bool isTrappingDivision(ExprNode *node)
+{
+    bool isInteger = node->operandType == wasm::type::i32 || node->operandType == wasm::type::i64;
+    if (node->kind != ExprNode::BinaryOp || !isInteger || *getTokenText(node->op) != '/') {
+        return false;
+    }
+
+    if (node->rhs->kind != ExprNode::Const) {
+        return true;
+    }
+
+    //this runs while internNode hoists values, with the candidate in the first scratch node
+    ExprNode *divisor = copyToScratch(node->rhs, 1);
+    convertConst(divisor, node->operandType);
+    i64 value = node->operandType == wasm::type::i32 ? divisor->i32Value : divisor->i64Value;
+    return value == 0 || value == NONE;
+}
+
+//whether computing the value or any of its operands could trap.  No intrinsic traps
+bool canTrap(ExprNode *node)
+{
+    return isTrappingDivision(node) || (node->lhs && canTrap(node->lhs)) || (node->rhs && canTrap(node->rhs)) ||
+        (node->condition && canTrap(node->condition));
+}
+
+//whether the value can be computed in the given block, before the if statement where it was first computed
+bool canHoist(ExprNode *node, u32 block)
+{
+    if (isAncestorBlock(node->block, block)) {
+        return true;
+    }
+
+    //an integer division executed on a path that didn't divide before could trap
+    if (isTrappingDivision(node)) {
+        return false;
+    }
+
+    return (node->lhs == nullptr || canHoist(node->lhs, block)) && (node->rhs == nullptr || canHoist(node->rhs, block)) &&
+        (node->condition == nullptr || canHoist(node->condition, block));
+}
+
+void hoistNode(ExprNode *node, u32 block, IRInstr *ifInstr)
+{
+    if (isAncestorBlock(node->block, block)) {
+        return;
+    }
+
+    //operands are added to the list first so they are computed before the values that use them
+    if (node->lhs) {
+        hoistNode(node->lhs, block, ifInstr);
+    }
+    if (node->rhs) {
+        hoistNode(node->rhs, block, ifInstr);
+    }
+    if (node->condition) {
+        hoistNode(node->condition, block, ifInstr);
+    }
+
+    //a value hoisted out of an inner if statement earlier is now computed before an outer one instead
+    if (node->hoistedBefore) {
+        ExprNode **link = &node->hoistedBefore->hoisted;
+        while (*link != node) {
+            link = &(*link)->nextHoisted;
+        }
+        *link = node->nextHoisted;
+    }
+
+    node->block = block;
+    node->hoistedBefore = ifInstr;
+    node->nextHoisted = nullptr;
+
+    ExprNode **tail = &ifInstr->hoisted;
+    while (*tail) {
+        tail = &(*tail)->nextHoisted;
+    }
+    *tail = node;
+}
+
+/* Return the node computing the same value as candidate, which is built by newCandidate, or make candidate a new
+node if this is the first time the value is computed.
+Values first computed inside an if body that has already ended are hoisted to just before that if statement */
+ExprNode *internNode(ExprNode *candidate)
+{
+    u64 key = getValueNumberKey(candidate);
+    u32 found = lookupSymbol(&valueNumbers, key);
+
+    if (found != NONE && isSameValue(&exprNodes[found], candidate)) {
+        ExprNode *node = &exprNodes[found];
+
+        if (isAncestorBlock(node->block, currentBlock)) {
+            return node;
+        }
+
+        //find the if statement in the innermost block containing both the first computation and this one
+        u32 commonBlock = currentBlock;
+        while (!isAncestorBlock(commonBlock, node->block)) {
+            commonBlock = blocks[commonBlock].parent;
+        }
+
+        u32 ifBody = node->block;
+        while (blocks[ifBody].parent != commonBlock) {
+            ifBody = blocks[ifBody].parent;
+        }
+
+        //a case of a switch may be entered without running the cases before it, so the switch computes the value
+        IRInstr *ifInstr = &instrs[blocks[ifBody].ifInstr];
+        if (ifInstr->kind == IRInstr::Case) {
+            ifInstr = &instrs[blocks[commonBlock].ifInstr];
+        }
+
+        if (canHoist(node, commonBlock)) {
+            hoistNode(node, commonBlock, ifInstr);
+            return node;
+        }
+    }
+
+    ExprNode *node = candidate;
+    ++exprNodeCount;
+
+    //constants and local variables cost nothing to recompute, so they are available everywhere
+    node->block = node->kind == ExprNode::Const || node->kind == ExprNode::LocalVar ? 0 : currentBlock;
+    node->useCount = 0;
+    node->tempLocal = NONE;
+    node->tempBlock = NONE;
+    node->firstUse = NONE;
+    node->lastUse = 0;
+    node->hoistedBefore = nullptr;
+    node->nextHoisted = nullptr;
+
+    defineSymbol(&valueNumbers, key, node - exprNodes);
+    return node;
+}
+
+//bits past the size of wasmType are ignored
+ExprNode *getConstNode(u8 wasmType, u64 bits)
+{
+    ExprNode *candidate = newCandidate();
+    candidate->kind = ExprNode::Const;
+    candidate->wasmType = wasmType;
+    candidate->i64Value = wasmType == wasm::type::i64 || wasmType == wasm::type::f64 ? bits : (u32)bits;
+    return internNode(candidate);
+}
+
+ExprNode *readLocalVar(u32 varIndex)
+{
+    IRInstr *lastStore = lastLocalStores[varIndex];
+
+    //a constant is cheaper to push than a local, and the store may not be needed at all
+    if (lastStore && lastStore->version == localVersions[varIndex] && lastStore->value->kind == ExprNode::Const) {
+        ExprNode *value = copyToScratch(lastStore->value, 0);
+        convertConst(value, varTypes[varIndex]);
+        return getConstNode(value->wasmType, value->i64Value);
+    }
+
+    //the store that produced this version of the variable now has a reader
+    if (lastStore) {
+        lastStore->isLive = true;
+    }
+
+    ExprNode *candidate = newCandidate();
+    candidate->kind = ExprNode::LocalVar;
+    candidate->wasmType = varTypes[varIndex];
+    candidate->varIndex = varIndex;
+    candidate->version = localVersions[varIndex];
+    return internNode(candidate);
+}
+
+//the last store to a global variable in this function, or nullptr
+IRInstr *getLastGlobalStore(u32 varIndex)
+{
+    return globalVersions[varIndex] > functionStartVersion ? lastGlobalStores[varIndex] : nullptr;
+}
+
+//a get_global of a global variable
+ExprNode *loadGlobalVar(u32 varIndex)
+{
+    IRInstr *lastStore = getLastGlobalStore(varIndex);
+    if (lastStore) {
+        lastStore->isRead = true;
+    }
+
+    ExprNode *candidate = newCandidate();
+    candidate->kind = ExprNode::GlobalVar;
+    candidate->wasmType = globalVarTypes[varIndex];
+    candidate->varIndex = varIndex;
+    candidate->version = globalVersions[varIndex] > lastCallVersion ? globalVersions[varIndex] : lastCallVersion;
+    return internNode(candidate);
+}
+
+void setGlobalVar(u32 varIndex, ExprNode *value);
+
+void writeBackPromotedGlobals(u64 mask)
+{
+    for (u32 i = 0; i < promotedGlobalCount; ++i) {
+        if (mask & ((u64)1 << i)) {
+            setGlobalVar(promotedGlobals[i], readLocalVar(promotedGlobalsStart + i));
+        }
+    }
+    dirtyGlobals &= ~mask;
+}
+
+ExprNode *readGlobalVar(u32 varIndex)
+{
+    if (globalLocals[varIndex] != NONE) {
+        u32 promoted = globalLocals[varIndex] - promotedGlobalsStart;
+        if (staleGlobals & ((u64)1 << promoted)) {
+            promotedValues[promoted] = loadGlobalVar(varIndex);
+            staleGlobals &= ~((u64)1 << promoted);
+        }
+
+        return promotedValues[promoted] ? promotedValues[promoted] : readLocalVar(globalLocals[varIndex]);
+    }
+
+    /* no call can have changed a global stored since the last call, so the stored value is reused without a load.
+    A computed value is kept in a local from where it is stored, so that store has to be written.
+    A local variable is the one value that isn't kept, so it is only reused while the local still holds it */
+    ExprNode *value = globalValues[varIndex];
+    if (globalVersions[varIndex] > lastCallVersion && value &&
+        (value->kind != ExprNode::LocalVar || value->version == localVersions[value->varIndex]))
+    {
+        if (value->kind != ExprNode::Const) {
+            lastGlobalStores[varIndex]->isRead = true;
+        }
+        return value;
+    }
+
+    return loadGlobalVar(varIndex);
+}
+
+void storeLocalVar(u32 varIndex, ExprNode *value)
+{
+    //local stores are only written once something reads them
+    IRInstr *store = addInstr(IRInstr::StoreLocal, varIndex, value);
+    store->isLive = false;
+    store->wasmType = varTypes[varIndex];
+    store->version = ++versionCounter;
+
+    storeLog[storeLogCount++] = {false, varIndex, lastLocalStores[varIndex]};
+    lastLocalStores[varIndex] = store;
+    localVersions[varIndex] = store->version;
+}
+
+void setGlobalVar(u32 varIndex, ExprNode *value)
+{
+    //a store overwritten in the same block before any load or call could observe it is dead
+    IRInstr *previousStore = getLastGlobalStore(varIndex);
+    if (previousStore && !previousStore->isRead && previousStore->block == currentBlock &&
+        previousStore->version > lastCallVersion)
+    {
+        previousStore->isLive = false;
+    }
+
+    IRInstr *store = addInstr(IRInstr::StoreGlobal, varIndex, value);
+    store->wasmType = globalVarTypes[varIndex];
+    store->version = ++versionCounter;
+
+    storeLog[storeLogCount++] = {true, varIndex, previousStore};
+    lastGlobalStores[varIndex] = store;
+    globalVersions[varIndex] = store->version;
+    globalValues[varIndex] = value;
+}
+
+void storeGlobalVar(u32 varIndex, ExprNode *value)
+{
+    if (globalLocals[varIndex] != NONE) {
+        u32 promoted = globalLocals[varIndex] - promotedGlobalsStart;
+        storeLocalVar(globalLocals[varIndex], value);
+        promotedValues[promoted] = nullptr;
+        staleGlobals &= ~((u64)1 << promoted);
+        dirtyGlobals |= (u64)1 << promoted;
+        return;
+    }
+
+    setGlobalVar(varIndex, value);
+}
+
+ExprNode *parseExpression(u32 minPrecedence);
+
+//binding strength of each supported binary operator, or 0 for tokens that end an expression
+u32 getOperatorPrecedence(char op)
+{
+    switch (op)
+    {
+    case '*':
+    case '/':
+        return 3;
+    case '+':
+    case '-':
+        return 2;
+    case '<':
+    case '>':
+        return 1;
+    }
+
+    return 0;
+}
+
+u32 getOperatorPrecedence(Token *token)
+{
+    if (token->type != Token::Symbol || token->length != 1) {
+        return 0;
+    }
+
+    return getOperatorPrecedence(*getTokenText(token));
+}
+
+ExprNode *parseNumber(Token *token)
+{
+    char *start = getTokenText(token);
+    char *end = start + token->length;
+
+    //like C++, literals with a decimal point are doubles and other literals are ints, unless a suffix says otherwise
+    bool hasDecimalPoint = false;
+    bool isFloat = false;
+    bool isLong = false;
+    for (char* c = start; c != end; ++c) {
+        hasDecimalPoint |= *c == '.';
+        isFloat |= *c == 'f';
+        isLong |= *c == 'l' || *c == 'L';
+    }
+
+    //the suffix isn't part of the value, and the trailing f at the end of float literals is optional
+    while (end[-1] == 'f' || end[-1] == 'l' || end[-1] == 'L') {
+        --end;
+    }
+
+    if (isFloat) {
+        f32 value = stod(start, end);
+        u32 bits;
+        memcpy(&bits, &value, 4);
+        return getConstNode(wasm::type::f32, bits);
+    }
+
+    if (hasDecimalPoint) {
+        f64 value = stod(start, end);
+        u64 bits;
+        memcpy(&bits, &value, 8);
+        return getConstNode(wasm::type::f64, bits);
+    }
+
+    //an integer literal too large for an int is a long
+    i64 value = stol(start, end);
+    if (isLong || value != (i32)value) {
+        return getConstNode(wasm::type::i64, value);
+    }
+
+    return getConstNode(wasm::type::i32, (u32)value);
+}
+
+ExprNode *makeIntrinsic(Intrinsic *intrinsic, ExprNode *lhs, ExprNode *rhs);
+
+//an operand is a variable, a number, a character, a math function, or a parenthesized expression.  Returns nullptr if there is no operand
+ExprNode *parseOperand()
+{
+    Token *token = readPos;
+
+    if (token->hash == HASH("(")) {
+        ++readPos;
+        ExprNode *node = parseExpression(1);
+        if (readPos < endReadPos && readPos->hash == HASH(")")) {
+            ++readPos;
+        }
+        return node;
+    }
+
+    else if (token->type == Token::Number) {
+        ++readPos;
+        return parseNumber(token);
+    }
+
+    else if (token->type == Token::CharLit) {
+        ++readPos;
+        return getConstNode(wasm::type::i32, decodeCharLiteral(token));
+    }
+
+    else if (token->type == Token::Identifier) {
+        ++readPos;
+
+        //math functions are computed by instructions in place instead of being called
+        Intrinsic *intrinsic = getIntrinsic(token->hash);
+        if (intrinsic && readPos < endReadPos && readPos->hash == HASH("(")) {
+            ++readPos;
+            ExprNode *lhs = parseExpression(1);
+            ExprNode *rhs = nullptr;
+            if (intrinsic->operandCount == 2 && readPos < endReadPos && readPos->hash == HASH(",")) {
+                ++readPos;
+                rhs = parseExpression(1);
+            }
+
+            if (readPos < endReadPos && readPos->hash == HASH(")")) {
+                ++readPos;
+            }
+
+            if (lhs == nullptr || (intrinsic->operandCount == 2 && rhs == nullptr)) {
+                PRINT_ERROR("Wrong number of arguments to ");
+                print(token);
+                put('\n');
+                return nullptr;
+            }
+
+            return makeIntrinsic(intrinsic, lhs, rhs);
+        }
+
+        u32 varIndex = getLocalVarIndex(token->hash);
+        if (varIndex != NONE) {
+            return readLocalVar(varIndex);
+        }
+
+        varIndex = getGlobalVarIndex(token->hash);
+        if (varIndex != NONE) {
+            return readGlobalVar(varIndex);
+        }
+
+        PRINT_ERROR("Failed to find variable ");
+        print(token);
+        put('\n');
+    }
+
+    return nullptr;
+}
+
+bool isPowerOf2(u32 value)
+{
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+u32 log2(u32 powerOf2)
+{
+    u32 result = 0;
+    while (powerOf2 >>= 1) {
+        ++result;
+    }
+    return result;
+}
+
+//convert a constant to the type of the operation that consumes it
+void convertConst(ExprNode *node, u8 wasmType)
+{
+    if (node->wasmType == wasmType || wasmType == 0) {
+        return;
+    }
+
+    //read the value as the widest type of its kind, then clear the bits a 32 bit result doesn't overwrite
+    bool isInteger = node->wasmType == wasm::type::i32 || node->wasmType == wasm::type::i64;
+    i64 integer = node->wasmType == wasm::type::i32 ? node->i32Value : node->i64Value;
+    f64 real = node->wasmType == wasm::type::f32 ? node->f32Value : node->f64Value;
+    node->i64Value = 0;
+
+    switch (wasmType)
+    {
+    case wasm::type::i32:
+        node->i32Value = isInteger ? (i32)integer : (i32)real;
+        break;
+    case wasm::type::i64:
+        node->i64Value = isInteger ? integer : (i64)real;
+        break;
+    case wasm::type::f32:
+        node->f32Value = isInteger ? (f32)integer : (f32)real;
+        break;
+    case wasm::type::f64:
+        node->f64Value = isInteger ? (f64)integer : real;
+        break;
+    }
+    node->wasmType = wasmType;
+}
+
+//the instruction converting a value of one type to another, or 0 if the types are the same
+u8 getConversionOp(u8 from, u8 to)
+{
+    switch (from)
+    {
+    case wasm::type::i32:
+        return to == wasm::type::i64 ? wasm::i64_extend_s_from_i32 :
+            to == wasm::type::f32 ? wasm::f32_convert_s_from_i32 :
+            to == wasm::type::f64 ? wasm::f64_convert_s_from_i32 : 0;
+    case wasm::type::i64:
+        return to == wasm::type::i32 ? wasm::i32_wrap_from_i64 :
+            to == wasm::type::f32 ? wasm::f32_convert_s_from_i64 :
+            to == wasm::type::f64 ? wasm::f64_convert_s_from_i64 : 0;
+    case wasm::type::f32:
+        return to == wasm::type::i32 ? wasm::i32_trunc_s_from_f32 :
+            to == wasm::type::i64 ? wasm::i64_trunc_s_from_f32 :
+            to == wasm::type::f64 ? wasm::f64_promote_from_f32 : 0;
+    case wasm::type::f64:
+        return to == wasm::type::i32 ? wasm::i32_trunc_s_from_f64 :
+            to == wasm::type::i64 ? wasm::i64_trunc_s_from_f64 :
+            to == wasm::type::f32 ? wasm::f32_demote_from_f64 : 0;
+    }
+
+    return 0;
+}
+
+//C++'s usual arithmetic conversions: the wider of two floating point types, else any floating point type, else the wider integer
+u8 getCommonType(u8 a, u8 b)
+{
+    if (a == wasm::type::f64 || b == wasm::type::f64) {
+        return wasm::type::f64;
+    }
+    if (a == wasm::type::f32 || b == wasm::type::f32) {
+        return wasm::type::f32;
+    }
+    if (a == wasm::type::i64 || b == wasm::type::i64) {
+        return wasm::type::i64;
+    }
+    return wasm::type::i32;
+}
+
+/* Evaluate an operation on two constants exactly as the wasm instruction would at runtime, storing the result in lhs.
+Returns false for operations that trap, which are left for runtime.  Constants are shared, so both are copies */
+bool foldConstants(ExprNode *lhs, char op, ExprNode *rhs, u8 operandType)
+{
+    convertConst(lhs, operandType);
+    convertConst(rhs, operandType);
+
+    //comparisons leave an i32 whatever type they compare
+    bool isComparison = op == '<' || op == '>';
+
+    if (operandType == wasm::type::i32 || operandType == wasm::type::i64) {
+        /* i32 operands are sign extended, so each i32 result is the low bits of the same operation on 64 bit values.
+        Integer arithmetic wraps, so it is done on unsigned values */
+        bool is64 = operandType == wasm::type::i64;
+        u64 a = is64 ? lhs->i64Value : (i64)lhs->i32Value;
+        u64 b = is64 ? rhs->i64Value : (i64)rhs->i32Value;
+        u64 minValue = is64 ? 0x8000000000000000ull : 0xFFFFFFFF80000000ull;
+        u64 result;
+
+        switch (op)
+        {
+        case '+':
+            result = a + b;
+            break;
+        case '-':
+            result = a - b;
+            break;
+        case '*':
+            result = a * b;
+            break;
+        case '/':
+            if (b == 0 || (a == minValue && b == (u64)-1)) {
+                return false;
+            }
+            result = (i64)a / (i64)b;
+            break;
+        case '<':
+            result = (i64)a < (i64)b;
+            break;
+        case '>':
+            result = (i64)a > (i64)b;
+            break;
+        default:
+            return false;
+        }
+
+        lhs->i64Value = is64 && !isComparison ? result : (u32)result;
+    } else if (operandType == wasm::type::f32) {
+        f32 a = lhs->f32Value;
+        f32 b = rhs->f32Value;
+
+        switch (op)
+        {
+        case '+':
+            lhs->f32Value = a + b;
+            break;
+        case '-':
+            lhs->f32Value = a - b;
+            break;
+        case '*':
+            lhs->f32Value = a * b;
+            break;
+        case '/':
+            lhs->f32Value = a / b;
+            break;
+        case '<':
+            lhs->i64Value = a < b;
+            break;
+        case '>':
+            lhs->i64Value = a > b;
+            break;
+        default:
+            return false;
+        }
+    } else if (operandType == wasm::type::f64) {
+        f64 a = lhs->f64Value;
+        f64 b = rhs->f64Value;
+
+        switch (op)
+        {
+        case '+':
+            lhs->f64Value = a + b;
+            break;
+        case '-':
+            lhs->f64Value = a - b;
+            break;
+        case '*':
+            lhs->f64Value = a * b;
+            break;
+        case '/':
+            lhs->f64Value = a / b;
+            break;
+        case '<':
+            lhs->i64Value = a < b;
+            break;
+        case '>':
+            lhs->i64Value = a > b;
+            break;
+        default:
+            return false;
+        }
+    } else {
+        return false;
+    }
+
+    if (isComparison) {
+        lhs->wasmType = wasm::type::i32;
+    }
+
+    return true;
+}
+
+/* Combine two operands with a binary operator, folding the operation if both are constants.
+Chains of integer additions or multiplications by constants are reassociated, which is exact because i32 arithmetic wraps.
+Float operations are never reassociated.  Nodes may be shared by other expressions, so results are always new nodes */
+ExprNode *makeBinaryOp(ExprNode *lhs, Token *op, ExprNode *rhs)
+{
+    //operands of different types are converted to a common type
+    u8 operandType = getCommonType(lhs->wasmType, rhs->wasmType);
+    char opChar = *getTokenText(op);
+    bool isComparison = opChar == '<' || opChar == '>';
+
+    if (lhs->kind == ExprNode::Const && rhs->kind == ExprNode::Const) {
+        ExprNode *folded = copyToScratch(lhs, 0);
+        ExprNode *rhsValue = copyToScratch(rhs, 1);
+        if (foldConstants(folded, opChar, rhsValue, operandType)) {
+            return getConstNode(folded->wasmType, folded->i64Value);
+        }
+    }
+
+    //x + y and y + x are the same value, so operands of + and * are put in one order with any constant on the right
+    if ((opChar == '+' || opChar == '*') &&
+        (lhs->kind == ExprNode::Const || (rhs->kind != ExprNode::Const && lhs > rhs)))
+    {
+        ExprNode *temp = lhs;
+        lhs = rhs;
+        rhs = temp;
+    }
+
+    if (operandType == wasm::type::i32 && rhs->kind == ExprNode::Const && lhs->kind == ExprNode::BinaryOp &&
+        lhs->rhs->kind == ExprNode::Const && lhs->operandType == wasm::type::i32)
+    {
+        char lhsOpChar = *getTokenText(lhs->op);
+        u32 c1 = lhs->rhs->i32Value;
+        u32 c2 = rhs->i32Value;
+
+        //(x + c1) + c2 becomes x + (c1 + c2), and likewise for any mix of + and -
+        if ((lhsOpChar == '+' || lhsOpChar == '-') && (opChar == '+' || opChar == '-')) {
+            return makeBinaryOp(lhs->lhs, lhs->op, getConstNode(wasm::type::i32, lhsOpChar == opChar ? c1 + c2 : c1 - c2));
+        }
+
+        //(x * c1) * c2 becomes x * (c1 * c2)
+        if (lhsOpChar == '*' && opChar == '*') {
+            return makeBinaryOp(lhs->lhs, lhs->op, getConstNode(wasm::type::i32, c1 * c2));
+        }
+    }
+
+    ExprNode *candidate = newCandidate();
+    candidate->kind = ExprNode::BinaryOp;
+    candidate->wasmType = isComparison ? (u8)wasm::type::i32 : operandType;
+    candidate->operandType = operandType;
+    candidate->op = op;
+    candidate->lhs = lhs;
+    candidate->rhs = rhs;
+    return internNode(candidate);
+}
+
+/* Evaluate an intrinsic of constants exactly as its instructions would at runtime, storing the result in lhs.
+rhs is ignored by intrinsics of one operand.  Returns false when an operand or the result is NaN, whose bits the C++
+library functions don't match */
+bool foldIntrinsic(ExprNode *lhs, u8 op, ExprNode *rhs, u8 operandType)
+{
+    convertConst(lhs, operandType);
+    convertConst(rhs, operandType);
+
+    bool isI64 = operandType == wasm::type::i64;
+    if (isI64 || operandType == wasm::type::i32) {
+        //i32 values are sign extended, and getConstNode keeps the low 32 bits of the result
+        i64 a = isI64 ? lhs->i64Value : lhs->i32Value;
+        i64 b = isI64 ? rhs->i64Value : rhs->i32Value;
+        u32 bitCount = isI64 ? 64 : 32;
+        u64 bits = isI64 ? a : (u32)a;
+
+        switch (isI64 ? op - (wasm::i64_clz - wasm::i32_clz) : op)
+        {
+        case wasm::i32_clz:
+            lhs->i64Value = bits == 0 ? bitCount : __builtin_clzll(bits) - (64 - bitCount);
+            return true;
+        case wasm::i32_ctz:
+            lhs->i64Value = bits == 0 ? bitCount : __builtin_ctzll(bits);
+            return true;
+        case wasm::i32_popcnt:
+            lhs->i64Value = __builtin_popcountll(bits);
+            return true;
+        }
+
+        //abs is the only select intrinsic of one operand, and wraps for the minimum value like the select does
+        if (rhs == lhs) {
+            lhs->i64Value = a < 0 ? 0ull - (u64)a : a;
+        } else {
+            lhs->i64Value = (op == wasm::i32_lt_s || op == wasm::i64_lt_s ? a < b : a > b) ? a : b;
+        }
+        return true;
+    }
+
+    //every f32 intrinsic is exact or correctly rounded, so computing it as an f64 and rounding gives the same result
+    bool isF32 = operandType == wasm::type::f32;
+    f64 a = isF32 ? lhs->f32Value : lhs->f64Value;
+    f64 b = isF32 ? rhs->f32Value : rhs->f64Value;
+    f64 result;
+
+    //the f64 instructions follow the f32 ones in the same order, and so do the comparisons min and max select with
+    bool isComparison = op == wasm::f64_lt || op == wasm::f64_gt;
+    switch (isF32 ? op : isComparison ? op - (wasm::f64_lt - wasm::f32_lt) : op - (wasm::f64_sqrt - wasm::f32_sqrt))
+    {
+    case wasm::f32_sqrt:
+        result = __builtin_sqrt(a);
+        break;
+    case wasm::f32_floor:
+        result = __builtin_floor(a);
+        break;
+    case wasm::f32_ceil:
+        result = __builtin_ceil(a);
+        break;
+    case wasm::f32_trunc:
+        result = __builtin_trunc(a);
+        break;
+    case wasm::f32_nearest:
+        result = __builtin_rint(a);
+        break;
+    case wasm::f32_abs:
+        result = __builtin_fabs(a);
+        break;
+    case wasm::f32_copysign:
+        result = __builtin_copysign(a, b);
+        break;
+    case wasm::f32_lt:
+        result = a < b ? a : b;
+        break;
+    case wasm::f32_gt:
+        result = a > b ? a : b;
+        break;
+    default:
+        return false;
+    }
+
+    if (a != a || b != b || result != result) {
+        return false;
+    }
+
+    if (isF32) {
+        lhs->i64Value = 0;
+        lhs->f32Value = result;
+    } else {
+        lhs->f64Value = result;
+    }
+    return true;
+}
+
+ExprNode *makeSelect(ExprNode *condition, ExprNode *lhs, ExprNode *rhs, u8 wasmType);
+
+//1 if a float value is NaN and 0 if it isn't, as x != x
+ExprNode *makeNaNTest(ExprNode *node, u8 wasmType)
+{
+    if (node->kind == ExprNode::Const) {
+        ExprNode *value = copyToScratch(node, 0);
+        convertConst(value, wasm::type::f64);
+        return getConstNode(wasm::type::i32, value->f64Value != value->f64Value);
+    }
+
+    ExprNode *candidate = newCandidate();
+    candidate->kind = ExprNode::Intrinsic;
+    candidate->wasmType = wasm::type::i32;
+    candidate->operandType = wasmType;
+    candidate->wasmOp = wasmType == wasm::type::f32 ? wasm::f32_ne : wasm::f64_ne;
+    candidate->lhs = node;
+    candidate->rhs = node;
+    return internNode(candidate);
+}
+
+//an intrinsic of one operand has a nullptr rhs
+ExprNode *makeIntrinsic(Intrinsic *intrinsic, ExprNode *lhs, ExprNode *rhs)
+{
+    //overloads are chosen by the usual arithmetic conversions, except that math functions take integers as doubles
+    u8 operandType = intrinsic->operandType;
+    if (operandType == 0) {
+        operandType = rhs ? getCommonType(lhs->wasmType, rhs->wasmType) : lhs->wasmType;
+        bool isInteger = operandType == wasm::type::i32 || operandType == wasm::type::i64;
+        if (isInteger && intrinsic->i32Op == 0) {
+            operandType = wasm::type::f64;
+        }
+    }
+
+    //the i64 and f64 instructions follow the i32 and f32 ones in the same order, as do the float comparisons
+    u8 op;
+    switch (operandType)
+    {
+    case wasm::type::i32:
+        op = intrinsic->i32Op;
+        break;
+    case wasm::type::i64:
+        if (intrinsic->i32Op == wasm::i32_lt_s || intrinsic->i32Op == wasm::i32_gt_s) {
+            op = intrinsic->i32Op + (wasm::i64_lt_s - wasm::i32_lt_s);
+        } else {
+            op = intrinsic->i32Op + (wasm::i64_clz - wasm::i32_clz);
+        }
+        break;
+    case wasm::type::f32:
+        op = intrinsic->f32Op;
+        break;
+    default:
+        if (intrinsic->f32Op == wasm::f32_lt || intrinsic->f32Op == wasm::f32_gt) {
+            op = intrinsic->f32Op + (wasm::f64_lt - wasm::f32_lt);
+        } else {
+            op = intrinsic->f32Op + (wasm::f64_sqrt - wasm::f32_sqrt);
+        }
+        break;
+    }
+
+    /* min(a, b) is select(a, b, a < b), which gives b when they are equal or either is NaN.  std::min(a, b) is
+    b < a ? b : a, so its operands are swapped, and std::max(a, b) is a < b ? b : a, which is b > a ? b : a.
+    Equal integers are the same value, so only float operands need swapping */
+    bool isFloatSelect = op == wasm::f32_lt || op == wasm::f32_gt || op == wasm::f64_lt || op == wasm::f64_gt;
+    if (isFloatSelect && intrinsic->i32Op != 0) {
+        ExprNode *temp = lhs;
+        lhs = rhs;
+        rhs = temp;
+    }
+
+    if (lhs->kind == ExprNode::Const && (rhs == nullptr || rhs->kind == ExprNode::Const)) {
+        ExprNode *folded = copyToScratch(lhs, 0);
+        ExprNode *rhsValue = rhs ? copyToScratch(rhs, 1) : folded;
+        if (foldIntrinsic(folded, op, rhsValue, operandType)) {
+            return getConstNode(folded->wasmType, folded->i64Value);
+        }
+    }
+
+    ExprNode *candidate = newCandidate();
+    candidate->kind = ExprNode::Intrinsic;
+    candidate->wasmType = operandType;
+    candidate->operandType = operandType;
+    candidate->wasmOp = op;
+    candidate->lhs = lhs;
+    candidate->rhs = rhs;
+    ExprNode *node = internNode(candidate);
+
+    //fmin and fmax return the operand that isn't NaN, which the select already gives unless rhs is NaN
+    if (isFloatSelect && intrinsic->i32Op == 0) {
+        return makeSelect(makeNaNTest(rhs, operandType), lhs, node, operandType);
+    }
+    return node;
+}
+
+//whether a constant is true as a condition
+bool isNonzeroConst(ExprNode *node)
+{
+    switch (node->wasmType)
+    {
+    case wasm::type::f32:
+        return node->f32Value != 0;
+    case wasm::type::f64:
+        return node->f64Value != 0;
+    default:
+        return node->i64Value != 0;
+    }
+}
+
+/* condition ? lhs : rhs, with both operands converted to wasmType.  Expressions have no side effects, so both
+operands can be computed and one chosen with select */
+ExprNode *makeSelect(ExprNode *condition, ExprNode *lhs, ExprNode *rhs, u8 wasmType)
+{
+    if (condition->kind == ExprNode::Const) {
+        ExprNode *chosen = isNonzeroConst(condition) ? lhs : rhs;
+        if (chosen->kind == ExprNode::Const) {
+            ExprNode *value = copyToScratch(chosen, 0);
+            convertConst(value, wasmType);
+            return getConstNode(wasmType, value->i64Value);
+        }
+
+        if (chosen->wasmType == wasmType) {
+            return chosen;
+        }
+    }
+
+    if (lhs == rhs && lhs->wasmType == wasmType) {
+        return lhs;
+    }
+
+    ExprNode *candidate = newCandidate();
+    candidate->kind = ExprNode::Select;
+    candidate->wasmType = wasmType;
+    candidate->operandType = wasmType;
+    candidate->lhs = lhs;
+    candidate->rhs = rhs;
+    candidate->condition = condition;
+    return internNode(candidate);
+}
+
+/* precedence climbing.  Extends lhs with every following operator that binds at least as tightly as minPrecedence,
+stopping at the first token that isn't such an operator */
+ExprNode *parseOperators(ExprNode *lhs, u32 minPrecedence)
+{
+    while (readPos < endReadPos) {
+        Token *op = readPos;
+        u32 precedence = getOperatorPrecedence(op);
+
+        //the lexer joins a minus sign to the number that follows it, so "x -1" is a subtraction
+        bool isJoinedMinus = op->type == Token::Number && *getTokenText(op) == '-';
+        if (isJoinedMinus) {
+            precedence = getOperatorPrecedence('-');
+        }
+
+        //?: binds more loosely than any other operator, and its last operand takes another ?: to its right
+        if (op->hash == HASH("?") && minPrecedence <= 1) {
+            ++readPos;
+            ExprNode *trueValue = parseExpression(1);
+            if (readPos < endReadPos && readPos->hash == HASH(":")) {
+                ++readPos;
+            }
+            ExprNode *falseValue = parseExpression(1);
+
+            if (trueValue == nullptr || falseValue == nullptr) {
+                PRINT_ERROR("Expected two operands after ?\n");
+                break;
+            }
+
+            lhs = makeSelect(lhs, trueValue, falseValue, getCommonType(trueValue->wasmType, falseValue->wasmType));
+            continue;
+        }
+
+        if (precedence == 0 || precedence < minPrecedence) {
+            break;
+        }
+
+        ++readPos;
+
+        //every supported operator is left associative, so the right hand side only takes tighter operators
+        ExprNode *rhs;
+        if (isJoinedMinus) {
+            //the number token doubles as the operator token, since it begins with the minus sign
+            Token number = *op;
+            ++number.offset;
+            --number.length;
+            rhs = parseOperators(parseNumber(&number), precedence + 1);
+        } else {
+            ExprNode *operand = parseOperand();
+            if (operand == nullptr) {
+                break;
+            }
+            rhs = parseOperators(operand, precedence + 1);
+        }
+
+        lhs = makeBinaryOp(lhs, op, rhs);
+    }
+
+    return lhs;
+}
+
+ExprNode *parseExpression(u32 minPrecedence)
+{
+    ExprNode *lhs = parseOperand();
+    if (lhs == nullptr) {
+        return nullptr;
+    }
+
+    return parseOperators(lhs, minPrecedence);
+}
+
+void resetIR(u32 tokenCount);
+
+/* The initializer of a global variable has to fold to a constant, since no code runs before main.  The IR is empty
+until the first function body is lowered, so the initializer is parsed like any other expression.  Leaves readPos
+at the ; and returns the bits of the constant converted to the type of the global */
+u64 parseGlobalInitializer(Token *identifier, u8 wasmType)
+{
+    Token *end = readPos;
+    while (end < endReadPos && end->hash != HASH(";")) {
+        ++end;
+    }
+
+    resetIR(end - readPos);
+    ExprNode *value = readPos < end ? parseExpression(1) : nullptr;
+    bool isConstant = value != nullptr && value->kind == ExprNode::Const && readPos == end;
+    readPos = end;
+
+    if (!isConstant) {
+        PRINT_ERROR("Initializer of global variable ");
+        print(identifier);
+        PRINT_LIT(" is not a constant\n");
+        return 0;
+    }
+
+    ExprNode *constant = copyToScratch(value, 0);
+    convertConst(constant, wasmType);
+    return constant->i64Value;
+}
+
+//begin the body of an if statement or loop, which is a block nested in the current one
+IRInstr *beginBody(IRInstr::Kind kind, ExprNode *condition)
+{
+    IRInstr *instr = addInstr(kind, blockCount, condition);
+
+    IRBlock *block = &blocks[blockCount++];
+    block->parent = currentBlock;
+    block->depth = blocks[currentBlock].depth + 1;
+    block->ifInstr = instr - instrs;
+    block->endInstr = NONE;
+    block->enclosingLoop = kind == IRInstr::Loop ? instr->index : blocks[currentBlock].enclosingLoop;
+    block->undoStart = storeLogCount;
+    block->localVarCountBefore = localVarCount;
+    block->callVersionBefore = lastCallVersion;
+    block->staleGlobalsBefore = staleGlobals;
+    block->dirtyGlobalsBefore = dirtyGlobals;
+    block->globalsInLocals = 0;
+    block->increment = nullptr;
+    block->hasBreak = false;
+    block->isJumpTable = false;
+    memcpy(&promotedValueStack[block->depth * MAX_PROMOTED_GLOBALS], promotedValues, sizeof(ExprNode *) * promotedGlobalCount);
+
+    currentBlock = instr->index;
+    return instr;
+}
+
+//copy a promoted global into its local if the local doesn't already hold it
+void movePromotedGlobalToLocal(u32 promoted)
+{
+    u64 bit = (u64)1 << promoted;
+    if ((staleGlobals & bit) || promotedValues[promoted]) {
+        ExprNode *value = promotedValues[promoted] ? promotedValues[promoted] : loadGlobalVar(promotedGlobals[promoted]);
+        storeLocalVar(promotedGlobalsStart + promoted, value);
+        promotedValues[promoted] = nullptr;
+        staleGlobals &= ~bit;
+    }
+}
+
+//the current store to each variable stored since the given entry of the store log can be read later
+void markLastStoresRead(u32 undoStart)
+{
+    for (u32 i = undoStart; i < storeLogCount; ++i) {
+        StoreLogEntry entry = storeLog[i];
+        IRInstr *store = entry.isGlobal ? lastGlobalStores[entry.varIndex] : lastLocalStores[entry.varIndex];
+        if (store) {
+            store->isRead = true;
+            store->isLive |= !entry.isGlobal;
+        }
+    }
+}
+
+/* after an if or loop body, every variable stored in the body may hold either the value from before the body or from
+the body.  endKind is the instruction that ends the body, and condition is its value */
+void endBody(IRInstr::Kind endKind, ExprNode *condition)
+{
+    /* a promoted global has to be in the same place after the if whether or not the body ran.  The body is the only
+    path that can still be changed, so it writes back or stores to the local to match the path that skips it */
+    IRBlock *block = &blocks[currentBlock];
+    ExprNode **valuesBefore = &promotedValueStack[block->depth * MAX_PROMOTED_GLOBALS];
+    for (u32 i = 0; i < promotedGlobalCount; ++i) {
+        u64 bit = (u64)1 << i;
+        bool wasInLocal = !(block->staleGlobalsBefore & bit) && !valuesBefore[i];
+        bool isInLocal = !(staleGlobals & bit) && !promotedValues[i];
+
+        if (wasInLocal && isInLocal) {
+            continue;
+        }
+
+        //only the local is up to date when the body is skipped
+        if (wasInLocal && (block->dirtyGlobalsBefore & bit)) {
+            movePromotedGlobalToLocal(i);
+            continue;
+        }
+
+        //otherwise the wasm global is up to date when the body is skipped
+        if (isInLocal && (dirtyGlobals & bit)) {
+            writeBackPromotedGlobals(bit);
+        }
+
+        //the same load can still be reused if it was made before the if, and the body didn't change the global
+        if (!promotedValues[i] || promotedValues[i] != valuesBefore[i]) {
+            promotedValues[i] = nullptr;
+            staleGlobals |= bit;
+        }
+    }
+    dirtyGlobals |= block->dirtyGlobalsBefore;
+
+    block->endInstr = instrCount;
+    addInstr(endKind, 0, condition);
+
+    //like a store, a call in the body may or may not have happened
+    if (lastCallVersion != block->callVersionBefore) {
+        lastCallVersion = ++versionCounter;
+    }
+
+    u32 undoStart = blocks[currentBlock].undoStart;
+
+    //the last store to each variable in the body can be read after the if
+    markLastStoresRead(undoStart);
+
+    for (u32 i = storeLogCount; i-- > undoStart;) {
+        StoreLogEntry entry = storeLog[i];
+        if (entry.isGlobal) {
+            lastGlobalStores[entry.varIndex] = entry.previousStore;
+        } else {
+            lastLocalStores[entry.varIndex] = entry.previousStore;
+        }
+    }
+
+    //as can the store from before the if, when the body doesn't run
+    u32 versionBefore = versionCounter;
+    u32 keptCount = undoStart;
+    for (u32 i = undoStart; i < storeLogCount; ++i) {
+        StoreLogEntry entry = storeLog[i];
+        if (entry.previousStore) {
+            entry.previousStore->isRead = true;
+            entry.previousStore->isLive |= !entry.isGlobal;
+        }
+
+        //a variable already given a new version here was stored earlier in the body, and one new version is enough
+        u32 *version = entry.isGlobal ? &globalVersions[entry.varIndex] : &localVersions[entry.varIndex];
+        if (*version > versionBefore) {
+            continue;
+        }
+
+        *version = ++versionCounter;
+        if (entry.isGlobal) {
+            globalValues[entry.varIndex] = nullptr;
+        }
+
+        /* the log is kept so that an enclosing if body also sees these stores.  The first store to each variable is
+        the one whose previous store is from before the body, and the variables declared in the body are out of scope,
+        so the log only grows with the variables an enclosing body can see rather than with every store nested in it */
+        if (entry.isGlobal || entry.varIndex < block->localVarCountBefore || entry.varIndex >= promotedGlobalsStart) {
+            storeLog[keptCount++] = entry;
+        }
+    }
+    storeLogCount = keptCount;
+
+    currentBlock = blocks[currentBlock].parent;
+}
+
+//the wasm global holds the value of every promoted global, which has to be loaded again when it is read
+void markPromotedGlobalsStale()
+{
+    staleGlobals = promotedGlobalCount == 64 ? ~(u64)0 : ((u64)1 << promotedGlobalCount) - 1;
+    for (u32 i = 0; i < promotedGlobalCount; ++i) {
+        promotedValues[i] = nullptr;
+    }
+}
+
+bool scanBranchingBody(Token *token, Token *end, bool isInlined, u64 *usedGlobals, u64 *storedGlobals);
+
+//scan one token of a branching body, which ends at end
+bool scanBranchingToken(Token *token, Token *end, bool isInlined, u64 *usedGlobals, u64 *storedGlobals)
+{
+    if (token->type != Token::Identifier) {
+        return false;
+    }
+
+    InlineCandidate *callee = getInlinedCallee(token, end);
+    if (callee) {
+        return scanBranchingBody(callee->body, callee->bodyEnd, true, usedGlobals, storedGlobals);
+    }
+
+    //math functions are instructions rather than calls, and the generated functions never touch globals
+    u32 funcIndex = getFuncIndex(token->hash);
+    if (funcIndex != NONE) {
+        return funcIndex < funcCount && getIntrinsic(token->hash) == nullptr;
+    }
+
+    //names declared in the loop that shadow a global are counted too, which at worst keeps a global in a local for nothing
+    u32 globalVarIndex = isInlined || getLocalVarIndex(token->hash) == NONE ? getGlobalVarIndex(token->hash) : NONE;
+    if (globalVarIndex != NONE && globalLocals[globalVarIndex] != NONE) {
+        u64 bit = (u64)1 << (globalLocals[globalVarIndex] - promotedGlobalsStart);
+        *usedGlobals |= bit;
+        if (token + 1 < end && token[1].hash == HASH("=")) {
+            *storedGlobals |= bit;
+        }
+    }
+
+    return false;
+}
+
+/* Find whether the tokens from token to end call a function, and which promoted globals they read and store.  The
+bodies of inlined calls are scanned too, where the caller's variables don't hide globals */
+bool scanBranchingBody(Token *token, Token *end, bool isInlined, u64 *usedGlobals, u64 *storedGlobals)
+{
+    bool hasCall = false;
+
+    //every use of a name gives the same answer, so each is scanned once.  The token after the last token isn't part
+    //of the body, so the last token is scanned on its own
+    u32 useCount = findNameUses(token, end - 1);
+    if (useCount != NONE) {
+        for (u32 i = 0; i < useCount; ++i) {
+            Token *use = foundNameUses[i];
+            hasCall |= scanBranchingToken(use, use + 2, isInlined, usedGlobals, storedGlobals);
+        }
+        token = end - 1;
+    }
+
+    for (; token < end; ++token) {
+        hasCall |= scanBranchingToken(token, end, isInlined, usedGlobals, storedGlobals);
+    }
+
+    return hasCall;
+}
+
+/* Begin the body of a loop or switch whose tokens run from readPos to end.  Control reaches the start of each
+iteration of a loop, each case of a switch, and the end of either after a break from more than one place, and
+promoted globals have to be in the same place on every path: bodies that call functions keep them in their wasm
+globals like calls do, and other bodies keep the ones they use in locals */
+IRInstr *beginBranchingBody(IRInstr::Kind kind, Token *end)
+{
+    u64 usedGlobals = 0;
+    u64 storedGlobals = 0;
+    bool hasCall = scanBranchingBody(readPos, end, false, &usedGlobals, &storedGlobals);
+
+    if (hasCall) {
+        writeBackPromotedGlobals(dirtyGlobals);
+        markPromotedGlobalsStale();
+    } else {
+        for (u32 i = 0; i < promotedGlobalCount; ++i) {
+            if (usedGlobals & ((u64)1 << i)) {
+                movePromotedGlobalToLocal(i);
+            }
+        }
+
+        //a global stored in a loop is only dirty after the first iteration, but every iteration is lowered once
+        dirtyGlobals |= storedGlobals;
+    }
+
+    IRInstr *instr = beginBody(kind, nullptr);
+    blocks[currentBlock].globalsInLocals = hasCall ? 0 : usedGlobals;
+
+    //a call anywhere in the body may have happened wherever paths meet, which restorePromotedGlobals checks for
+    if (hasCall) {
+        lastCallVersion = ++versionCounter;
+    }
+
+    return instr;
+}
+
+void renewStoredVersions(Token *token, Token *end, bool isInlined);
+
+//give the variable stored to by the token a new version, if the token is followed by =
+void renewStoredVersion(Token *token, Token *end, bool isInlined)
+{
+    InlineCandidate *callee = getInlinedCallee(token, end);
+    if (callee) {
+        renewStoredVersions(callee->body, callee->bodyEnd, true);
+        return;
+    }
+
+    if (token->type != Token::Identifier || token[1].hash != HASH("=")) {
+        return;
+    }
+
+    u32 varIndex = isInlined ? NONE : getLocalVarIndex(token->hash);
+    if (varIndex != NONE) {
+        localVersions[varIndex] = ++versionCounter;
+        return;
+    }
+
+    u32 globalVarIndex = getGlobalVarIndex(token->hash);
+    if (globalVarIndex != NONE) {
+        //forget a store made by an earlier function, which getLastGlobalStore would stop ignoring
+        lastGlobalStores[globalVarIndex] = getLastGlobalStore(globalVarIndex);
+        globalVersions[globalVarIndex] = ++versionCounter;
+        globalValues[globalVarIndex] = nullptr;
+
+        if (globalLocals[globalVarIndex] != NONE) {
+            localVersions[globalLocals[globalVarIndex]] = ++versionCounter;
+        }
+    }
+}
+
+/* Give each variable stored to by the tokens from token to end a new version.  Variables of inlined bodies are
+declared again each time the body is lowered, so only the globals those bodies store to are looked for */
+void renewStoredVersions(Token *token, Token *end, bool isInlined)
+{
+    //a variable stored to more than once only needs one new version, so each use of a name is looked at once
+    u32 useCount = findNameUses(token, end - 1);
+    if (useCount != NONE) {
+        for (u32 i = 0; i < useCount; ++i) {
+            renewStoredVersion(foundNameUses[i], foundNameUses[i] + 2, isInlined);
+        }
+        return;
+    }
+
+    for (; token + 1 < end; ++token) {
+        renewStoredVersion(token, end, isInlined);
+    }
+}
+
+/* Begin the body of a loop whose header, body and condition end at end, with readPos just past the loop's keyword.
+Every variable stored in the loop may hold a value from the previous iteration when an iteration begins, so each gets
+a new version */
+IRInstr *beginLoopBody(Token *end)
+{
+    IRInstr *loop = beginBranchingBody(IRInstr::Loop, end);
+    renewStoredVersions(readPos, end, false);
+    return loop;
+}
+
+/* put the promoted globals back where they were at the start of the loop or switch beginning the given block, before
+the loop repeats, a case ends, or a break leaves */
+void restorePromotedGlobals(u32 blockIndex)
+{
+    IRBlock *block = &blocks[blockIndex];
+    if (lastCallVersion != block->callVersionBefore) {
+        writeBackPromotedGlobals(dirtyGlobals);
+        markPromotedGlobalsStale();
+        return;
+    }
+
+    for (u32 i = 0; i < promotedGlobalCount; ++i) {
+        if (block->globalsInLocals & ((u64)1 << i)) {
+            movePromotedGlobalToLocal(i);
+        }
+    }
+}
+
+void addCall(u32 funcIndex)
+{
+    //the arguments are already pushed, but writing back a global leaves the stack as it was
+    if (funcIndex < funcCount) {
+        writeBackPromotedGlobals(dirtyGlobals);
+    }
+
+    IRInstr *call = addInstr(IRInstr::Call, funcIndex, nullptr);
+
+    //the results of calls made as statements are unused
+    if (types[funcSigs[funcIndex]] >> 61 != 4) {
+        call->convertOp = wasm::drop;
+    }
+
+    //the callee may read or write any global variable, but the generated draw list functions never do
+    if (funcIndex < funcCount) {
+        lastCallVersion = ++versionCounter;
+        markPromotedGlobalsStale();
+    }
+}
+
+//the type of a function's parameter, from its encoded signature
+u8 getParamType(u32 funcIndex, u32 paramIndex)
+{
+    u64 encodedType = types[funcSigs[funcIndex]];
+    u32 paramCount = (encodedType >> 56) & 0b11111;
+    if (paramIndex >= paramCount) {
+        return 0;
+    }
+    return wasm::type::f64 | ((encodedType >> 2 * (paramCount - 1 - paramIndex)) & 0b11);
+}
+
+void addPrintCall(u32 stdoutFunc)
+{
+    //the functions that print only touch the stdout ring, so they don't invalidate any global variable
+    addInstr(IRInstr::Call, stdoutFuncs + stdoutFunc, nullptr);
+}
+
+//lower a std::cout statement.  readPos must be just past std::cout
+void buildPrintStatement()
+{
+    if (!hasStdout) {
+        PRINT_ERROR("Failed to find function 'flushStdout'\n");
+    }
+
+    do {
+        Token *token = readPos;
+
+        if (token->hash == HASH("<<")) {
+            //found << operator, move to next token
+            ++readPos;
+        } else if (token->hash == HASH(";")) {
+            //found end of statement
+            break;
+        } else if (token->type == Token::StringLit) {
+            //the literal already lives in the Data section, so copy it into the ring with a single call
+            u32 literal = lookupSymbol(&stringLiterals, token->hash);
+            u32 length = stringLiteralLengths[literal];
+
+            if (hasStdout && length > 0) {
+                addInstr(IRInstr::Arg, 0, getConstNode(wasm::type::i32, stringDataAddress + stringLiteralOffsets[literal]));
+                addInstr(IRInstr::Arg, 0, getConstNode(wasm::type::i32, length));
+                addPrintCall(StdoutFunc::PutString);
+            }
+
+            ++readPos;
+        } else if (token->type == Token::CharLit) {
+            if (hasStdout) {
+                addInstr(IRInstr::Arg, 0, getConstNode(wasm::type::i32, decodeCharLiteral(token)));
+                addPrintCall(StdoutFunc::PutChar);
+            }
+
+            ++readPos;
+        } else {
+            //parseExpression leaves readPos on the following << or ;
+            ExprNode *value = parseExpression(1);
+            if (value == nullptr) {
+                readPos += readPos == token;
+                continue;
+            }
+
+            u32 printFunc = NONE;
+            u8 convertOp = 0;
+            switch(value->wasmType) {
+                case wasm::type::i32:
+                    printFunc = StdoutFunc::PutI32;
+                    break;
+                case wasm::type::i64:
+                    printFunc = StdoutFunc::PutI64;
+                    break;
+                case wasm::type::f32:
+                    //f32 values are printed with the same formatting as f64
+                    convertOp = wasm::f64_promote_from_f32;
+                    printFunc = StdoutFunc::PutF64;
+                    break;
+                case wasm::type::f64:
+                    printFunc = StdoutFunc::PutF64;
+                    break;
+            }
+
+            if (!hasStdout || printFunc == NONE) {
+                PRINT_ERROR("Failed to find print function for type ");
+                puti32(value->wasmType);
+                put('\n');
+            } else {
+                addInstr(IRInstr::Arg, 0, value)->convertOp = convertOp;
+                addPrintCall(printFunc);
+            }
+        }
+    } while (readPos < endReadPos);
+}
+
+void countUse(ExprNode *node)
+{
+    //the operands of a value are only consumed the first time it is computed
+    if (node->useCount++ == 0 && (node->kind == ExprNode::BinaryOp || node->kind == ExprNode::Select)) {
+        countUse(node->lhs);
+        countUse(node->rhs);
+        if (node->condition) {
+            countUse(node->condition);
+        }
+    }
+
+    //abs, min and max are lowered with select, which reads abs's operand three times and the others twice
+    if (node->useCount == 1 && node->kind == ExprNode::Intrinsic) {
+        u32 reads = isSelectIntrinsic(node) ? 3 - (node->rhs != nullptr) : 1;
+        for (u32 i = 0; i < reads; ++i) {
+            countUse(node->lhs);
+            if (node->rhs) {
+                countUse(node->rhs);
+            }
+        }
+    }
+}
+
+//empty the IR before lowering the given number of tokens
+void resetIR(u32 tokenCount)
+{
+    exprNodeCount = 0;
+    instrCount = 0;
+    storeLogCount = 0;
+    switchCaseCount = 0;
+
+    //only the part of the table these tokens can fill is cleared
+    valueNumbers.capacity = nextPowerOf2(getMaxIRSize(tokenCount) * 2 + 2);
+    if (valueNumbers.capacity > maxValueNumbersCapacity) {
+        valueNumbers.capacity = maxValueNumbersCapacity;
+    }
+    clearSymbolTable(&valueNumbers);
+
+    blockCount = 1;
+    currentBlock = 0;
+    blocks[0] = {};
+}
+
+//the token closing the parenthesis or brace at open, or end if it isn't closed
+Token *findClosingToken(Token *open, Token *end)
+{
+    if (open >= indexedBodyStart && open < indexedBodyEnd && closingOffsets[open - indexedBodyStart] != NONE) {
+        Token *closing = indexedBodyStart + closingOffsets[open - indexedBodyStart];
+        return closing < end ? closing : end;
+    }
+
+    u64 closeHash = open->hash == HASH("(") ? HASH(")") : HASH("}");
+    u32 depth = 0;
+
+    for (Token *token = open; token < end; ++token) {
+        if (token->hash == open->hash) {
+            ++depth;
+        } else if (token->hash == closeHash && --depth == 0) {
+            return token;
+        }
+    }
+
+    return end;
+}
+
+//the key of a use of a name in nameUseIndexes
+u64 getNameUseKey(Token *token, Token *end)
+{
+    u32 kind = token + 1 >= end ? 0 : token[1].hash == HASH("=") ? 1 : token[1].hash == HASH("(") ? 2 : 0;
+    return token->hash * 3 + kind;
+}
+
+//index the names and the braces and parentheses of the function body from body to end
+void indexBody(Token *body, Token *end)
+{
+    u32 length = end - body;
+    indexedBodyStart = body;
+    indexedBodyEnd = end;
+
+    //only the part of the table this body can fill is cleared
+    nameUseIndexes.capacity = nextPowerOf2(length * 2 + 2);
+    if (nameUseIndexes.capacity > maxNameUseIndexesCapacity) {
+        nameUseIndexes.capacity = maxNameUseIndexesCapacity;
+    }
+    clearSymbolTable(&nameUseIndexes);
+    nameUseCount = 0;
+
+    //the open braces and parentheses waiting for their close are kept on two stacks at either end of nameUsePositions,
+    //which is only filled once they are done with
+    u32 braceCount = 0;
+    u32 parenCount = 0;
+    u32 *braces = nameUsePositions;
+    u32 *parens = nameUsePositions + length - 1;
+
+    for (u32 i = 0; i < length; ++i) {
+        Token *token = body + i;
+        closingOffsets[i] = NONE;
+
+        if (token->hash == HASH("{")) {
+            braces[braceCount++] = i;
+        } else if (token->hash == HASH("(")) {
+            parens[-(i32)parenCount++] = i;
+        } else if (token->hash == HASH("}") && braceCount > 0) {
+            closingOffsets[braces[--braceCount]] = i;
+        } else if (token->hash == HASH(")") && parenCount > 0) {
+            closingOffsets[parens[-(i32)--parenCount]] = i;
+        } else if (token->type == Token::Identifier) {
+            u64 key = getNameUseKey(token, end);
+            u32 use = lookupSymbol(&nameUseIndexes, key);
+            if (use == NONE) {
+                use = nameUseCount++;
+                nameUseStarts[use] = 0;
+                defineSymbol(&nameUseIndexes, key, use);
+            }
+            ++nameUseStarts[use];
+            tokenNameUses[i] = use;
+        }
+    }
+
+    //turn the number of occurrences of each use into where its positions begin, then list the positions in order
+    u32 start = 0;
+    for (u32 use = 0; use < nameUseCount; ++use) {
+        u32 count = nameUseStarts[use];
+        nameUseStarts[use] = start;
+        start += count;
+    }
+    nameUseStarts[nameUseCount] = start;
+
+    for (u32 i = 0; i < length; ++i) {
+        if (body[i].type == Token::Identifier) {
+            nameUsePositions[nameUseStarts[tokenNameUses[i]]++] = i;
+        }
+    }
+
+    //filling in the positions moved each start to the start of the next use
+    for (u32 use = nameUseCount; use > 0; --use) {
+        nameUseStarts[use] = nameUseStarts[use - 1];
+    }
+    nameUseStarts[0] = 0;
+
+    //the uses of names declared outside the body can mean something anywhere in it
+    u32 orderCount = 0;
+    for (u32 use = 0; use < nameUseCount; ++use) {
+        u64 hash = body[nameUsePositions[nameUseStarts[use]]].hash;
+        if (lookupSymbol(&localVars, hash) != NONE || lookupSymbol(&globalVars, hash) != NONE ||
+            lookupSymbol(&funcs, hash) != NONE || lookupSymbol(&inlineCandidateNames, hash) != NONE)
+        {
+            nameUseVisibleFrom[use] = 0;
+            nameUseOrder[orderCount++] = use;
+        } else {
+            nameUseVisibleFrom[use] = NONE;
+        }
+    }
+
+    //and every use of any other name can mean something after the name first occurs
+    for (u32 i = 0; i < length; ++i) {
+        if (body[i].type != Token::Identifier || nameUseVisibleFrom[tokenNameUses[i]] != NONE) {
+            continue;
+        }
+
+        for (u32 kind = 0; kind < 3; ++kind) {
+            u32 use = lookupSymbol(&nameUseIndexes, body[i].hash * 3 + kind);
+            if (use != NONE && nameUseVisibleFrom[use] == NONE) {
+                nameUseVisibleFrom[use] = i + 1;
+                nameUseOrder[orderCount++] = use;
+            }
+        }
+    }
+
+    visibleNameUseCount = 0;
+    nextVisibleNameUse = 0;
+    lastNameUseStart = 0;
+}
+
+/* Find one token of each distinct use of a name among the tokens from start to end that can mean something there,
+which is put in foundNameUses.  Returns the number of uses found, or NONE when the range is outside the indexed body or
+too short for looking up every use that can mean something to be faster than reading its tokens */
+u32 findNameUses(Token *start, Token *end)
+{
+    if (start < indexedBodyStart || end > indexedBodyEnd || start >= end) {
+        return NONE;
+    }
+
+    u32 first = start - indexedBodyStart;
+    u32 last = end - indexedBodyStart;
+
+    //a range before the last one may see uses that were dropped, so they are gathered again from the beginning
+    if (first < lastNameUseStart) {
+        visibleNameUseCount = 0;
+        nextVisibleNameUse = 0;
+    }
+    lastNameUseStart = first;
+
+    while (nextVisibleNameUse < nameUseCount && nameUseVisibleFrom[nameUseOrder[nextVisibleNameUse]] <= first) {
+        visibleNameUses[visibleNameUseCount++] = nameUseOrder[nextVisibleNameUse++];
+    }
+
+    //a use that doesn't occur at or after start won't occur in any later range either
+    u32 keptCount = 0;
+    for (u32 i = 0; i < visibleNameUseCount; ++i) {
+        u32 use = visibleNameUses[i];
+        if (nameUsePositions[nameUseStarts[use + 1] - 1] >= first) {
+            visibleNameUses[keptCount++] = use;
+        }
+    }
+    visibleNameUseCount = keptCount;
+
+    if (last - first < 8 * visibleNameUseCount) {
+        return NONE;
+    }
+
+    u32 foundCount = 0;
+    for (u32 i = 0; i < visibleNameUseCount; ++i) {
+        u32 use = visibleNameUses[i];
+
+        //the first occurrence of the use at or after start
+        u32 low = nameUseStarts[use];
+        u32 high = nameUseStarts[use + 1];
+        while (low < high) {
+            u32 middle = (low + high) / 2;
+            if (nameUsePositions[middle] < first) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+
+        if (low < nameUseStarts[use + 1] && nameUsePositions[low] < last) {
+            foundNameUses[foundCount++] = indexedBodyStart + nameUsePositions[low];
+        }
+    }
+
+    return foundCount;
+}
+
+//the open brace of the body of the while, for or do loop beginning with keyword, or nullptr if the body isn't in braces
+Token *findLoopBody(Token *keyword, Token *end)
+{
+    Token *body = keyword + 1;
+    if (keyword->hash != HASH("do")) {
+        if (body >= end || body->hash != HASH("(")) {
+            return nullptr;
+        }
+        body = findClosingToken(body, end) + 1;
+    }
+
+    return body < end && body->hash == HASH("{") ? body : nullptr;
+}
+
+void beginScope(u32 scopeDepth, u8 kind)
+{
+    shadowedLocalVarCountAtScopeStart[scopeDepth] = shadowedLocalVarCount;
+    scopeKinds[scopeDepth] = kind;
+}
+
+void endScope(u32 scopeDepth)
+{
+    popLocalVarScope(shadowedLocalVarCountAtScopeStart[scopeDepth]);
+}
+
+//a new variable in the innermost scope
+u32 declareVariable(u64 hash, u8 wasmType)
+{
+    u32 varIndex = localVarCount++;
+    varTypes[varIndex] = wasmType;
+    declareLocalVar(hash, varIndex);
+
+    //live from its declaration, so a loop inside its scope keeps the values stored by earlier iterations
+    liveRangeStarts[varIndex] = 2 * instrCount;
+    liveRangeEnds[varIndex] = 2 * instrCount;
+
+    return varIndex;
+}
+
+void buildStatements(i32 scopeDepth, i32 outerDepth);
+
+/* Lower a call to an inlined function in place, with readPos on the open parenthesis of the arguments and the call
+in the scope at scopeDepth.  The body sees its parameters and the global variables, but none of the caller's
+variables.  Leaves readPos on the close parenthesis */
+void buildInlinedCall(InlineCandidate *callee, u32 scopeDepth)
+{
+    //the arguments are evaluated in the caller's scope.  A signature has at most 28 parameters
+    ExprNode *args[32];
+    u32 argCount = 0;
+    ++readPos;
+    while (readPos < endReadPos && readPos->hash != HASH(")") && readPos->hash != HASH(";")) {
+        Token *argStart = readPos;
+        ExprNode *value = parseExpression(1);
+
+        if (value && argCount < 32) {
+            args[argCount++] = value;
+        }
+
+        readPos += readPos == argStart || readPos->hash == HASH(",");
+    }
+    Token *callEnd = readPos;
+
+    u32 callerFirstVisibleLocal = firstVisibleLocal;
+    firstVisibleLocal = localVarCount;
+    beginScope(scopeDepth + 1, ScopeKind::Plain);
+
+    u32 paramIndex = 0;
+    for (Token *token = callee->params + 1; token + 1 < callee->body; ++token) {
+        u8 wasmType = token->type == Token::Identifier ? getWasmTypeFromCppName(token->hash) : 0;
+        if (!wasmType) {
+            continue;
+        }
+
+        u32 varIndex = declareVariable((++token)->hash, wasmType);
+        if (paramIndex < argCount) {
+            storeLocalVar(varIndex, args[paramIndex]);
+        } else {
+            localVersions[varIndex] = ++versionCounter;
+            lastLocalStores[varIndex] = nullptr;
+        }
+        ++paramIndex;
+    }
+
+    readPos = callee->body + 1;
+    buildStatements(scopeDepth + 1, scopeDepth);
+
+    firstVisibleLocal = callerFirstVisibleLocal;
+    readPos = callEnd;
+}
+
+/* Lower a declaration, assignment, call or std::cout statement beginning with token, with readPos just past token.
+Variables are declared in the scope at scopeDepth.  Leaves readPos on the token that ends the statement */
+void buildStatement(Token *token, u32 scopeDepth)
+{
+    u64 hash = token->hash;
+    u32 wasmType = getWasmTypeFromCppName(hash);
+    if (wasmType) {
+        //if the identifier on the beginning of the line is a type name, then declare
+        //a variable of that type with the following identifier as its name/hash
+        token = readPos++;
+        hash = token->hash;
+
+        u32 varIndex = declareVariable(hash, wasmType);
+
+        if (readPos->hash == HASH("=")) {
+            ++readPos;
+            ExprNode *value = parseExpression(1);
+            if (value) {
+                storeLocalVar(varIndex, value);
+            }
+        } else {
+            //an uninitialized variable may share its local with variables that are no longer live, so its value is unknown
+            localVersions[varIndex] = ++versionCounter;
+            lastLocalStores[varIndex] = nullptr;
+        }
+    }
+    else if (hash == HASH("std::cout")) {
+        buildPrintStatement();
+    } else {
+        InlineCandidate *callee = getInlinedCallee(token, endReadPos);
+        u32 funcIndex = getFuncIndex(hash);
+
+        if (callee) {
+            buildInlinedCall(callee, scopeDepth);
+        } else if (funcIndex != NONE) {
+            //skip past '(' then push each argument, converted to the type of its parameter
+            ++readPos;
+            u32 argCount = 0;
+            while (readPos < endReadPos && readPos->hash != HASH(")") && readPos->hash != HASH(";")) {
+                Token *argStart = readPos;
+                ExprNode *value = parseExpression(1);
+
+                if (value) {
+                    addInstr(IRInstr::Arg, 0, value)->wasmType = getParamType(funcIndex, argCount++);
+                }
+
+                //arguments are separated by commas, and anything that isn't an expression is skipped
+                readPos += readPos == argStart || readPos->hash == HASH(",");
+            }
+
+            addCall(funcIndex);
+        } else {
+            u32 varIndex = getLocalVarIndex(hash);
+            u32 globalVarIndex = varIndex == NONE ? getGlobalVarIndex(hash) : NONE;
+
+            if (varIndex != NONE || globalVarIndex != NONE) {
+                //skip past '='
+                ++readPos;
+                ExprNode *value = parseExpression(1);
+
+                if (value && varIndex != NONE) {
+                    storeLocalVar(varIndex, value);
+                } else if (value) {
+                    storeGlobalVar(globalVarIndex, value);
+                }
+            } else {
+                PRINT_ERROR("Failed to find a variable or function named ");
+                print(token);
+                put('\n');
+            }
+        }
+    }
+}
+
+/* Lower the header of a while, for or do loop beginning with keyword, leaving readPos on the open brace of the body.
+A for loop's initializer is lowered before the loop, in a scope of its own that ends with the body, and its
+increment is lowered when the body ends.  Returns the kind of scope the body is */
+u8 buildLoopHeader(Token *keyword, Token *body, i32 *scopeDepth)
+{
+    //the loop's variables are stored in its header, body, and the condition of a do while loop
+    Token *end = findClosingToken(body, endReadPos);
+    if (keyword->hash == HASH("do")) {
+        while (end < endReadPos && end->hash != HASH(";")) {
+            ++end;
+        }
+    }
+
+    if (keyword->hash == HASH("for")) {
+        beginScope(++*scopeDepth, ScopeKind::ForInit);
+
+        //skip past '('
+        ++readPos;
+        if (readPos->type == Token::Identifier) {
+            Token *token = readPos++;
+            buildStatement(token, *scopeDepth);
+        }
+
+        while (readPos < body && readPos->hash != HASH(";")) {
+            ++readPos;
+        }
+        ++readPos;
+    }
+
+    IRInstr *loop = beginLoopBody(end);
+
+    if (keyword->hash != HASH("do")) {
+        //skip past the '(' of a while loop
+        readPos += keyword->hash == HASH("while");
+
+        ExprNode *condition = nullptr;
+        if (readPos->hash != HASH(";") && readPos->hash != HASH(")")) {
+            condition = parseExpression(1);
+        }
+
+        //a loop that is always true never exits at the top, like a for loop without a condition
+        bool isAlwaysTrue = condition && condition->kind == ExprNode::Const && isNonzeroConst(condition);
+        loop->value = isAlwaysTrue ? nullptr : condition;
+    }
+
+    if (keyword->hash == HASH("for")) {
+        while (readPos < body && readPos->hash != HASH(";")) {
+            ++readPos;
+        }
+
+        //the increment ends at the ) before the body
+        if (readPos + 1 < body - 1) {
+            blocks[currentBlock].increment = readPos + 1;
+        }
+    }
+
+    readPos = body;
+    return keyword->hash == HASH("do") ? ScopeKind::DoWhileBody : ScopeKind::LoopBody;
+}
+
+//end the loop whose body just ended, leaving readPos past the loop
+void buildLoopEnd(u8 scopeKind, u32 scopeDepth)
+{
+    Token *increment = blocks[currentBlock].increment;
+    if (increment && increment->type == Token::Identifier) {
+        Token *resumePos = readPos;
+        readPos = increment + 1;
+        buildStatement(increment, scopeDepth);
+        readPos = resumePos;
+    }
+
+    restorePromotedGlobals(currentBlock);
+
+    ExprNode *condition = nullptr;
+    if (scopeKind == ScopeKind::DoWhileBody) {
+        //skip past "while (" and leave the rest of the statement to be skipped
+        if (readPos + 1 < endReadPos && readPos->hash == HASH("while")) {
+            readPos += 2;
+            condition = parseExpression(1);
+        } else {
+            PRINT_ERROR("Expected while after the body of a do loop\n");
+        }
+
+        //a do loop without a condition runs once
+        if (condition == nullptr) {
+            condition = getConstNode(wasm::type::i32, 0);
+        }
+    }
+
+    endBody(IRInstr::EndLoop, condition);
+}
+
+//whether token begins a case or default label
+bool isCaseLabel(Token *token)
+{
+    return token->hash == HASH("case") || token->hash == HASH("default");
+}
+
+//consecutive labels begin the same case
+bool continuesCase(Token *label)
+{
+    return label[-1].hash == HASH(":");
+}
+
+/* Lower the header of a switch beginning with keyword and find the case labels in its body, which begins with the
+open brace body.  The statements from each run of labels to the next are a block of their own inside the switch's
+block, and the body is a scope.  Leaves readPos on the first label, since statements before it never run */
+void buildSwitchHeader(Token *keyword, Token *body, i32 *scopeDepth)
+{
+    //skip past '('
+    readPos = keyword + 2;
+    ExprNode *selector = parseExpression(1);
+    if (selector == nullptr) {
+        PRINT_ERROR("Expected a value to switch on\n");
+        selector = getConstNode(wasm::type::i32, 0);
+    }
+
+    Token *end = findClosingToken(body, endReadPos);
+    readPos = body;
+    IRInstr *instr = beginBranchingBody(IRInstr::Switch, end);
+    instr->value = selector;
+    instr->wasmType = selector->wasmType == wasm::type::i64 ? wasm::type::i64 : wasm::type::i32;
+
+    IRBlock *block = &blocks[currentBlock];
+    block->firstCase = switchCaseCount;
+    block->segmentCount = 0;
+    block->defaultSegment = NONE;
+
+    Token *firstLabel = end;
+    u32 depth = 0;
+    for (Token *token = body + 1; token < end; ++token) {
+        depth += token->hash == HASH("{");
+        depth -= token->hash == HASH("}");
+        if (depth > 0 || !isCaseLabel(token)) {
+            continue;
+        }
+
+        if (firstLabel == end) {
+            firstLabel = token;
+        }
+        block->segmentCount += !continuesCase(token);
+        u32 segment = block->segmentCount - 1;
+
+        if (token->hash != HASH("case")) {
+            block->defaultSegment = segment;
+            continue;
+        }
+
+        readPos = token + 1;
+        ExprNode *value = parseExpression(1);
+        if (value == nullptr || value->kind != ExprNode::Const) {
+            PRINT_ERROR("Expected a constant after case\n");
+            continue;
+        }
+
+        ExprNode *constant = copyToScratch(value, 0);
+        convertConst(constant, instr->wasmType);
+        i64 caseValue = instr->wasmType == wasm::type::i32 ? constant->i32Value : constant->i64Value;
+
+        //insertion sort, since labels are usually written in order
+        u32 i = switchCaseCount++;
+        while (i > block->firstCase && switchCases[i - 1].value > caseValue) {
+            switchCases[i] = switchCases[i - 1];
+            --i;
+        }
+        switchCases[i] = {caseValue, segment};
+    }
+
+    if (block->defaultSegment == NONE) {
+        block->defaultSegment = block->segmentCount;
+    }
+
+    //br_table has an entry for every value from the least case to the greatest, so it is used when at least a third are cases
+    block->caseCount = switchCaseCount - block->firstCase;
+    if (instr->wasmType == wasm::type::i32 && block->caseCount > 0) {
+        u64 range = switchCases[switchCaseCount - 1].value - switchCases[block->firstCase].value;
+        block->isJumpTable = range < 3 * (u64)block->caseCount;
+    }
+
+    beginScope(++*scopeDepth, ScopeKind::SwitchBody);
+    readPos = firstLabel;
+}
+
+//end the case that is the current block, putting promoted globals where the next case and the end of the switch expect them
+void endCase()
+{
+    restorePromotedGlobals(blocks[currentBlock].parent);
+    endBody(IRInstr::EndCase, nullptr);
+}
+
+//begin a case at a label directly inside the body of a switch, unless it continues one, and leave readPos past the label
+void buildCaseLabel(Token *label)
+{
+    if (!continuesCase(label)) {
+        //the case before falls through into this one
+        if (instrs[blocks[currentBlock].ifInstr].kind == IRInstr::Case) {
+            endCase();
+        }
+        beginBody(IRInstr::Case, nullptr);
+    }
+
+    readPos = label;
+    while (readPos < endReadPos && readPos->hash != HASH(":")) {
+        ++readPos;
+    }
+    ++readPos;
+}
+
+//end the switch whose body just ended
+void buildSwitchEnd()
+{
+    if (instrs[blocks[currentBlock].ifInstr].kind == IRInstr::Case) {
+        endCase();
+    }
+
+    //the switch writes a block for every case its header found, even one whose label was skipped with an unsupported statement
+    u32 caseCount = 0;
+    for (u32 i = currentBlock + 1; i < blockCount; ++i) {
+        caseCount += blocks[i].parent == currentBlock;
+    }
+    for (; caseCount < blocks[currentBlock].segmentCount; ++caseCount) {
+        beginBody(IRInstr::Case, nullptr);
+        endCase();
+    }
+
+    endBody(IRInstr::EndSwitch, nullptr);
+}
+
+//leave the innermost loop or switch
+void buildBreak()
+{
+    u32 target = currentBlock;
+    while (target != 0 && instrs[blocks[target].ifInstr].kind != IRInstr::Loop &&
+        instrs[blocks[target].ifInstr].kind != IRInstr::Switch)
+    {
+        target = blocks[target].parent;
+    }
+
+    if (target == 0) {
+        PRINT_ERROR("Expected break inside a loop or switch\n");
+        return;
+    }
+
+    restorePromotedGlobals(target);
+
+    //the value each variable has here is one that can be read after the loop or switch
+    markLastStoresRead(blocks[target].undoStart);
+
+    addInstr(IRInstr::Break, target, nullptr);
+    blocks[target].hasBreak = true;
+}
+
+//whether token is a number, character or variable, rather than a math function
+bool isSimpleOperand(Token *token)
+{
+    return token->type == Token::Number || token->type == Token::CharLit ||
+        (token->type == Token::Identifier && getIntrinsic(token->hash) == nullptr);
+}
+
+//the end of the assignment of a cheap value to a variable beginning at token, or nullptr if it isn't one
+Token *findCheapAssignmentEnd(Token *token)
+{
+    if (token + 3 >= endReadPos || token->type != Token::Identifier || token[1].hash != HASH("=") ||
+        (getLocalVarIndex(token->hash) == NONE && getGlobalVarIndex(token->hash) == NONE))
+    {
+        return nullptr;
+    }
+
+    //one operand, or two joined by an operator other than division, which could trap
+    Token *value = token + 2;
+    if (isSimpleOperand(value) && value[1].hash == HASH(";")) {
+        return value + 1;
+    }
+
+    if (value + 3 < endReadPos && isSimpleOperand(value) && getOperatorPrecedence(value + 1) > 0 &&
+        value[1].hash != HASH("/") && isSimpleOperand(value + 2) && value[3].hash == HASH(";"))
+    {
+        return value + 3;
+    }
+
+    return nullptr;
+}
+
+/* An if statement whose body only assigns cheap values to up to 3 variables, like a clamp, stores to each variable
+either its value from the body or its own value, chosen with select instead of branching.  Returns whether the if
+statement with readPos just past its condition was lowered this way, leaving readPos past its body if it was */
+bool buildConditionalAssignments(ExprNode *condition)
+{
+    Token *body = readPos + (readPos < endReadPos && readPos->hash == HASH(")"));
+    if (body >= endReadPos || body->hash != HASH("{")) {
+        return false;
+    }
+
+    Token *token = body + 1;
+    for (u32 i = 0; i < 3 && token < endReadPos && token->hash != HASH("}"); ++i) {
+        token = findCheapAssignmentEnd(token);
+        if (token == nullptr) {
+            return false;
+        }
+        ++token;
+    }
+
+    if (token >= endReadPos || token->hash != HASH("}")) {
+        return false;
+    }
+    Token *bodyEnd = token;
+
+    for (token = body + 1; token < bodyEnd; token = findCheapAssignmentEnd(token) + 1) {
+        u32 varIndex = getLocalVarIndex(token->hash);
+        u32 globalVarIndex = varIndex == NONE ? getGlobalVarIndex(token->hash) : NONE;
+
+        readPos = token + 2;
+        ExprNode *value = parseExpression(1);
+        if (value == nullptr) {
+            continue;
+        }
+
+        ExprNode *oldValue = varIndex != NONE ? readLocalVar(varIndex) : readGlobalVar(globalVarIndex);
+        u8 wasmType = varIndex != NONE ? varTypes[varIndex] : globalVarTypes[globalVarIndex];
+        ExprNode *result = makeSelect(condition, value, oldValue, wasmType);
+
+        if (result != oldValue && varIndex != NONE) {
+            storeLocalVar(varIndex, result);
+        } else if (result != oldValue) {
+            storeGlobalVar(globalVarIndex, result);
+        }
+    }
+
+    readPos = bodyEnd + 1;
+    return true;
+}
+
+/* Lower statements until the scope just inside outerDepth ends, with scopeDepth the scope readPos is in.  A function
+body is lowered from its open brace with both at -1, and an inlined body from just inside its braces */
+void buildStatements(i32 scopeDepth, i32 outerDepth)
+{
+    u8 nextScopeKind = ScopeKind::Plain;
+
+    //don't read past the end of the input string in the event of malformed C++
+    while (readPos < endReadPos) {
+        Token *token = readPos++;
+
+        if (token->hash == HASH("{")) {
+            beginScope(++scopeDepth, nextScopeKind);
+            nextScopeKind = ScopeKind::Plain;
+        }
+        else if (token->hash == HASH("}")) {
+            endScope(scopeDepth);
+            u8 scopeKind = scopeKinds[scopeDepth--];
+
+            if (scopeKind == ScopeKind::IfBody) {
+                endBody(IRInstr::End, nullptr);
+            } else if (scopeKind == ScopeKind::LoopBody || scopeKind == ScopeKind::DoWhileBody) {
+                buildLoopEnd(scopeKind, scopeDepth);
+            } else if (scopeKind == ScopeKind::SwitchBody) {
+                buildSwitchEnd();
+            }
+
+            //the scope of a for loop's initializer ends with the loop
+            if (scopeDepth > outerDepth && scopeKinds[scopeDepth] == ScopeKind::ForInit) {
+                endScope(scopeDepth--);
+            }
+
+            if (scopeDepth <= outerDepth) {
+                break;
+            }
+        }
+        else if (token->type == Token::Identifier && isCaseLabel(token)) {
+            if (scopeDepth >= 0 && scopeKinds[scopeDepth] == ScopeKind::SwitchBody) {
+                buildCaseLabel(token);
+            } else {
+                PRINT_ERROR("Expected case labels directly inside the braces of a switch\n");
+            }
+        }
+        else if (token->hash == HASH("switch")) {
+            //findLoopBody finds the braces after the parenthesis of a switch just as of a while loop
+            Token *body = findLoopBody(token, endReadPos);
+            if (body) {
+                buildSwitchHeader(token, body, &scopeDepth);
+            } else {
+                PRINT_ERROR("Expected the body of a switch in braces\n");
+            }
+        }
+        else if (token->type == Token::Identifier) {
+            u64 hash = token->hash;
+            if (hash == HASH("if")) {
+                //set read position to one token past the open parenthesis
+                ++readPos;
+                ExprNode *condition = parseExpression(1);
+
+                if (condition && buildConditionalAssignments(condition)) {
+                    continue;
+                }
+
+                if (condition) {
+                    beginBody(IRInstr::If, condition);
+                    nextScopeKind = ScopeKind::IfBody;
+                }
+            } else if (hash == HASH("while") || hash == HASH("for") || hash == HASH("do")) {
+                Token *body = findLoopBody(token, endReadPos);
+                if (body) {
+                    nextScopeKind = buildLoopHeader(token, body, &scopeDepth);
+                } else {
+                    PRINT_ERROR("Expected the body of a ");
+                    print(token);
+                    PRINT_LIT(" loop in braces\n");
+                }
+            } else if (hash == HASH("break")) {
+                buildBreak();
+            } else {
+                buildStatement(token, scopeDepth);
+            }
+
+            //anything left in the statement is unsupported and skipped
+            while (readPos < endReadPos && readPos->hash != HASH(";") && readPos->hash != HASH("{") && readPos->hash != HASH("}")) {
+                ++readPos;
+            }
+        }
+    }
+}
+
+/* Lower the function body at readPos into IR.  localCount is the number of parameters and local variables,
+and bodyTokenCount bounds the size of the IR */
+void buildFunctionIR(u32 bodyTokenCount, u32 localCount)
+{
+    resetIR(bodyTokenCount);
+
+    functionStartVersion = ++versionCounter;
+    lastCallVersion = functionStartVersion;
+    for (u32 i = 0; i < localCount; ++i) {
+        localVersions[i] = 0;
+        lastLocalStores[i] = nullptr;
+    }
+
+    //promoted globals are loaded when they are first read
+    markPromotedGlobalsStale();
+    dirtyGlobals = 0;
+    firstVisibleLocal = 0;
+
+    buildStatements(-1, -1);
+    writeBackPromotedGlobals(dirtyGlobals);
+
+    //count the uses of each value by the instructions that will be written
+    for (u32 i = 0; i < instrCount; ++i) {
+        IRInstr *instr = &instrs[i];
+        if (instr->isLive && instr->value) {
+            countUse(instr->value);
+
+            //a switch that compares its value to the cases reads it more than once
+            if (instr->kind == IRInstr::Switch && !blocks[instr->index].isJumpTable) {
+                countUse(instr->value);
+            }
+        }
+    }
+}
+
+void writeExprNode(ExprNode *node, u8 wasmType);
+
+//whether a value converts to f32 and back to its own type without changing
+bool isExactF32(ExprNode *node)
+{
+    if (node->kind != ExprNode::Const) {
+        return node->wasmType == wasm::type::f32;
+    }
+
+    ExprNode *value = copyToScratch(node, 0);
+    convertConst(value, wasm::type::f64);
+    f64 real = value->f64Value;
+    return (f64)(f32)real == real;
+}
+
+//the instructions for a binary operation, after replacing operations by some constants with cheaper ones.
+//type is the operand type of the instruction, which may be narrower than the node's operand type
+void writeBinaryOp(ExprNode *node, u8 type)
+{
+    char opChar = *getTokenText(node->op);
+    ExprNode *lhs = node->lhs;
+    ExprNode *rhs = node->rhs;
+
+    //promoting an f32 to f64 is exact, so comparing f32 values as f64 has the same result as comparing them as f32
+    if (type == wasm::type::f64 && (opChar == '<' || opChar == '>') && isExactF32(lhs) && isExactF32(rhs)) {
+        type = wasm::type::f32;
+    }
+
+    if (rhs->kind == ExprNode::Const && type == wasm::type::i32) {
+        i32 c = rhs->i32Value;
+
+        if (((opChar == '*' || opChar == '/') && c == 1) || ((opChar == '+' || opChar == '-') && c == 0)) {
+            writeExprNode(lhs, type);
+            return;
+        }
+
+        //expressions have no side effects, so the other operand can be dropped entirely
+        if (opChar == '*' && c == 0) {
+            writeI32Const(0);
+            return;
+        }
+
+        if (opChar == '*' && isPowerOf2(c)) {
+            writeExprNode(lhs, type);
+            writeI32Const(log2(c));
+            *writePos++ = wasm::i32_shl;
+            return;
+        }
+
+        //signed division rounds toward zero, so negative dividends are biased by 2^k - 1 before the arithmetic shift.
+        //The dividend is needed twice, so this is only done when it is a variable or already kept in a local
+        if (opChar == '/' && c > 0 && isPowerOf2(c) &&
+            (lhs->kind == ExprNode::LocalVar || lhs->kind == ExprNode::GlobalVar || lhs->tempLocal != NONE))
+        {
+            u32 k = log2(c);
+            writeExprNode(lhs, type);
+            writeExprNode(lhs, type);
+            writeI32Const(31);
+            if (k > 1) {
+                *writePos++ = wasm::i32_shr_s;
+                writeI32Const(32 - k);
+            }
+            *writePos++ = wasm::i32_shr_u;
+            *writePos++ = wasm::i32_add;
+            writeI32Const(k);
+            *writePos++ = wasm::i32_shr_s;
+            return;
+        }
+    }
+
+    if (rhs->kind == ExprNode::Const && type == wasm::type::f32) {
+        ExprNode *rhsValue = copyToScratch(rhs, 0);
+        convertConst(rhsValue, type);
+        f32 c = rhsValue->f32Value;
+        u32 bits;
+        memcpy(&bits, &c, 4);
+
+        //x - 0.0f is exactly x, but x + 0.0f is not when x is -0.0f
+        if (((opChar == '*' || opChar == '/') && c == 1.0f) || (opChar == '-' && bits == 0)) {
+            writeExprNode(lhs, type);
+            return;
+        }
+
+        //dividing by a power of 2 is exactly the same as multiplying by its reciprocal, when that is a normal float
+        u32 exponent = (bits >> 23) & 0xFF;
+        if (opChar == '/' && (bits & 0x7FFFFF) == 0 && exponent >= 1 && exponent <= 253) {
+            u32 reciprocalBits = (bits & 0x80000000) | ((254 - exponent) << 23);
+            f32 reciprocal;
+            memcpy(&reciprocal, &reciprocalBits, 4);
+
+            writeExprNode(lhs, type);
+            *writePos++ = wasm::f32_const;
+            writeF32(reciprocal);
+            *writePos++ = wasm::f32_mul;
+            return;
+        }
+    }
+
+    writeExprNode(lhs, type);
+    writeExprNode(rhs, type);
+    *writePos++ = getWasmOpFromOperator(node->op, type);
+}
+
+void writeIntrinsic(ExprNode *node)
+{
+    u8 type = node->operandType;
+    ExprNode *lhs = node->lhs;
+    ExprNode *rhs = node->rhs;
+
+    if (isSelectIntrinsic(node)) {
+        if (rhs) {
+            //min(a, b) is select(a, b, a < b), and max(a, b) is select(a, b, a > b)
+            writeExprNode(lhs, type);
+            writeExprNode(rhs, type);
+            writeExprNode(lhs, type);
+            writeExprNode(rhs, type);
+            *writePos++ = node->wasmOp;
+        } else {
+            //abs(x) is select(0 - x, x, x < 0)
+            ExprNode *zero = getConstNode(type, 0);
+            writeExprNode(zero, type);
+            writeExprNode(lhs, type);
+            *writePos++ = type == wasm::type::i64 ? wasm::i64_sub : wasm::i32_sub;
+            writeExprNode(lhs, type);
+            writeExprNode(lhs, type);
+            writeExprNode(zero, type);
+            *writePos++ = node->wasmOp;
+        }
+        *writePos++ = wasm::select;
+        return;
+    }
+
+    writeExprNode(lhs, type);
+    if (rhs) {
+        writeExprNode(rhs, type);
+    }
+    *writePos++ = node->wasmOp;
+}
+
+//write the instructions that compute the value of a node that isn't a constant
+//leave 1 on the stack if node is nonzero and 0 if it isn't, as C++ converts conditions to bool
+void writeCondition(ExprNode *node)
+{
+    writeExprNode(node, node->wasmType);
+    switch (node->wasmType)
+    {
+    case wasm::type::i64:
+        *writePos++ = wasm::i64_eqz;
+        *writePos++ = wasm::i32_eqz;
+        break;
+    case wasm::type::f32:
+        *writePos++ = wasm::f32_const;
+        writeF32(0);
+        *writePos++ = wasm::f32_ne;
+        break;
+    case wasm::type::f64:
+        writeF64Const(0);
+        *writePos++ = wasm::f64_ne;
+        break;
+    }
+}
+
+//number of ifs enclosing the value being written that were written for an expression rather than a block of the IR
+COMPILER_STATE(u32, branchedWriteDepth);
+
+/* ?: computes both operands and chooses one with select, unless computing the operand that isn't chosen could trap,
+in which case it branches with an if that leaves a value */
+void writeSelect(ExprNode *node)
+{
+    if (!canTrap(node->lhs) && !canTrap(node->rhs)) {
+        writeExprNode(node->lhs, node->wasmType);
+        writeExprNode(node->rhs, node->wasmType);
+        writeCondition(node->condition);
+        *writePos++ = wasm::select;
+        return;
+    }
+
+    writeCondition(node->condition);
+    *writePos++ = wasm::_if;
+    *writePos++ = node->wasmType;
+    ++branchedWriteDepth;
+    writeExprNode(node->lhs, node->wasmType);
+    *writePos++ = wasm::_else;
+    writeExprNode(node->rhs, node->wasmType);
+    --branchedWriteDepth;
+    *writePos++ = wasm::end;
+}
+
+void writeExprValue(ExprNode *node)
+{
+    switch (node->kind)
+    {
+    case ExprNode::Const:
+        break;
+
+    case ExprNode::LocalVar:
+        writeLocalOp(wasm::get_local, node->varIndex);
+        break;
+
+    case ExprNode::GlobalVar:
+        *writePos++ = wasm::get_global;
+        writePos += wasm::varuint(writePos, node->varIndex);
+        break;
+
+    case ExprNode::BinaryOp:
+        writeBinaryOp(node, node->operandType);
+        break;
+
+    case ExprNode::Intrinsic:
+        writeIntrinsic(node);
+        break;
+
+    case ExprNode::Select:
+        writeSelect(node);
+        break;
+    }
+}
+
+//write the instructions that leave the value of node on the stack as wasmType
+void writeExprNode(ExprNode *node, u8 wasmType)
+{
+    if (node->kind == ExprNode::Const) {
+        //constants are converted at compile time
+        ExprNode *value = copyToScratch(node, 0);
+        convertConst(value, wasmType);
+        switch (value->wasmType)
+        {
+        case wasm::type::i32:
+            writeI32Const(value->i32Value);
+            break;
+        case wasm::type::i64:
+            writeI64Const(value->i64Value);
+            break;
+        case wasm::type::f32:
+            *writePos++ = wasm::f32_const;
+            writeF32(value->f32Value);
+            break;
+        case wasm::type::f64:
+            writeF64Const(value->f64Value);
+            break;
+        }
+        return;
+    }
+
+    /* f64 has more than twice the precision of f32, so f64 arithmetic on f32 values that is rounded to f32 straight
+    away gives the same result as the f32 instruction.  Expressions of floats and double literals stay in f32 */
+    if (wasmType == wasm::type::f32 && node->wasmType == wasm::type::f64 && node->kind == ExprNode::BinaryOp &&
+        node->tempLocal == NONE && isExactF32(node->lhs) && isExactF32(node->rhs))
+    {
+        writeBinaryOp(node, wasm::type::f32);
+        return;
+    }
+
+    //a value with several uses is kept in a local the first time it is computed
+    if (node->tempLocal != NONE && node->tempBlock != NONE && isAncestorBlock(node->tempBlock, currentBlock)) {
+        writeLocalOp(wasm::get_local, node->tempLocal);
+    } else {
+        writeExprValue(node);
+
+        //the operands of an if are only computed on one path, so they are left for a later use to compute again
+        if (node->tempLocal != NONE && branchedWriteDepth == 0) {
+            writeLocalOp(wasm::tee_local, node->tempLocal);
+            node->tempBlock = currentBlock;
+        }
+    }
+
+    u8 conversion = getConversionOp(node->wasmType, wasmType);
+    if (conversion) {
+        *writePos++ = conversion;
+    }
+}
+
+//values used in the body of an if or loop and after it are computed once, before the if or loop
+void writeHoistedValues(IRInstr *instr)
+{
+    for (ExprNode *node = instr->hoisted; node; node = node->nextHoisted) {
+        if (node->tempLocal != NONE) {
+            writeExprValue(node);
+            writeLocalOp(wasm::set_local, node->tempLocal);
+            node->tempBlock = currentBlock;
+        }
+    }
+}
+
+/* Branch to the case of a switch matching the selector, comparing it to count cases from first, at extraDepth labels
+inside the switch's dispatch.  Fewer than 4 cases are compared in turn, and more are halved by comparing to the case
+in the middle */
+void writeCaseTree(IRBlock *block, ExprNode *selector, u8 type, u32 first, u32 count, u32 extraDepth)
+{
+    if (count < 4) {
+        for (u32 i = first; i < first + count; ++i) {
+            writeExprNode(selector, type);
+            if (type == wasm::type::i32) {
+                writeI32Const(switchCases[i].value);
+            } else {
+                writeI64Const(switchCases[i].value);
+            }
+            *writePos++ = type == wasm::type::i32 ? wasm::i32_eq : wasm::i64_eq;
+            *writePos++ = wasm::br_if;
+            writePos += wasm::varuint(writePos, switchCases[i].segment + extraDepth);
+        }
+
+        *writePos++ = wasm::br;
+        writePos += wasm::varuint(writePos, block->defaultSegment + extraDepth);
+        return;
+    }
+
+    u32 half = count / 2;
+    writeExprNode(selector, type);
+    if (type == wasm::type::i32) {
+        writeI32Const(switchCases[first + half].value);
+    } else {
+        writeI64Const(switchCases[first + half].value);
+    }
+    *writePos++ = type == wasm::type::i32 ? wasm::i32_lt_s : wasm::i64_lt_s;
+
+    writeBlockOp(wasm::_if);
+    writeCaseTree(block, selector, type, first, half, extraDepth + 1);
+    *writePos++ = wasm::_else;
+    writeCaseTree(block, selector, type, first + half, count - half, extraDepth + 1);
+    *writePos++ = wasm::end;
+}
+
+/* Branch from inside the blocks of a switch to the case matching its value.  Case i begins at the end of the block
+i labels out from the dispatch, and the end of the switch is the block after the last case */
+void writeSwitchDispatch(IRInstr *instr)
+{
+    IRBlock *block = &blocks[instr->index];
+    SwitchCase *cases = &switchCases[block->firstCase];
+    ExprNode *selector = instr->value;
+
+    //a constant selector always takes the same branch
+    if (selector->kind == ExprNode::Const) {
+        ExprNode *value = copyToScratch(selector, 0);
+        convertConst(value, instr->wasmType);
+        i64 selectorValue = instr->wasmType == wasm::type::i32 ? value->i32Value : value->i64Value;
+
+        u32 target = block->defaultSegment;
+        for (u32 i = 0; i < block->caseCount; ++i) {
+            if (cases[i].value == selectorValue) {
+                target = cases[i].segment;
+                break;
+            }
+        }
+
+        *writePos++ = wasm::br;
+        writePos += wasm::varuint(writePos, target);
+        return;
+    }
+
+    if (!block->isJumpTable) {
+        writeCaseTree(block, selector, instr->wasmType, block->firstCase, block->caseCount, 0);
+        return;
+    }
+
+    //values below the least case wrap around to large unsigned indices, which take the default branch like those past the end
+    i32 least = cases[0].value;
+    i32 greatest = cases[block->caseCount - 1].value;
+    writeExprNode(selector, wasm::type::i32);
+    if (least != 0) {
+        writeI32Const(least);
+        *writePos++ = wasm::i32_sub;
+    }
+
+    *writePos++ = wasm::br_table;
+    writePos += wasm::varuint(writePos, greatest - least + 1);
+    SwitchCase *nextCase = cases;
+    for (i64 value = least; value <= greatest; ++value) {
+        //a repeated case can't be reached
+        while (nextCase->value < value) {
+            ++nextCase;
+        }
+        writePos += wasm::varuint(writePos, nextCase->value == value ? nextCase->segment : block->defaultSegment);
+    }
+    writePos += wasm::varuint(writePos, block->defaultSegment);
+}
+
+void markUse(ExprNode *node, u32 position)
+{
+    if (node->firstUse == NONE || position < node->firstUse) {
+        node->firstUse = position;
+    }
+    if (position > node->lastUse) {
+        node->lastUse = position;
+    }
+}
+
+void addLiveRange(u32 varIndex, u32 start, u32 end)
+{
+    if (liveRangeStarts[varIndex] == NONE || start < liveRangeStarts[varIndex]) {
+        liveRangeStarts[varIndex] = start;
+    }
+    if (end > liveRangeEnds[varIndex]) {
+        liveRangeEnds[varIndex] = end;
+    }
+}
+
+/* Assign the locals after the parameters to as few locals as the output needs.  Every local is live from the first
+to the last position that stores or reads it, and one that is live on entry to a loop is live until the loop's end,
+since later iterations read what earlier ones stored.  Locals are taken in order of the start of their live range,
+and each goes in the first slot of its type that is free again, which is the linear scan of a register allocator.
+The indexes in the IR are then rewritten to those of the slots, declared as one run of locals per type */
+void allocateLocals(u32 paramCount, u32 localCount, u32 *slotCountByType)
+{
+    //values are used by live instructions, and values computed before an if or loop by the instruction they precede
+    for (u32 i = 0; i < instrCount; ++i) {
+        IRInstr *instr = &instrs[i];
+        for (ExprNode *node = instr->hoisted; node; node = node->nextHoisted) {
+            if (node->tempLocal != NONE) {
+                markUse(node, 2 * i);
+            }
+        }
+
+        if ((instr->kind == IRInstr::StoreLocal || instr->kind == IRInstr::StoreGlobal) && !instr->isLive) {
+            continue;
+        }
+
+        if (instr->value) {
+            markUse(instr->value, 2 * i + 1);
+        }
+        if (instr->kind == IRInstr::StoreLocal) {
+            addLiveRange(instr->index, 2 * i + 1, 2 * i + 1);
+        }
+    }
+
+    //operands are created before the values computed from them, so the uses of a value are known before its operands
+    for (u32 i = exprNodeCount; i-- > 0;) {
+        ExprNode *node = &exprNodes[i];
+        if (node->firstUse == NONE) {
+            continue;
+        }
+
+        ExprNode *operands[3] = {node->lhs, node->rhs, node->condition};
+        for (u32 j = 0; j < 3; ++j) {
+            if (operands[j]) {
+                markUse(operands[j], node->firstUse);
+                markUse(operands[j], node->lastUse);
+            }
+        }
+
+        if (node->kind == ExprNode::LocalVar && node->varIndex >= paramCount) {
+            addLiveRange(node->varIndex, node->firstUse, node->lastUse);
+        }
+        if (node->tempLocal != NONE) {
+            addLiveRange(node->tempLocal, node->firstUse, node->lastUse);
+        }
+    }
+
+    /* a loop runs from just after its Loop instruction to just after its EndLoop, and a range that begins before a
+    loop and ends inside it lasts to the end of the loop, which may be inside a loop that began after the range too.
+    Only the loops holding the end of each range are looked at, from the innermost out */
+    for (u32 j = paramCount; j < localCount; ++j) {
+        u32 i = liveRangeEnds[j] / 2;
+        if (liveRangeStarts[j] == NONE || i >= instrCount) {
+            continue;
+        }
+
+        bool isAfterInstr = liveRangeEnds[j] & 1;
+        u32 block = instrs[i].block;
+        if (isAfterInstr && instrs[i].kind == IRInstr::Loop) {
+            block = instrs[i].index;
+        } else if (isAfterInstr && instrs[i].kind == IRInstr::EndLoop) {
+            block = blocks[block].parent;
+        }
+
+        for (u32 loop = blocks[block].enclosingLoop; loop != 0; loop = blocks[blocks[loop].parent].enclosingLoop) {
+            if (liveRangeStarts[j] >= 2 * blocks[loop].ifInstr + 1) {
+                break;
+            }
+
+            if (blocks[loop].endInstr != NONE) {
+                liveRangeEnds[j] = 2 * blocks[loop].endInstr + 1;
+            }
+        }
+    }
+
+    //counting sort by the start of the live range, leaving out locals that are never used
+    u32 positionCount = 2 * instrCount + 2;
+    memset(positionCounts, 0, sizeof(u32) * (positionCount + 1));
+    for (u32 i = paramCount; i < localCount; ++i) {
+        if (liveRangeStarts[i] != NONE) {
+            ++positionCounts[liveRangeStarts[i] + 1];
+        }
+    }
+
+    for (u32 i = 1; i <= positionCount; ++i) {
+        positionCounts[i] += positionCounts[i - 1];
+    }
+
+    u32 liveLocalCount = positionCounts[positionCount];
+    for (u32 i = paramCount; i < localCount; ++i) {
+        if (liveRangeStarts[i] != NONE) {
+            localsByStart[positionCounts[liveRangeStarts[i]]++] = i;
+        }
+    }
+
+    u32 slotCount = 0;
+    for (u32 i = 0; i < liveLocalCount; ++i) {
+        u32 varIndex = localsByStart[i];
+        u8 wasmType = varTypes[varIndex];
+
+        u32 slot = 0;
+        while (slot < slotCount &&
+            (localSlots[slot].wasmType != wasmType || localSlots[slot].liveUntil >= liveRangeStarts[varIndex]))
+        {
+            ++slot;
+        }
+
+        if (slot == slotCount) {
+            localSlots[slot].wasmType = wasmType;
+            localSlots[slot].index = slotCountByType[wasmType & 0b11]++;
+            ++slotCount;
+        }
+
+        localSlots[slot].liveUntil = liveRangeEnds[varIndex];
+        allocatedLocals[varIndex] = slot;
+    }
+
+    u32 slotStartingIndexes[4];
+    slotStartingIndexes[0] = paramCount;
+    for (u32 i = 1; i < 4; ++i) {
+        slotStartingIndexes[i] = slotStartingIndexes[i-1] + slotCountByType[i-1];
+    }
+
+    for (u32 i = 0; i < localCount; ++i) {
+        if (i < paramCount) {
+            allocatedLocals[i] = i;
+        } else if (liveRangeStarts[i] != NONE) {
+            LocalSlot *slot = &localSlots[allocatedLocals[i]];
+            allocatedLocals[i] = slotStartingIndexes[slot->wasmType & 0b11] + slot->index;
+        } else {
+            //never written to the output
+            allocatedLocals[i] = 0;
+        }
+    }
+
+    for (u32 i = 0; i < instrCount; ++i) {
+        if (instrs[i].kind == IRInstr::StoreLocal) {
+            instrs[i].index = allocatedLocals[instrs[i].index];
+        }
+    }
+
+    for (u32 i = 0; i < exprNodeCount; ++i) {
+        ExprNode *node = &exprNodes[i];
+        if (node->kind == ExprNode::LocalVar) {
+            node->varIndex = allocatedLocals[node->varIndex];
+        }
+        if (node->tempLocal != NONE) {
+            node->tempLocal = allocatedLocals[node->tempLocal];
+        }
+    }
+}
+
+void writeFunctionIR()
+{
+    currentBlock = 0;
+
+    //number of wasm blocks, loops and ifs enclosing the code being written, for finding the depth of a break
+    u32 labelDepth = 0;
+
+    for (u32 i = 0; i < instrCount; ++i) {
+        IRInstr *instr = &instrs[i];
+
+        switch (instr->kind)
+        {
+        case IRInstr::StoreLocal:
+            if (instr->isLive) {
+                writeExprNode(instr->value, instr->wasmType);
+                writeLocalOp(wasm::set_local, instr->index);
+            }
+            break;
+
+        case IRInstr::StoreGlobal:
+            if (instr->isLive) {
+                writeExprNode(instr->value, instr->wasmType);
+                *writePos++ = wasm::set_global;
+                writePos += wasm::varuint(writePos, instr->index);
+            }
+            break;
+
+        case IRInstr::Arg:
+            writeExprNode(instr->value, instr->wasmType);
+            if (instr->convertOp) {
+                *writePos++ = instr->convertOp;
+            }
+            break;
+
+        case IRInstr::Call:
+            writeCall(instr->index);
+            if (instr->convertOp) {
+                *writePos++ = instr->convertOp;
+            }
+            break;
+
+        case IRInstr::If:
+            writeHoistedValues(instr);
+            writeCondition(instr->value);
+            writeBlockOp(wasm::_if);
+            ++labelDepth;
+            currentBlock = instr->index;
+            break;
+
+        case IRInstr::End:
+            *writePos++ = wasm::end;
+            --labelDepth;
+            currentBlock = blocks[currentBlock].parent;
+            break;
+
+        case IRInstr::Loop:
+            //a loop that can exit at the top or by a break is wrapped in a block to branch out of
+            writeHoistedValues(instr);
+            if (instr->value || blocks[instr->index].hasBreak) {
+                writeBlockOp(wasm::block);
+                blocks[instr->index].breakLabel = ++labelDepth;
+            }
+            writeBlockOp(wasm::loop);
+            ++labelDepth;
+            currentBlock = instr->index;
+
+            if (instr->value) {
+                writeCondition(instr->value);
+                *writePos++ = wasm::i32_eqz;
+                *writePos++ = wasm::br_if;
+                *writePos++ = 1;
+            }
+            break;
+
+        case IRInstr::EndLoop:
+            if (instr->value) {
+                writeCondition(instr->value);
+                *writePos++ = wasm::br_if;
+            } else {
+                *writePos++ = wasm::br;
+            }
+            *writePos++ = 0;
+            *writePos++ = wasm::end;
+            --labelDepth;
+
+            if (instrs[blocks[currentBlock].ifInstr].value || blocks[currentBlock].hasBreak) {
+                *writePos++ = wasm::end;
+                --labelDepth;
+            }
+            currentBlock = blocks[currentBlock].parent;
+            break;
+
+        case IRInstr::Switch:
+        {
+            //a block for the end of the switch, then one for each case with the first case innermost
+            writeHoistedValues(instr);
+            u32 segmentCount = blocks[instr->index].segmentCount;
+            for (u32 j = 0; j <= segmentCount; ++j) {
+                writeBlockOp(wasm::block);
+            }
+            blocks[instr->index].breakLabel = labelDepth + 1;
+            labelDepth += segmentCount + 1;
+
+            writeSwitchDispatch(instr);
+            currentBlock = instr->index;
+            break;
+        }
+
+        case IRInstr::Case:
+            //the statements of a case follow the end of its block, after those of the case before
+            *writePos++ = wasm::end;
+            --labelDepth;
+            currentBlock = instr->index;
+            break;
+
+        case IRInstr::EndCase:
+            currentBlock = blocks[currentBlock].parent;
+            break;
+
+        case IRInstr::EndSwitch:
+            *writePos++ = wasm::end;
+            --labelDepth;
+            currentBlock = blocks[currentBlock].parent;
+            break;
+
+        case IRInstr::Break:
+            *writePos++ = wasm::br;
+            writePos += wasm::varuint(writePos, labelDepth - blocks[instr->index].breakLabel);
+            break;
+        }
+    }
+}
+
+u32 getFuncIndex(u64 hash) {
+    //imported and locally defined functions share one table
+    return lookupSymbol(&funcs, hash);
+}
+
+u32 getLocalVarIndex(u64 hash) {
+    //parameters and local variables currently in scope, which in an inlined body are only the body's own
+    u32 varIndex = lookupSymbol(&localVars, hash);
+    return varIndex != NONE && varIndex >= firstVisibleLocal ? varIndex : NONE;
+}
+
+u32 getGlobalVarIndex(u64 hash) {
+    return lookupSymbol(&globalVars, hash);
+}
+
+constexpr i64 stol(char *c, char *end) {
+    //accumulate unsigned so that -2^63 wraps to the right value instead of overflowing
+    u64 result = 0;
+    bool isNegative = false;
+
+    if (*c == '-') {
+        isNegative = true;
+        ++c;
+    }
+
+    while (c != end)
+    {
+        result = result * 10 + (*c++ - '0');
+    }
+
+    return isNegative ? 0 - result : result;
+}
+
+/* Unsigned integers of up to BIG_LIMB_COUNT 32 bit limbs, least significant first, for comparing a decimal literal
+with the halfway point between two doubles exactly.  A literal keeps at most MAX_EXACT_DIGITS significant digits,
+which is more than any halfway point has, and the size covers such a literal scaled by the powers of 2 and 10 that
+the smallest and largest doubles need.  They live in per thread scratch memory rather than on the stack, which is 1 KiB
+in the wasm build.  Nothing in them outlives the parsing of one literal, so compiler contexts do not keep them */
+#define MAX_EXACT_DIGITS 800
+#define BIG_LIMB_COUNT 136
+
+struct BigInt
+{
+    u32 limbs[BIG_LIMB_COUNT];
+    u32 count;
+};
+
+THREAD_STATE BigInt literalDigits, scaledDigits, scaledHalfway;
+
+void bigMulAdd(BigInt *big, u32 factor, u32 addend)
+{
+    u64 carry = addend;
+    for (u32 i = 0; i < big->count; ++i) {
+        carry += (u64)big->limbs[i] * factor;
+        big->limbs[i] = (u32)carry;
+        carry >>= 32;
+    }
+    if (carry) {
+        big->limbs[big->count++] = (u32)carry;
+    }
+}
+
+void bigMulPow10(BigInt *big, u32 exponent)
+{
+    for (; exponent >= 9; exponent -= 9) {
+        bigMulAdd(big, 1000000000, 0);
+    }
+    u32 factor = 1;
+    for (; exponent > 0; --exponent) {
+        factor *= 10;
     }
+    bigMulAdd(big, factor, 0);
+}
 
-    //end of function
-    u8 flush = getFuncIndex(HASH("flushStdout"));
-    if (flush != (u8)-1) {
-        *writePos++ = wasm::call;
-        *writePos++ = flush;
+void bigShiftLeft(BigInt *big, u32 shift)
+{
+    u32 limbShift = shift / 32;
+    u32 bitShift = shift % 32;
+    if (big->count == 0) {
+        return;
     }
-    *writePos++ = wasm::end;
 
-    //patch in the body size of the function earlier in the output
-    writeSectionSize(functionBodySize);
+    big->limbs[big->count] = 0;
+    for (u32 i = big->count + 1; i-- > 0;) {
+        u32 high = big->limbs[i] << bitShift;
+        u32 low = bitShift && i > 0 ? big->limbs[i - 1] >> (32 - bitShift) : 0;
+        big->limbs[i + limbShift] = high | low;
+    }
+    memset(big->limbs, 0, limbShift * 4);
+    big->count += limbShift + 1;
+    while (big->count > 0 && big->limbs[big->count - 1] == 0) {
+        --big->count;
+    }
 }
 
-u8 writeExpression() {
-    u8 queuedOperation = 0;
-    u8 lhsType = 0;
-    u8 rhsType = 0;
-
-    while (readPos < endReadPos) {
-        Token token = nextToken(readPos);
-        readPos = token.end;
-
-        if (*token.start == ';' || *token.start == ')' || (token.end - token.start == 2 && *token.start == '<')) {
-            readPos = token.start;
-            break;
+i32 bigCompare(BigInt *a, BigInt *b)
+{
+    if (a->count != b->count) {
+        return a->count < b->count ? -1 : 1;
+    }
+    for (u32 i = a->count; i-- > 0;) {
+        if (a->limbs[i] != b->limbs[i]) {
+            return a->limbs[i] < b->limbs[i] ? -1 : 1;
         }
+    }
+    return 0;
+}
 
-        //assume every token is an identifier, a number, or an operator
-        else if (token.type == Token::Identifier) {
-            u64 hash = djb_hash(token);
-            u32 varIndex = getLocalVarIndex(hash);
+//compare digits * 10^exponent10, plus a little more if isInexact, with halfway * 2^exponent2
+i32 compareDecimal(BigInt *digits, i32 exponent10, bool isInexact, u64 halfway, i32 exponent2)
+{
+    BigInt *left = &scaledDigits;
+    BigInt *right = &scaledHalfway;
+    memcpy(left->limbs, digits->limbs, digits->count * 4);
+    left->count = digits->count;
+    right->limbs[0] = (u32)halfway;
+    right->limbs[1] = (u32)(halfway >> 32);
+    right->count = right->limbs[1] ? 2 : 1;
+
+    exponent10 >= 0 ? bigMulPow10(left, exponent10) : bigMulPow10(right, -exponent10);
+    exponent2 >= 0 ? bigShiftLeft(right, exponent2) : bigShiftLeft(left, -exponent2);
+
+    i32 result = bigCompare(left, right);
+    return result == 0 && isInexact ? 1 : result;
+}
 
-            if (varIndex != -1) {
-                *writePos++ = wasm::get_local;
-                *writePos++ = varIndex;
+//For now, only convert fixed-point literals to values.  The result is the nearest double, ties to even
+f64 stod(char *c, char *end)
+{
+    f64 sign = 1.0;
 
-                if (queuedOperation) {
-                    *writePos++ = queuedOperation;
-                    queuedOperation = 0;
-                }
+    if (*c == '-')
+    {
+        sign = -1.0;
+        ++c;
+    }
 
-                lhsType = rhsType;
-                rhsType = varTypes[varIndex];
-            } else {
-                varIndex = getGlobalVarIndex(hash);
-                if (varIndex != -1) {
-                    u8 type = globalVarTypes[varIndex];
-                    u8 loadInstruction = getWasmLoadInstructionFromType(type);
-                    u32 address = globalVarAddresses[varIndex];
-
-                    *writePos++ = wasm::i32_const;
-                    *writePos++ = 0;
-                    *writePos++ = loadInstruction;
-                    //Alignment: 2 for i32 and f32, 3 for i64 and f64.  Temporary TODO       
-                    *writePos++ = 3 - (type & 1);
-                    writePos += wasm::varuint(writePos, address);
-
-                    lhsType = rhsType;
-                    rhsType = type;
-                }
-            }
+    /* the literal is digits * 10^exponent10, where digits holds the significant digits.  The first 19 also go into
+    top, which is exact in a u64.  Digits past MAX_EXACT_DIGITS only make the value inexact.
+    NOTE: literals may begin with a decimal point e.g. ".01f" */
+    BigInt *digits = &literalDigits;
+    digits->count = 0;
+    u32 digitCount = 0;
+    u64 top = 0;
+    u32 topCount = 0;
+    i32 exponent10 = 0;
+    bool isFraction = false;
+    bool isInexact = false;
+
+    for (; c != end; ++c)
+    {
+        if (*c == '.') {
+            isFraction = true;
+            continue;
         }
-        
-        else if (token.type == Token::Number) {
-            bool isFloat = false;
-            for (char* c = token.start; c != token.end; ++c) {
-                if (*c == '.' || *c == 'f') {
-                    isFloat = true;
-                }
-            }
 
-            if (token.end[-1] == 'f') {
-                //make the trailing f at the end of literals optional
-                --token.end;
+        u32 digit = *c - '0';
+        if (digitCount == 0 && digit == 0) {
+            exponent10 -= isFraction;
+        } else if (digitCount < MAX_EXACT_DIGITS) {
+            bigMulAdd(digits, 10, digit);
+            ++digitCount;
+            exponent10 -= isFraction;
+            if (topCount < 19) {
+                top = top * 10 + digit;
+                ++topCount;
             }
+        } else {
+            isInexact |= digit != 0;
+            exponent10 += !isFraction;
+        }
+    }
 
-            lhsType = rhsType;
+    if (digitCount == 0) {
+        return sign * 0.0;
+    }
 
-            if (isFloat) {
-                *writePos++ = wasm::f32_const;
-                f32 result = stof(token.start, token.end);
-                writeF32(result);
+    //the nearest double is one rounding away while both the digits and the power of 10 are exact doubles
+    if (digitCount == topCount && top <= 1ull << 53 && exponent10 >= -22 && exponent10 <= 22) {
+        f64 power = 1.0;
+        for (i32 i = exponent10 < 0 ? -exponent10 : exponent10; i > 0; --i) {
+            power *= 10.0;
+        }
+        return sign * (exponent10 < 0 ? (f64)top / power : (f64)top * power);
+    }
 
-                rhsType = wasm::type::f32;
-            } else {
-                *writePos++ = wasm::i32_const;
-                i32 result = stoi(token.start, token.end);
-                writePos += wasm::varint(writePos, result);
+    //the leading digit's place decides overflow and underflow before any arithmetic
+    i32 leadingExponent = exponent10 + (i32)digitCount - 1;
+    if (leadingExponent > 309) {
+        return sign * (1.0 / 0.0);
+    }
+    if (leadingExponent < -325) {
+        return sign * 0.0;
+    }
 
-                rhsType = wasm::type::i32;
-            }
+    //a guess within a few units in the last place, from the top digits scaled one power of 10 at a time
+    f64 guess = (f64)top;
+    for (i32 i = exponent10 + (i32)(digitCount - topCount); i > 0; --i) {
+        guess *= 10.0;
+    }
+    for (i32 i = exponent10 + (i32)(digitCount - topCount); i < 0; ++i) {
+        guess /= 10.0;
+    }
 
-            if (queuedOperation) {
-                *writePos++ = queuedOperation;
-                queuedOperation = 0;
+    //the guess is mantissa * 2^exponent2, with infinity as 2^1024
+    u64 bits;
+    memcpy(&bits, &guess, 8);
+    u64 mantissa = bits & ((1ull << 52) - 1);
+    i32 exponent2 = -1074;
+    if (bits >> 52) {
+        mantissa |= 1ull << 52;
+        exponent2 = (i32)(bits >> 52) - 1075;
+    }
+    if (exponent2 > 971) {
+        mantissa = 1ull << 52;
+        exponent2 = 972;
+    }
+
+    //step to the next double up while the literal is above the halfway point to it, or on it with an odd mantissa,
+    //and down the same way.  Below the smallest normal double the spacing stays 2^-1074
+    for (;;)
+    {
+        i32 above = compareDecimal(digits, exponent10, isInexact, mantissa * 2 + 1, exponent2 - 1);
+        if (above > 0 || (above == 0 && (mantissa & 1))) {
+            if (++mantissa == 1ull << 53) {
+                mantissa = 1ull << 52;
+                ++exponent2;
             }
+            continue;
         }
-        
-        else {
-            u8 wasmOp = getWasmOpFromOperator(token, rhsType);
 
-            //for now, don't take into account operator precedence
-            if (queuedOperation) {
-                *writePos++ = queuedOperation;
-            }
+        if (mantissa == 0) {
+            break;
+        }
 
-            queuedOperation = wasmOp;
+        bool isBinadeStart = mantissa == 1ull << 52 && exponent2 > -1074;
+        i32 below = isBinadeStart ? compareDecimal(digits, exponent10, isInexact, mantissa * 4 - 1, exponent2 - 2)
+                                  : compareDecimal(digits, exponent10, isInexact, mantissa * 2 - 1, exponent2 - 1);
+        if (below < 0 || (below == 0 && (mantissa & 1))) {
+            if (isBinadeStart) {
+                mantissa = (1ull << 53) - 1;
+                --exponent2;
+            } else {
+                --mantissa;
+            }
+            continue;
         }
+        break;
     }
 
-    if (queuedOperation) {
-        *writePos++ = queuedOperation;
-        queuedOperation = 0;
+    if (exponent2 > 971) {
+        return sign * (1.0 / 0.0);
     }
-
-    //return the type of the expression
-    return rhsType;
+    bits = mantissa >> 52 ? (u64)(exponent2 + 1075) << 52 | (mantissa & ((1ull << 52) - 1)) : mantissa;
+    memcpy(&guess, &bits, 8);
+    return sign * guess;
 }
 
-u32 getFuncIndex(u64 hash) {
-    //check all imported and locally defined functions
-    for (u32 i = 0; i < funcCount; ++i) {
-        if (hash == funcNameHashes[i]) {
-            return i;
-        }
+/* Scan through the entire source code and write down the imported functions, exported functions.
+function signatures, and global variables w/ initial values.
+
+Anything that appears outside of a function definition is scanned during this pass and written to the binary.  */
+
+
+//return the type index of an encoded function signature, adding it to the Type section if it wasn't used before
+u32 getTypeIndex(u64 encodedType)
+{
+    u32 typeIndex = lookupSymbol(&signatures, encodedType);
+
+    //this func sig wasn't previously defined, so define it
+    if (typeIndex == NONE)
+    {
+        typeIndex = typeCount++;
+        types[typeIndex] = encodedType;
+        defineSymbol(&signatures, encodedType, typeIndex);
     }
 
-    return -1;
+    return typeIndex;
 }
 
-u32 getLocalVarIndex(u64 hash) {
-    //check for parameters for a match
-    for (u32 i = 0; i < varStartingIndexes[0]; ++i) {
-        if (hash == varNameHashes[i]) {
-            return i;
+/* Place every region of memory and return the end of the last one.  The stdout ring and the draw list are 16 byte
+aligned, so their 16 byte headers and each draw command sit within one cache line */
+u32 layoutDataRegions()
+{
+    dataRegionSizes[DataRegion::StdoutRing] = hasStdout ? 16 + STDOUT_RING_CAPACITY + 32 : 0;
+    dataRegionAlignments[DataRegion::StdoutRing] = 4;
+    dataRegionSizes[DataRegion::DrawList] = hasDrawList ? 16 + 16 * DRAW_LIST_CAPACITY : 0;
+    dataRegionAlignments[DataRegion::DrawList] = 4;
+    dataRegionSizes[DataRegion::Strings] = stringDataSize;
+    dataRegionAlignments[DataRegion::Strings] = 0;
+
+    //insertion sort by increasing alignment, keeping regions of the same alignment in order
+    u32 order[DataRegion::Count];
+    for (u32 i = 0; i < DataRegion::Count; ++i) {
+        u32 j = i;
+        for (; j > 0 && dataRegionAlignments[order[j - 1]] > dataRegionAlignments[i]; --j) {
+            order[j] = order[j - 1];
         }
+        order[j] = i;
     }
 
-    //check each of the 4 types of local vars for matches
-    for (u32 i = 0; i < 4; ++i) {
-        for (u32 j = 0; j < varCountByType[i]; ++j) {
-            u32 varIndex = varStartingIndexes[i] + j;
-            if (hash == varNameHashes[varIndex]) {
-                return varIndex;
-            }
-        }
+    u32 dataEnd = 0;
+    for (u32 i = 0; i < DataRegion::Count; ++i) {
+        u32 region = order[i];
+        u32 alignment = 1 << dataRegionAlignments[region];
+        dataRegionAddresses[region] = (dataEnd + alignment - 1) & -alignment;
+        dataEnd = dataRegionAddresses[region] + dataRegionSizes[region];
     }
 
-    return -1;
+    stdoutRingAddress = dataRegionAddresses[DataRegion::StdoutRing];
+    drawListAddress = dataRegionAddresses[DataRegion::DrawList];
+    stringDataAddress = dataRegionAddresses[DataRegion::Strings];
+    return dataEnd;
 }
 
-u32 getGlobalVarIndex(u64 hash) {
-    //check for parameters for a match
-    for (u32 i = 0; i < globalVarCount; ++i) {
-        if (hash == globalVarNameHashes[i]) {
-            return i;
+/* Mark the functions reachable from the exported functions, then remove the local functions that are unreachable or
+whose every call is inlined and the imports that nothing calls.  The functions that std::cout and drawCircle compile
+to are only generated when something reachable uses them, and they keep their imports */
+void removeUnreachableFuncs()
+{
+    u32 queueLength = 0;
+    for (u32 i = 0; i < localFuncCount; ++i) {
+        u32 candidate = lookupSymbol(&inlineCandidateNames, localFuncs[i].nameHash);
+        if (localFuncs[i].isExported && candidate != NONE && !inlineCandidates[candidate].isReachable) {
+            inlineCandidates[candidate].isReachable = true;
+            inlineStack[queueLength++] = candidate;
         }
     }
 
-    return -1;
-}
-
-constexpr i32 stoi(char *c, char *end) {
-    i32 result = 0;
-    i32 sign = 1;
+    bool usesStdout = false;
+    bool usesDrawCircle = false;
+    for (u32 i = 0; i < queueLength; ++i) {
+        InlineCandidate *func = &inlineCandidates[inlineStack[i]];
 
-    if (*c == '-') {
-        sign = -1;
-        ++c;
-    }
+        for (Token *token = func->body; token < func->bodyEnd; ++token) {
+            if (token->type != Token::Identifier) {
+                continue;
+            }
 
-    while (c != end)
-    {
-        result = result * 10 + (*c++ - '0');
-    }
+            if (token->hash == HASH("std::cout")) {
+                usesStdout = true;
+            }
 
-    return result * sign;
-}
+            //math functions are instructions rather than calls
+            if (token[1].hash != HASH("(") || getIntrinsic(token->hash) != nullptr) {
+                continue;
+            }
 
-constexpr f32 stof(char *c, char *end)
-{
-    //For now, only convert fixed-point float literals to float values
-    f32 result = 0.0f;
-    f32 sign = 1.0f;
+            u32 callee = lookupSymbol(&inlineCandidateNames, token->hash);
+            if (callee != NONE) {
+                if (!inlineCandidates[callee].isReachable) {
+                    inlineCandidates[callee].isReachable = true;
+                    inlineStack[queueLength++] = callee;
+                }
+                continue;
+            }
 
-    if (*c == '-')
-    {
-        sign = -1.0f;
-        ++c;
+            for (u32 j = 0; j < importedFuncCount; ++j) {
+                if (importedFuncs[j].nameHash == token->hash) {
+                    importedFuncs[j].isCalled = true;
+                    usesDrawCircle |= token->hash == HASH("drawCircle");
+                }
+            }
+        }
     }
 
-    //calculate portion of value larger than 10
-    //NOTE: float literals may begin with a decimal point e.g. ".01f"
-    while (c != end && *c != '.')
-    {
-        result = result * 10.0f + (*c++ - '0');
+    u32 usedImportCount = 0;
+    for (u32 i = 0; i < importedFuncCount; ++i) {
+        u64 hash = importedFuncs[i].nameHash;
+        if (importedFuncs[i].isCalled || (hash == HASH("flushStdout") && usesStdout) ||
+            (hash == HASH("flushDrawList") && usesDrawCircle))
+        {
+            importedFuncs[usedImportCount++] = importedFuncs[i];
+        }
     }
+    importedFuncCount = usedImportCount;
 
-    if (c != end && *c == '.')
-    {
-        ++c;
-
-        float scale = 0.1f;
-        while (c != end)
-        {
-            result += scale * (*c++ - '0');
-            scale *= 0.1f;
+    //a function declared before its definition is only compiled at its definition
+    u32 emittedFuncCount = 0;
+    for (u32 i = 0; i < localFuncCount; ++i) {
+        u32 candidate = lookupSymbol(&inlineCandidateNames, localFuncs[i].nameHash);
+        bool isEmitted = candidate == NONE ? localFuncs[i].isExported :
+            inlineCandidates[candidate].params == funcDefinitions[i] + 2 && inlineCandidates[candidate].isReachable &&
+            (localFuncs[i].isExported || inlineCandidates[candidate].state != InlineState::Inlinable);
+
+        if (isEmitted) {
+            funcDefinitions[emittedFuncCount] = funcDefinitions[i];
+            localFuncs[emittedFuncCount++] = localFuncs[i];
         }
     }
+    localFuncCount = emittedFuncCount;
+
+    //signatures only the removed functions had are removed too, keeping the rest in order
+    clearSymbolTable(&signatures);
+    u32 usedTypeCount = 0;
+    for (u32 i = 0; i < typeCount; ++i) {
+        bool isUsed = false;
+        for (u32 j = 0; j < importedFuncCount + localFuncCount; ++j) {
+            FuncHeader *func = j < importedFuncCount ? &importedFuncs[j] : &localFuncs[j - importedFuncCount];
+            if (func->typeIndex == i) {
+                func->typeIndex = usedTypeCount;
+                isUsed = true;
+            }
+        }
 
-    return result * sign;
+        if (isUsed) {
+            types[usedTypeCount] = types[i];
+            defineSymbol(&signatures, types[i], usedTypeCount++);
+        }
+    }
+    typeCount = usedTypeCount;
 }
 
-/* Scan through the entire source code and write down the imported functions, exported functions.
-function signatures, and global variables w/ initial values.
-
-Anything that appears outside of a function definition is scanned during this pass and written to the binary.  */
-
-struct FuncHeader
-{
-    char *nameStart;
-    u16 nameLength;
-    u8 typeIndex;
-    bool isExported;
-};
-
-u8 writeMetaData()
+void writeMetaData()
 {
     /* keep note of all function signatures (wasm types) used in a given source code.
     signatures are encoded as follows to allow O(1) equality checks between two fignatures and efficient encoding and decoding
@@ -1014,53 +6828,53 @@ u8 writeMetaData()
 
     f64 - i32 have numeric values 124 - 127, so mapping involves a check for void or subtraction by 124
     */
-    u8 typeCount = 0;
-
-    //store the locations in memory that define the name of the functions, the length of the name, and the corresponding type
-    FuncHeader importedFuncs[32];
-    u8 importedFuncCount = 0;
-
-    //record the function signatures of each function defined inside the wasm module, in order
-    //assuming no more than 127 unique indexes will be used in a single program
-    FuncHeader localFuncs[32];
-    u8 localFuncCount = 0;
+    typeCount = 0;
+    importedFuncCount = 0;
+    localFuncCount = 0;
 
     bool definingExternalResource = false;
     u32 lhsType = 0;
-    char *identifierStart = nullptr;
-    char *identifierEnd = nullptr;
+    Token *typeName = nullptr;
+    Token *identifier = nullptr;
+    u64 initialValue = 0;
 
     while (readPos < endReadPos)
     {
-        Token token = nextToken(readPos);
+        Token *token = readPos;
 
-        switch (token.type)
+        switch (token->type)
         {
         case Token::Symbol:
         {
-            if (lhsType != 0 && identifierStart != nullptr)
+            if (lhsType != 0 && identifier != nullptr)
             {
-                if (token.start[0] == ';')
+                if (token->hash == HASH(";"))
                 {
                     definingExternalResource = false;
-                    
-                    u32 address = 0;
-                    if (globalVarCount > 0) {
-                        //for now, align everything on 8 byte boundaries, TODO
-                        address = globalVarAddresses[globalVarCount - 1] + 4;
-                        if ((lhsType & 0) == 0 && (address & 4)) {
-                            //i64 or f64, round up to 8 bytes
-                            address += 4;
-                        }
+
+                    //code outside the supported subset can look like more globals than the tables were sized for
+                    if (globalVarCount < functionTableSizes.maxGlobals) {
+                        defineSymbol(&globalVars, identifier->hash, globalVarCount);
+                        globalVarTypes[globalVarCount] = lhsType;
+                        globalVarInitialValues[globalVarCount] = initialValue;
+                        ++globalVarCount;
+                    } else {
+                        PRINT_ERROR("Unexpected declaration of global variable ");
+                        print(identifier);
+                        put('\n');
                     }
 
-                    globalVarAddresses[globalVarCount] = address;
-                    globalVarNameHashes[globalVarCount] = djb_hash(identifierStart, identifierEnd);
-                    globalVarTypes[globalVarCount] = lhsType;
+                    initialValue = 0;
+                }
+                else if (token->hash == HASH("="))
+                {
+                    readPos = token + 1;
+                    initialValue = parseGlobalInitializer(identifier, lhsType);
 
-                    ++globalVarCount;
+                    //continue from the ; that ends the declaration
+                    token = readPos - 1;
                 }
-                else if (token.start[0] == '(')
+                else if (token->hash == HASH("("))
                 {
                     //this looks like the start of a function header
                     //scan its parameters to determine the function signature
@@ -1070,99 +6884,85 @@ u8 writeMetaData()
                     //encode earlier paramater types at higher addresses to avoid variable bit shifts
                     do
                     {
-                        token = nextToken(token.end);
-                        if (token.type == Token::Identifier)
+                        ++token;
+                        if (token->type == Token::Identifier)
                         {
-                            u64 hash = djb_hash(token);
-                            u32 wasmType = getWasmTypeFromCppName(hash);
+                            u32 wasmType = getWasmTypeFromCppName(token->hash);
                             if (wasmType)
                             {
                                 type = (type << 2) | (wasmType & 0b11);
                                 ++paramCount;
                             }
                         }
-                    } while (*token.start != ')');
+                    } while (token->hash != HASH(")") && token + 1 < endReadPos);
 
                     //assign a value of 0-4 to the highest 3 bits of type to indicate return type
                     //encode the number of parameters in the 5 bits immediately below that
                     type |= ((u64)paramCount << 56) | ((u64)(lhsType - wasm::type::f64) << 61);
 
-                    //now check if this func signature has been used before.  Either grab a reference to the
-                    //previously used func index or generate a new unique func sig
-                    u8 typeIndex = 255;
-                    for (u32 i = 0; i < typeCount; ++i)
-                    {
-                        if (type == types[i])
-                        {
-                            typeIndex = i;
-                        }
-                    }
-
-                    //this func sig wasn't previously defined, so define it
-                    if (typeIndex == 255)
-                    {
-                        typeIndex = typeCount++;
-                        types[typeIndex] = type;
-                    }
+                    u32 typeIndex = getTypeIndex(type);
 
                     FuncHeader func = {
-                        identifierStart,
-                        (u16)(identifierEnd - identifierStart),
+                        identifier->hash,
+                        getTokenText(identifier),
+                        identifier->length,
                         typeIndex,
-                        !definingExternalResource //assume local functions are always exported
+                        !definingExternalResource && isExportRoot(identifier->hash),
+                        false
                     };
 
                     if (definingExternalResource) {
                         definingExternalResource = false;
                         importedFuncs[importedFuncCount++] = func;
                     } else {
+                        //remember where the definition starts so the code generation pass can jump straight to it
+                        funcDefinitions[localFuncCount] = typeName;
                         localFuncs[localFuncCount++] = func;
                     }
 
-                    identifierStart = nullptr;
-                    identifierEnd = nullptr;
+                    identifier = nullptr;
                     lhsType = 0;
 
                     //the next symbol is either ';' or '{'.  Ignore bodies of functions in this pass
-                    Token next = nextToken(token.end);
-                    if (next.type == Token::Symbol)
+                    Token *next = token + 1;
+                    if (next < endReadPos && next->type == Token::Symbol)
                     {
-                        if (next.start[0] == ';')
+                        if (next->hash == HASH(";"))
                         {
                             token = next;
                         }
-                        else if (next.start[0] == '{')
+                        else if (next->hash == HASH("{"))
                         {
                             //match brackets to skip whole function body
                             int bracketDepth = 1;
                             do
                             {
-                                next = nextToken(next.end);
-                                if (next.type == Token::Symbol)
+                                ++next;
+                                if (next->type == Token::Symbol)
                                 {
-                                    if (next.start[0] == '{')
+                                    if (next->hash == HASH("{"))
                                     {
                                         ++bracketDepth;
                                     }
-                                    else if (next.start[0] == '}')
+                                    else if (next->hash == HASH("}"))
                                     {
                                         --bracketDepth;
                                     }
                                 }
-                            } while (bracketDepth > 0);
+                            } while (bracketDepth > 0 && next + 1 < endReadPos);
 
                             token = next;
                         }
                         else
                         {
-                            PRINT_LIT("Unrecognized symbol after function paramaters: ");
+                            PRINT_ERROR("Unrecognized symbol after function paramaters: ");
                             print(next);
                             put('\n');
                         }
                     }
                     else
                     {
-                        PRINT_LIT("Expected symbol after function paramaters. Found: \"");
+                        PRINT_ERROR("Expected symbol after function paramaters. Found: \"");
                         print(next);
                         PRINT_LIT("\"\n");
                     }
@@ -1180,11 +6980,12 @@ u8 writeMetaData()
 
         case Token::Identifier:
         {
-            u64 hash = djb_hash(token);
+            u64 hash = token->hash;
             u32 wasmType = getWasmTypeFromCppName(hash);
             if (wasmType)
             {
                 lhsType = wasmType;
+                typeName = token;
             }
             else
                 switch (hash)
@@ -1195,8 +6996,8 @@ u8 writeMetaData()
                     definingExternalResource = true;
 
                     //check the next token to see if there is a whole `extern "C"`
-                    Token next = nextToken(token.end);
-                    if (next.type == Token::StringLit && next.end - next.start == 3 && next.start[1] == 'C')
+                    Token *next = token + 1;
+                    if (next < endReadPos && next->type == Token::StringLit && next->hash == HASH("\"C\""))
                     {
                         token = next;
                     }
@@ -1206,8 +7007,7 @@ u8 writeMetaData()
                 default:
                 {
                     //the identifier is neither a type name nor a keyword, so it must be a variable name or function name
-                    identifierStart = token.start;
-                    identifierEnd = token.end;
+                    identifier = token;
                 }
                 break;
                 }
@@ -1226,17 +7026,87 @@ u8 writeMetaData()
         break;
         }
 
-        readPos = token.end;
+        readPos = token + 1;
     }
 
+    //only what the exported functions reach is in the module
+    removeUnreachableFuncs();
+
     //all information necessary to populate the Type, Import, Function, Global, and Export sections should be known by this point
 
+    //calls to drawCircle append to the draw list when the host can replay it
+    flushDrawListImport = NONE;
+    u32 drawCircleImport = NONE;
+    for (u32 i = 0; i < importedFuncCount; ++i)
+    {
+        if (importedFuncs[i].nameHash == HASH("flushDrawList")) {
+            flushDrawListImport = i;
+        } else if (importedFuncs[i].nameHash == HASH("drawCircle")) {
+            drawCircleImport = i;
+        }
+    }
+
+    //the generated function stores its parameters as drawCircle(float x, float y, float r)
+    u64 circleType = ((u64)4 << 61) | ((u64)3 << 56) | 0b010101;
+    hasDrawList = flushDrawListImport != NONE && drawCircleImport != NONE &&
+        types[importedFuncs[drawCircleImport].typeIndex] == circleType;
+
+    //nothing calls the drawCircle import once its calls go to the generated function, so it is not imported
+    if (hasDrawList) {
+        --importedFuncCount;
+        for (u32 i = drawCircleImport; i < importedFuncCount; ++i) {
+            importedFuncs[i] = importedFuncs[i + 1];
+        }
+        flushDrawListImport -= flushDrawListImport > drawCircleImport;
+    }
+
+    //std::cout is compiled to calls to generated functions that share the flushStdout import
+    flushStdoutImport = NONE;
+    for (u32 i = 0; i < importedFuncCount; ++i)
+    {
+        if (importedFuncs[i].nameHash == HASH("flushStdout")) {
+            flushStdoutImport = i;
+        }
+    }
+
+    hasStdout = flushStdoutImport != NONE;
+    generatedFuncCount = hasStdout ? StdoutFunc::Count : 0;
+    stdoutFuncs = importedFuncCount + localFuncCount;
+
+    drawFuncs = stdoutFuncs + generatedFuncCount;
+    u32 drawFuncTypes[DrawFunc::Count] = {};
+    if (hasDrawList) {
+        generatedFuncCount += DrawFunc::Count;
+        drawFuncTypes[DrawFunc::Circle] = getTypeIndex(circleType);
+    }
+
+    /* signatures of PutChar(i32), PutString(i32, i32), PutI32(i32), PutI64(i64), PutF64(f64), and Flush().
+    void is encoded as 4, i32 as 3 and i64 as 2 */
+    u32 stdoutFuncTypes[StdoutFunc::Count];
+    if (hasStdout)
+    {
+        u64 voidReturn = (u64)4 << 61;
+        stdoutFuncTypes[StdoutFunc::PutChar] = getTypeIndex(voidReturn | ((u64)1 << 56) | 3);
+        stdoutFuncTypes[StdoutFunc::PutString] = getTypeIndex(voidReturn | ((u64)2 << 56) | 0b1111);
+        stdoutFuncTypes[StdoutFunc::PutI32] = stdoutFuncTypes[StdoutFunc::PutChar];
+        stdoutFuncTypes[StdoutFunc::PutI64] = getTypeIndex(voidReturn | ((u64)1 << 56) | 2);
+        stdoutFuncTypes[StdoutFunc::PutF64] = getTypeIndex(voidReturn | ((u64)1 << 56));
+        stdoutFuncTypes[StdoutFunc::Flush] = getTypeIndex(voidReturn);
+    }
+
+    //names are copied out of the source code at most twice, and everything else is a few bytes per type, function or global
+    if (!reserveMemory(writePos + 128 + 40 * typeCount + 32 * (importedFuncCount + localFuncCount) +
+        16 * globalVarCount + 2 * (sourceEnd - sourceStart)))
+    {
+        return;
+    }
+
     u8 *sectionSizePtr;
 
     *writePos++ = wasm::section::Type;
-    sectionSizePtr = writePos; //# of bytes that belong to this section.  Allocate space up to 16256 bytes
-    writePos += 2;
-    *writePos++ = typeCount;
+    sectionSizePtr = writePos; //# of bytes that belong to this section
+    writePos += 5;
+    writePos += wasm::varuint(writePos, typeCount);
 
     for (u32 i = 0; i < typeCount; ++i)
     {
@@ -1266,64 +7136,156 @@ u8 writeMetaData()
 
     *writePos++ = wasm::section::Import;
     sectionSizePtr = writePos;
-    writePos += 2;
-    *writePos++ = importedFuncCount;
+    writePos += 5;
+    writePos += wasm::varuint(writePos, importedFuncCount);
 
     for (u32 i = 0; i < importedFuncCount; ++i)
     {
         INSERT_LIT("env", writePos);
-        *writePos++ = importedFuncs[i].nameLength; //assuming name lengths stay below 127 chars
+        writePos += wasm::varuint(writePos, importedFuncs[i].nameLength);
         memcpy(writePos, importedFuncs[i].nameStart, importedFuncs[i].nameLength);
         writePos += importedFuncs[i].nameLength;
         *writePos++ = wasm::external::Function;
-        *writePos++ = importedFuncs[i].typeIndex;
+        writePos += wasm::varuint(writePos, importedFuncs[i].typeIndex);
     }
 
     writeSectionSize(sectionSizePtr);
 
     *writePos++ = wasm::section::Function;
     sectionSizePtr = writePos;
-    writePos += 2;
-    *writePos++ = localFuncCount;
+    writePos += 5;
+    writePos += wasm::varuint(writePos, localFuncCount + generatedFuncCount);
 
     for (u32 i = 0; i < localFuncCount; ++i) {
-        *writePos++ = localFuncs[i].typeIndex;
+        writePos += wasm::varuint(writePos, localFuncs[i].typeIndex);
+    }
+
+    if (hasStdout) {
+        for (u32 i = 0; i < StdoutFunc::Count; ++i) {
+            writePos += wasm::varuint(writePos, stdoutFuncTypes[i]);
+        }
+    }
+
+    if (hasDrawList) {
+        for (u32 i = 0; i < DrawFunc::Count; ++i) {
+            writePos += wasm::varuint(writePos, drawFuncTypes[i]);
+        }
     }
 
     writeSectionSize(sectionSizePtr);
 
+    u32 dataEnd = layoutDataRegions();
+
+    //request enough 64KiB pages to hold every string literal, the stdout ring, and the draw list
+    u32 pageCount = (dataEnd + 0xFFFF) >> 16;
+    if (pageCount == 0) {
+        pageCount = 1;
+    }
+
     *writePos++ = wasm::section::Memory;
-    *writePos++ = 4; //# of bytes that belong to this section
+    sectionSizePtr = writePos;
+    writePos += 5;
     *writePos++ = 1; //one memory defined
     *writePos++ = 1; //memory is limited
-    *writePos++ = 1; //initial one page
-    *writePos++ = 1; //max one page
+    writePos += wasm::varuint(writePos, pageCount); //initial pages
+    writePos += wasm::varuint(writePos, pageCount); //max pages
+    writeSectionSize(sectionSizePtr);
+
+    /* every global variable of the program is a mutable wasm global initialized to its constant initializer, or 0.
+    The addresses of the stdout ring and draw list follow as immutable globals, exported so the host can find them */
+    u32 stdoutGlobal = globalVarCount;
+    u32 drawListGlobal = stdoutGlobal + hasStdout;
+    u32 wasmGlobalCount = drawListGlobal + hasDrawList;
+    if (wasmGlobalCount > 0)
+    {
+        *writePos++ = wasm::section::Global;
+        sectionSizePtr = writePos;
+        writePos += 5;
+        writePos += wasm::varuint(writePos, wasmGlobalCount); //# of global variables defined
+
+        for (u32 i = 0; i < globalVarCount; ++i) {
+            u8 type = globalVarTypes[i];
+            *writePos++ = type;
+            *writePos++ = 1; //mutable
+
+            u64 bits = globalVarInitialValues[i];
+            if (type == wasm::type::i32) {
+                writeI32Const(bits);
+            } else if (type == wasm::type::i64) {
+                writeI64Const(bits);
+            } else if (type == wasm::type::f32) {
+                *writePos++ = wasm::f32_const;
+                memcpy(writePos, &bits, 4);
+                writePos += 4;
+            } else {
+                *writePos++ = wasm::f64_const;
+                memcpy(writePos, &bits, 8);
+                writePos += 8;
+            }
+            *writePos++ = wasm::end;
+        }
+
+        if (hasStdout) {
+            *writePos++ = wasm::type::i32;
+            *writePos++ = 0; //immutable
+            *writePos++ = wasm::i32_const;
+            writePos += wasm::varint(writePos, stdoutRingAddress);
+            *writePos++ = wasm::end;
+        }
 
-    /*  Come back to this section once a stack is implemented.  The only global var will be the stack pointer
-    *writePos++ = wasm::section::Global;
-    *writePos++ = 1; //# of bytes belong to this section.
-    *writePos++ = 0; //# of global variables defined */
+        if (hasDrawList) {
+            *writePos++ = wasm::type::i32;
+            *writePos++ = 0; //immutable
+            *writePos++ = wasm::i32_const;
+            writePos += wasm::varint(writePos, drawListAddress);
+            *writePos++ = wasm::end;
+        }
+
+        writeSectionSize(sectionSizePtr);
+    }
+
+    //the memory is exported so the host can read strings out of it
+    u32 exportCount = 1 + hasStdout + hasDrawList;
+    for (u32 i = 0; i < localFuncCount; ++i)
+    {
+        if (localFuncs[i].isExported) {
+            ++exportCount;
+        }
+    }
 
     *writePos++ = wasm::section::Export;
     sectionSizePtr = writePos;
-    writePos += 3;
+    writePos += 5;
+    writePos += wasm::varuint(writePos, exportCount);
+
+    INSERT_LIT("memory", writePos);
+    *writePos++ = wasm::external::Memory;
+    *writePos++ = 0; //memory index
+
+    if (hasStdout) {
+        INSERT_LIT("__stdout", writePos);
+        *writePos++ = wasm::external::Global;
+        writePos += wasm::varuint(writePos, stdoutGlobal);
+    }
+
+    if (hasDrawList) {
+        INSERT_LIT("__drawList", writePos);
+        *writePos++ = wasm::external::Global;
+        writePos += wasm::varuint(writePos, drawListGlobal);
+    }
 
-    u8 exportedFuncCount = 0;
     for (u32 i = 0; i < localFuncCount; ++i)
     {
         FuncHeader func = localFuncs[i];
         if (func.isExported) {
-            ++exportedFuncCount;
-
-            *writePos++ = func.nameLength; //assuming name lengths stay below 127 chars
+            writePos += wasm::varuint(writePos, func.nameLength);
             memcpy(writePos, func.nameStart, func.nameLength);
             writePos += func.nameLength;
             *writePos++ = wasm::external::Function;
-            *writePos++ = i + importedFuncCount; //local function indexed start after the last imported function index
+            writePos += wasm::varuint(writePos, i + importedFuncCount); //local function indexed start after the last imported function index
         }
     }
 
-    sectionSizePtr[2] = exportedFuncCount;
     writeSectionSize(sectionSizePtr);
 
 
@@ -1333,16 +7295,165 @@ u8 writeMetaData()
 
     for (u32 i = 0; i < importedFuncCount; ++i) {
         FuncHeader func = importedFuncs[i];
-        funcNameHashes[i] = djb_hash(func.nameStart, func.nameStart + func.nameLength);
+        defineSymbol(&funcs, func.nameHash, i);
         funcSigs[i] = func.typeIndex;
     }
 
     for (u32 i = importedFuncCount; i < funcCount; ++i) {
         FuncHeader func = localFuncs[i - importedFuncCount];
-        funcNameHashes[i] = djb_hash(func.nameStart, func.nameStart + func.nameLength);
+        defineSymbol(&funcs, func.nameHash, i);
         funcSigs[i] = func.typeIndex;
     }
 
-    //this is the number that is recorded in the Code section, so return it
-    return localFuncCount;
-}
\ No newline at end of file
+    //calls to drawCircle go to the generated function that appends to the draw list
+    if (hasDrawList) {
+        defineSymbol(&funcs, HASH("drawCircle"), drawFuncs + DrawFunc::Circle);
+        funcSigs[drawFuncs + DrawFunc::Circle] = drawFuncTypes[DrawFunc::Circle];
+    }
+}
+
+/* A compiler context is a copy of everything declared with COMPILER_STATE.  Without one, each native thread and each
+wasm instance compiles with the state of its own globals.  A host that wants several independent compilers, each with
+its own export roots, code cache and thread count, creates a context for each and loads it into the globals with
+useCompilerContext before compiling with it.  Switching stores the state of the context it leaves back into that
+context, the same way the codegen workers copy ModuleState in and out.  A context is in use on at most one thread at a
+time, but it may move to another thread once the first has switched away from it.
+The contexts live in the compiler's own static memory, because a compilation may write over any memory after its
+source code.  There are MAX_COMPILER_CONTEXTS of them, and destroyCompilerContext returns one for reuse */
+enum : u32
+{
+    compilerStateCount = __COUNTER__ //every COMPILER_STATE comes before this
+};
+
+//a context stores the variables in the order they are declared, each aligned like its type
+template <u32 index> constexpr u32 getCompilerStateOffset(u32 end)
+{
+    return (end + CompilerStateVar<index>::alignment - 1) & -CompilerStateVar<index>::alignment;
+}
+
+//the end of the variables of the state from index on, when they are stored from offset on
+template <u32 index> constexpr u32 getCompilerStateEnd(u32 offset)
+{
+    return getCompilerStateEnd<index + 1>(getCompilerStateOffset<index>(offset) + CompilerStateVar<index>::size);
+}
+
+template <> constexpr u32 getCompilerStateEnd<compilerStateCount>(u32 offset)
+{
+    return offset;
+}
+
+struct CompilerContext
+{
+    alignas(8) u8 state[getCompilerStateEnd<0>(0)];
+};
+
+//copy the variables of the state from index on into the context, or out of it when isLoading
+template <u32 index> void copyCompilerState(CompilerContext *context, u32 offset, bool isLoading)
+{
+    void *variable = CompilerStateVar<index>::address();
+    u8 *stored = context->state + getCompilerStateOffset<index>(offset);
+    if (isLoading) {
+        memcpy(variable, stored, CompilerStateVar<index>::size);
+    } else {
+        memcpy(stored, variable, CompilerStateVar<index>::size);
+    }
+    copyCompilerState<index + 1>(context, getCompilerStateOffset<index>(offset) + CompilerStateVar<index>::size,
+        isLoading);
+}
+
+template <> void copyCompilerState<compilerStateCount>(CompilerContext *, u32, bool)
+{
+}
+
+//store the globals into context, or load them from it when isLoading
+void copyCompilerContext(CompilerContext *context, bool isLoading)
+{
+    copyCompilerState<0>(context, 0, isLoading);
+}
+
+#define MAX_COMPILER_CONTEXTS 64
+CompilerContext compilerContexts[MAX_COMPILER_CONTEXTS];
+bool isCompilerContextTaken[MAX_COMPILER_CONTEXTS];
+
+//the context loaded into the globals, or nullptr for the thread's or instance's own state, which is kept in
+//defaultContext while another context is loaded
+THREAD_STATE CompilerContext *currentContext;
+THREAD_STATE CompilerContext defaultContext;
+
+//load context into the globals, so the next exports called on this thread use it.  0 goes back to the state this
+//thread or instance had before it loaded any context
+EXPORT void useCompilerContext(uptr context)
+{
+    CompilerContext *next = context ? (CompilerContext *)context : &defaultContext;
+    CompilerContext *current = currentContext ? currentContext : &defaultContext;
+    if (next == current)
+    {
+        return;
+    }
+
+    copyCompilerContext(current, false);
+    copyCompilerContext(next, true);
+    currentContext = context ? next : nullptr;
+}
+
+//a new context with the state the globals start with, or 0 if all MAX_COMPILER_CONTEXTS are taken
+EXPORT uptr createCompilerContext()
+{
+    u32 index = 0;
+    while (index < MAX_COMPILER_CONTEXTS)
+    {
+#ifdef __wasm__
+        bool wasTaken = isCompilerContextTaken[index];
+        isCompilerContextTaken[index] = true;
+#else
+        bool wasTaken = __atomic_exchange_n(&isCompilerContextTaken[index], true, __ATOMIC_ACQUIRE);
+#endif
+        if (!wasTaken)
+        {
+            break;
+        }
+        ++index;
+    }
+
+    if (index == MAX_COMPILER_CONTEXTS)
+    {
+        return 0;
+    }
+
+    //the globals are the only place the state has names, so the new context is loaded to set the variables that have
+    //an initializer.  Every other variable starts at zero
+    CompilerContext *context = compilerContexts + index;
+    memset(context, 0, sizeof(CompilerContext));
+
+    uptr previous = (uptr)currentContext;
+    useCompilerContext((uptr)context);
+    exportRootCount = NONE;
+#ifndef __wasm__
+    codegenThreadCount = 1;
+#endif
+    useCompilerContext(previous);
+    return (uptr)context;
+}
+
+/* return a context from createCompilerContext to the pool, for a later createCompilerContext to reuse.  A thread that
+has it loaded goes back to its own state first.  No other thread may have it loaded */
+EXPORT void destroyCompilerContext(uptr context)
+{
+    uptr offset = context - (uptr)compilerContexts;
+    if (offset >= sizeof(compilerContexts) || offset % sizeof(CompilerContext) != 0)
+    {
+        return;
+    }
+    u32 index = offset / sizeof(CompilerContext);
+
+    if (currentContext == (CompilerContext *)context)
+    {
+        useCompilerContext(0);
+    }
+
+#ifdef __wasm__
+    isCompilerContextTaken[index] = false;
+#else
+    __atomic_store_n(&isCompilerContextTaken[index], false, __ATOMIC_RELEASE);
+#endif
+}
@@ -0,0 +1,367 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "native-host.h"
+
+#define PAGE_SIZE 65536
+
+//address space only, the pages are backed as the compiler touches them
+#define RESERVED_MEMORY_SIZE (4ull << 30)
+
+//the compiler's state is per thread, so each thread compiles in its own memory
+thread_local u8 *memoryStart, *memoryEnd, *memoryLimit, *highestMemoryEnd;
+
+//memory of the workers writing function bodies for this thread's compilations, kept to be reused by the next one.
+//the compiler runs at most 64 workers
+thread_local u8 *workerMemoryStarts[64];
+thread_local u64 workerMemoryUse;
+
+//the function bodies of the last compilation on this thread, copied out of its memory before the next one reuses it
+thread_local bool isKeepingCodeCache;
+thread_local std::vector<u8> keptCodeCache;
+//what the compiler printed during the last compilation on this thread, which is only ever error messages
+thread_local std::string diagnostics;
+
+extern "C" void hostPuts(char *address, u32 size)
+{
+    diagnostics.append(address, size);
+}
+
+extern "C" void hostPut(u32 character)
+{
+    diagnostics += (char)character;
+}
+
+extern "C" void hostPutu32(u32 num)
+{
+    diagnostics += std::to_string(num);
+}
+
+extern "C" void hostPuti32(i32 num)
+{
+    diagnostics += std::to_string(num);
+}
+
+extern "C" u8 *hostGetMemoryEnd()
+{
+    return memoryEnd;
+}
+
+extern "C" bool hostGrowMemory(u32 pageCount)
+{
+    u64 size = (u64)pageCount * PAGE_SIZE;
+    if (size > (u64)(memoryLimit - memoryEnd))
+    {
+        return false;
+    }
+
+    memoryEnd += size;
+    if (memoryEnd > highestMemoryEnd)
+    {
+        highestMemoryEnd = memoryEnd;
+    }
+
+    return true;
+}
+
+//make start the memory of this thread, reserving it if it is null.  returns false if it could not be reserved
+bool useMemory(u8 *start)
+{
+    if (start == nullptr)
+    {
+        void *reservation = mmap(nullptr, RESERVED_MEMORY_SIZE, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (reservation == MAP_FAILED)
+        {
+            perror("mmap");
+            return false;
+        }
+
+        start = (u8 *)reservation;
+    }
+
+    memoryStart = start;
+    memoryEnd = start;
+    memoryLimit = start + RESERVED_MEMORY_SIZE;
+    highestMemoryEnd = start;
+    return true;
+}
+
+//run task once for each worker, each on a thread of its own with memory of its own, and wait for all of them
+extern "C" void hostRunInParallel(void (*task)(void *context, u32 worker), void *context, u32 workerCount)
+{
+    u8 **memoryStarts = workerMemoryStarts;
+    std::vector<u64> memoryUse(workerCount);
+    std::vector<std::string> workerDiagnostics(workerCount);
+    std::vector<std::thread> workers;
+
+    for (u32 worker = 0; worker < workerCount; ++worker)
+    {
+        workers.emplace_back([=, &memoryUse, &workerDiagnostics] {
+            useMemory(memoryStarts[worker]);
+            memoryStarts[worker] = memoryStart;
+            task(context, worker);
+            memoryUse[worker] = highestMemoryEnd - memoryStart;
+            workerDiagnostics[worker] = std::move(diagnostics);
+        });
+    }
+
+    //the errors of each worker follow the errors before them, in the order of the functions they wrote
+    for (u32 worker = 0; worker < workerCount; ++worker)
+    {
+        workers[worker].join();
+        workerMemoryUse += memoryUse[worker];
+        diagnostics += workerDiagnostics[worker];
+    }
+}
+
+//the declarations compiler.mjs puts in place of #include <iostream> and #include <canvas>
+const char IOSTREAM[] = R"(extern "C" void puts(char *address, u32 size);
+extern "C" void put(u32 character);
+extern "C" void putu32(u32 num);
+extern "C" void puti32(i32 num);
+extern "C" void putf32(f32 num);
+extern "C" void putf64(f64 num);
+extern "C" void flushStdout();
+)";
+
+const char CANVAS[] = R"(extern "C" void drawCircle(float x, float y, float r);
+extern "C" void flushDrawList();
+)";
+
+//no include directive is shorter than this, so the output is at most this many times longer than the input
+#define MAX_PREPROCESSOR_GROWTH (sizeof(IOSTREAM) / sizeof("#include<canvas>") + 1)
+
+struct SourceReader
+{
+    const char *pos;
+    const char *end;
+};
+
+//a backslash before a newline joins the two lines, wherever it is
+void skipLineContinuations(SourceReader *reader)
+{
+    while (reader->end - reader->pos >= 2 && reader->pos[0] == '\\' && reader->pos[1] == '\n')
+    {
+        reader->pos += 2;
+    }
+}
+
+char peek(SourceReader *reader, u32 ahead)
+{
+    SourceReader lookahead = *reader;
+    for (u32 i = 0; i < ahead && lookahead.pos < lookahead.end; ++i)
+    {
+        ++lookahead.pos;
+        skipLineContinuations(&lookahead);
+    }
+    return lookahead.pos < lookahead.end ? *lookahead.pos : '\0';
+}
+
+void advance(SourceReader *reader)
+{
+    ++reader->pos;
+    skipLineContinuations(reader);
+}
+
+//whether the reader is at text, which is then skipped
+bool skipText(SourceReader *reader, const char *text)
+{
+    SourceReader lookahead = *reader;
+    for (; *text; ++text)
+    {
+        if (lookahead.pos >= lookahead.end || *lookahead.pos != *text)
+        {
+            return false;
+        }
+        advance(&lookahead);
+    }
+
+    *reader = lookahead;
+    return true;
+}
+
+void skipSpaces(SourceReader *reader)
+{
+    while (reader->pos < reader->end && (*reader->pos == ' ' || *reader->pos == '\t'))
+    {
+        advance(reader);
+    }
+}
+
+//the include a directive beginning at the reader names if it is one of the known headers, or null
+const char *getIncludedHeader(SourceReader *reader)
+{
+    SourceReader lookahead = *reader;
+    if (!skipText(&lookahead, "#include"))
+    {
+        return nullptr;
+    }
+    skipSpaces(&lookahead);
+
+    const char *header = skipText(&lookahead, "<iostream>") ? IOSTREAM :
+                         skipText(&lookahead, "<canvas>") ? CANVAS : nullptr;
+    skipSpaces(&lookahead);
+    if (header == nullptr || (lookahead.pos < lookahead.end && *lookahead.pos != '\n'))
+    {
+        return nullptr;
+    }
+
+    *reader = lookahead;
+    return header;
+}
+
+/* The preprocessing compiler.mjs does before compiling: join continued lines, remove comments, replace the known
+includes with their declarations, and remove every other preprocessor line.  out needs room for
+MAX_PREPROCESSOR_GROWTH times length.  Returns the length of the output */
+u32 preprocess(const char *source, u32 length, char *out)
+{
+    char *outStart = out;
+    SourceReader reader = {source, source + length};
+    skipLineContinuations(&reader);
+
+    while (reader.pos < reader.end)
+    {
+        char c = *reader.pos;
+        if (c == '/' && peek(&reader, 1) == '/')
+        {
+            while (reader.pos < reader.end && *reader.pos != '\n')
+            {
+                advance(&reader);
+            }
+        }
+        else if (c == '/' && peek(&reader, 1) == '*')
+        {
+            advance(&reader);
+            advance(&reader);
+            while (reader.pos < reader.end && !skipText(&reader, "*/"))
+            {
+                advance(&reader);
+            }
+        }
+        else if (c == '#')
+        {
+            const char *header = getIncludedHeader(&reader);
+            if (header)
+            {
+                u32 headerLength = strlen(header);
+                memcpy(out, header, headerLength);
+                out += headerLength;
+            }
+
+            while (reader.pos < reader.end && *reader.pos != '\n')
+            {
+                advance(&reader);
+            }
+        }
+        else
+        {
+            *out++ = c;
+            advance(&reader);
+        }
+    }
+
+    return out - outStart;
+}
+
+u32 compileNative(const char *source, u32 length, u8 **module)
+{
+    *module = nullptr;
+    diagnostics.clear();
+    if (!useMemory(memoryStart) || (u64)length * MAX_PREPROCESSOR_GROWTH + 8 > RESERVED_MEMORY_SIZE)
+    {
+        return 0;
+    }
+
+    //every compilation starts over with the source code at the start of memory, like a freshly loaded module
+    length = preprocess(source, length, (char *)memoryStart);
+    memoryEnd = memoryStart + ((length + 8ull + PAGE_SIZE - 1) & -(u64)PAGE_SIZE);
+    highestMemoryEnd = memoryEnd;
+    workerMemoryUse = 0;
+
+    if (isKeepingCodeCache)
+    {
+        setCodeCache(keptCodeCache.data(), keptCodeCache.size());
+    }
+
+    *module = (u8 *)getWasmFromCpp((char *)memoryStart, length);
+
+    if (isKeepingCodeCache)
+    {
+        u8 *cache = (u8 *)getCodeCacheAddress();
+        keptCodeCache.assign(cache, cache + getCodeCacheSize());
+    }
+
+    //the compiler stores the module size over the start of the source code
+    return *(u32 *)memoryStart;
+}
+
+void setCodeCacheEnabled(bool isEnabled)
+{
+    isKeepingCodeCache = isEnabled;
+    if (!isEnabled)
+    {
+        keptCodeCache.clear();
+        keptCodeCache.shrink_to_fit();
+    }
+}
+
+u32 compileFile(const char *path, u8 **module, bool *hasErrors)
+{
+    *module = nullptr;
+    *hasErrors = true;
+    diagnostics.clear();
+
+    int file = open(path, O_RDONLY);
+    if (file == -1)
+    {
+        diagnostics = std::string(strerror(errno)) + "\n";
+        return 0;
+    }
+
+    struct stat status;
+    if (fstat(file, &status) == -1 || status.st_size > 0xFFFFFFFF)
+    {
+        diagnostics = "unable to compile a file of this size\n";
+        close(file);
+        return 0;
+    }
+
+    //the file is read through a mapping and preprocessed straight into the compiler's memory, with no copy in between
+    u32 length = status.st_size;
+    void *source = length > 0 ? mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0) : nullptr;
+    close(file);
+    if (source == MAP_FAILED)
+    {
+        diagnostics = std::string(strerror(errno)) + "\n";
+        return 0;
+    }
+
+    u32 moduleSize = compileNative((const char *)source, length, module);
+    *hasErrors = *module == nullptr || getErrorCount() != 0;
+
+    if (source)
+    {
+        munmap(source, length);
+    }
+    return moduleSize;
+}
+
+const std::string &getDiagnostics()
+{
+    return diagnostics;
+}
+
+u64 getPeakMemoryUse()
+{
+    return highestMemoryEnd - memoryStart + workerMemoryUse;
+}
@@ -0,0 +1,45 @@
+/* Runs the compiler in a native process instead of a wasm instance.  The compiler expects the source code at the start
+of a memory region that grows in 64 KiB pages the way linear memory does, so the host reserves one large range of
+address space up front and moves the end of memory forward within it */
+#include <string>
+
+#include "wasm_definitions.h"
+
+extern "C" uptr getWasmFromCpp(char *sourceCode, u32 length);
+extern "C" void setExportRoots(char *names, u32 length);
+
+//write function bodies on this many threads once the metadata pass is done.  1 writes them on the compiling thread
+extern "C" void setCodegenThreadCount(u32 threadCount);
+
+//reuse the function bodies of cache in the next compilation, and write a new cache after its module
+extern "C" void setCodeCache(u8 *cache, u32 size);
+extern "C" uptr getCodeCacheAddress();
+extern "C" u32 getCodeCacheSize();
+
+//a context holds the state of a compiler, so one thread can switch between several.  See CompilerContext in cpp.cpp
+extern "C" uptr createCompilerContext();
+extern "C" void useCompilerContext(uptr context);
+extern "C" void destroyCompilerContext(uptr context);
+
+//how many errors the last compilation printed
+extern "C" u32 getErrorCount();
+
+/* preprocess source the way compiler.mjs does, compile it, and point *module at the output, which stays valid until the
+next compilation on the same thread.  returns the module size, or 0 if it could not compile.  Every thread compiles in
+its own memory with its own compiler state, so any number of threads can compile at once */
+u32 compileNative(const char *source, u32 length, u8 **module);
+
+//compile the file at path like compileNative, reading it through a mapping of the file.  *hasErrors is set if the file
+//could not be read or the compilation printed errors, in which case the module is not usable
+u32 compileFile(const char *path, u8 **module, bool *hasErrors);
+
+//what the last compilation on this thread printed, which is its error messages one per line, or empty if it had none
+const std::string &getDiagnostics();
+
+//the most memory the last compilation on this thread used, from the start of the source code to the end of memory,
+//plus the memory of the workers that wrote its function bodies
+u64 getPeakMemoryUse();
+
+//keep the function bodies of each compilation on this thread, so the next compilation only writes the functions that
+//changed.  Turning it off discards the kept bodies
+void setCodeCacheEnabled(bool isEnabled);
@@ -8,6 +8,7 @@ typedef signed long long i64;
 typedef unsigned long long u64;
 typedef float f32;
 typedef double f64;
+typedef __UINTPTR_TYPE__ uptr;
 
 struct wasm
 {
@@ -34,6 +35,29 @@ struct wasm
         return c - writePos;
     }
 
+    static u32 varint64(u8 *writePos, i64 value)
+    {
+        u8 *c = writePos;
+
+        u8 byte;
+
+        do
+        {
+            byte = value & 0x7F;
+            value >>= 7;
+
+            /* sign bit of byte is second high order bit (0x40) */
+            if ((value != 0 && (byte & 0x40) == 0) || (value != -1 && (byte & 0x40)))
+            {
+                byte |= 0x80;
+            }
+
+            *c++ = byte;
+        } while (byte & 0x80);
+
+        return c - writePos;
+    }
+
     static u32 varuint(u8 *writePos, u32 value)
     {
         u8 *c = writePos;
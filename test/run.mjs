@@ -0,0 +1,324 @@
+//Compiles small programs with the cpp.wasm at the root of the repository, runs them and checks what they print and
+//draw.  Run it with "npm test" after rebuilding cpp.wasm with src/build.sh, since that build is what the page loads
+import fs from "fs";
+import getCompiler from "../compiler.mjs";
+
+const root = new URL("../", import.meta.url);
+
+//compiler.mjs fetches cpp.wasm relative to the page, so read it from the repository instead
+globalThis.fetch = async path => ({
+    arrayBuffer: async () => fs.readFileSync(new URL(path, root))
+});
+
+//the exports of the compiler's own instance, which is the first one instantiated
+let compilerExports = null;
+const instantiate = WebAssembly.instantiate;
+WebAssembly.instantiate = async (...args) => {
+    const results = await instantiate(...args);
+    compilerExports = compilerExports || results.instance.exports;
+    return results;
+};
+
+//the program the editor starts with
+const editorSource = fs.readFileSync(new URL("public/create-editor.js", root), "utf8");
+const sampleProgram = editorSource.match(/const sampleProgram = [^`]*`\\\n([\s\S]*?)`;/)[1].replace(/\\\\/g, "\\");
+
+let output = "";
+let circles = [];
+let runtime = null;
+
+//the circles appended to the module's draw list since the last replay, laid out as in public/create-ui.js
+function replayDrawList() {
+    if (!runtime || !runtime.__drawList) {
+        return;
+    }
+
+    const address = runtime.__drawList.value;
+    const header = new Uint32Array(runtime.memory.buffer, address, 2);
+    const commandTypes = new Uint32Array(runtime.memory.buffer, address + 16, header[0] * 4);
+    const operands = new Float32Array(runtime.memory.buffer, address + 16, header[0] * 4);
+    for (let i = 0; i < header[0] * 4; i += 4) {
+        if (commandTypes[i] === 0) {
+            circles.push([operands[i + 1], operands[i + 2], operands[i + 3]]);
+        }
+    }
+    header[0] = 0;
+}
+
+const imports = {
+    stdout: text => {
+        output += text;
+    },
+    drawCircle: (x, y, r) => {
+        circles.push([x, y, r]);
+    },
+    flushDrawList: replayDrawList
+};
+
+//compile source, call main and then update once per frame, and return what the program printed and drew.
+//The functions in exportNames are compiled too, for the test to call afterwards
+async function run(compiler, source, frameCount = 0, exportNames = undefined) {
+    output = "";
+    circles = [];
+    runtime = await compiler.compile(source, imports, exportNames);
+
+    if (runtime.main) {
+        runtime.main();
+    }
+    for (let frame = 0; frame < frameCount; ++frame) {
+        runtime.update(frame / 60, 1 / 60);
+        replayDrawList();
+    }
+    return {output, circles, runtime};
+}
+
+function expectEqual(actual, expected, what) {
+    if (actual !== expected) {
+        throw new Error(`${what} is ${JSON.stringify(actual)} instead of ${JSON.stringify(expected)}`);
+    }
+}
+
+function expectSameBytes(actual, expected, what) {
+    if (actual.length !== expected.length || actual.some((byte, i) => byte !== expected[i])) {
+        throw new Error(`${what} differ`);
+    }
+}
+
+const tests = [];
+function test(name, body) {
+    tests.push({name, body});
+}
+
+test("runs the editor's sample program", async compiler => {
+    const {output, circles} = await run(compiler, sampleProgram, 600);
+    expectEqual(circles.length, 600, "the number of circles drawn in 600 frames");
+    expectEqual(/^((Bounce|Launch): \d+\.\d+\n)+$/.test(output), true, `whether ${JSON.stringify(output)} is lines of bounces`);
+});
+
+//the names of the functions a module imports, read from its import section
+function importedNames(bytes) {
+    let offset = 8;
+    const readVaruint = () => {
+        let value = 0;
+        for (let shift = 0; ; shift += 7) {
+            const byte = bytes[offset++];
+            value |= (byte & 0x7F) << shift;
+            if (byte < 0x80) {
+                return value;
+            }
+        }
+    };
+    const readName = () => {
+        const length = readVaruint();
+        offset += length;
+        return String.fromCharCode(...bytes.subarray(offset - length, offset));
+    };
+
+    while (offset < bytes.length) {
+        const id = bytes[offset++];
+        const end = readVaruint() + offset;
+        if (id === 2) {
+            const names = [];
+            for (let count = readVaruint(); count > 0; --count) {
+                readName();
+                names.push(readName());
+                offset++; //kind
+                readVaruint(); //type index
+            }
+            return names;
+        }
+        offset = end;
+    }
+    return [];
+}
+
+test("imports only the functions its module calls", async compiler => {
+    //the sample's calls to drawCircle append to the draw list, which the host replays through flushDrawList
+    const names = importedNames(compiler.compileToWasmBinary(sampleProgram));
+    expectEqual(names.join(" "), "flushStdout flushDrawList", "the imported functions");
+});
+
+test("compiles deeply nested parentheses", async compiler => {
+    //each level recurses in the parser, which shares the compiler's 1 KiB stack
+    let expression = "x";
+    let expected = 1;
+    for (let i = 0; i < 1000; ++i) {
+        expression = `(x + ${expression} * 3)`;
+        expected = (1 + Math.imul(expected, 3)) | 0;
+    }
+
+    const source = `#include <iostream>\nint x;\nvoid main() {\n    x = 1;\n    std::cout << ${expression} << '\\n';\n}\n`;
+    expectEqual((await run(compiler, source)).output, `${expected}\n`, "the value of the expression");
+});
+
+test("rounds long literals near halfway points to the nearest double", async compiler => {
+    //2^53 + 1 and 1 + 2^-53 are halfway between two doubles, so the digits after them decide the rounding.
+    //Subtracting the double below leaves a small integer that prints exactly
+    const source = `#include <iostream>
+void main() {
+    std::cout << 9007199254740993.0000000000000000000000000000000000000000 - 9007199254740992.0 << ' ';
+    std::cout << 9007199254740993.0000000000000000000000000000000000000001 - 9007199254740992.0 << ' ';
+    std::cout << 9007199254740992.9999999999999999999999999999999999999999 - 9007199254740992.0 << ' ';
+    std::cout << (1.00000000000000011102230246251565404236316680908203125 - 1.0) * 4503599627370496.0 << ' ';
+    std::cout << (1.00000000000000011102230246251565404236316680908203125001 - 1.0) * 4503599627370496.0 << '\\n';
+}
+`;
+    expectEqual((await run(compiler, source)).output, "0 2 0 0 1\n", "the output");
+});
+
+test("gives min and max the C++ results for NaN and zeros", async compiler => {
+    //fmin and fmax return the operand that isn't NaN.  std::min(a, b) is b < a ? b : a and std::max(a, b) is
+    //a < b ? b : a, so they return a when the operands are equal or either is NaN.  The expected lines are from g++
+    const source = `#include <iostream>
+void compare(double a, double b) {
+    std::cout << fmin(a, b) << ' ' << fmax(a, b) << ' ' << std::min(a, b) << ' ' << std::max(a, b) << '\\n';
+}
+void compareFloats(float a, float b) {
+    std::cout << fminf(a, b) << ' ' << fmaxf(a, b) << ' ' << std::min(a, b) << ' ' << std::max(a, b) << '\\n';
+}
+void main() {
+    std::cout << std::min(0.0, -0.0) << ' ' << std::max(-0.0, 0.0) << ' ' << fmin(0.0, 0.0 / 0.0) << ' ';
+    std::cout << fmax(0.0 / 0.0, -1.0) << '\\n';
+}
+`;
+    const {runtime} = await run(compiler, source, 0, ["main", "compare", "compareFloats"]);
+    const pairs = [[NaN, 1], [1, NaN], [-0, 0], [0, -0], [1, 2], [2, 1]];
+    for (const [a, b] of pairs) {
+        runtime.compare(a, b);
+    }
+    for (const [a, b] of pairs) {
+        runtime.compareFloats(a, b);
+    }
+
+    const lines = "1 1 nan nan\n1 1 1 1\n0 0 -0 -0\n-0 -0 0 0\n1 2 1 2\n1 2 1 2\n";
+    expectEqual(output, "0 -0 0 -1\n" + lines + lines, "the output");
+});
+
+test("keeps the sign of zero in constants", async compiler => {
+    //the compiler folds float constants with its own arithmetic, which must follow IEEE 754 like wasm's
+    const source = `#include <iostream>
+void main() {
+    std::cout << -0.0 << ' ' << 0.0 * -1.0 << ' ' << 1.0 / -0.0 << ' ' << -0.0f << '\\n';
+}
+`;
+    expectEqual((await run(compiler, source)).output, "-0 -0 -inf -0\n", "the output");
+});
+
+test("grows its memory for a long program", async compiler => {
+    //the compiler starts with 2 pages, far less than the arena for a function of 20000 statements needs
+    const statements = "    g = g + 1;\n".repeat(20000);
+    const source = `#include <iostream>\nint g;\nvoid main() {\n${statements}    std::cout << g << '\\n';\n}\n`;
+    expectEqual((await run(compiler, source)).output, "20000\n", "the output");
+});
+
+test("reports running out of memory instead of writing past it", async compiler => {
+    //every level of braces takes a few KiB of tables, so a million of them need more than the 2 GiB the compiler may grow to
+    const source = `void main() {\n${"{".repeat(1000000)}${"}".repeat(1000000)}}\n`;
+    output = "";
+    expectEqual(compiler.compileToWasmBinary(source).length, 0, "the size of the module");
+    expectEqual(output, "Out of memory\n", "the output");
+
+    const after = await run(compiler, `#include <iostream>\nvoid main() {\n    std::cout << 5 << '\\n';\n}\n`);
+    expectEqual(after.output, "5\n", "the output of the next compilation");
+});
+
+test("reuses its code cache", async compiler => {
+    const first = compiler.compileToWasmBinary(sampleProgram).slice();
+    const changed = sampleProgram.replace("elasticity = -0.8f;", "elasticity = -0.7f;");
+    expectEqual(changed !== sampleProgram, true, "whether the sample program was changed");
+
+    compiler.compileToWasmBinary(changed);
+    expectSameBytes(compiler.compileToWasmBinary(sampleProgram), first, "the bytes from a cached compilation");
+});
+
+//compile source in a context with the compiler's own exports, for the state compiler.mjs sets again before each
+//compilation.  Returns the names of the functions the module exports
+function compileInContext(context, source) {
+    compilerExports.useCompilerContext(context);
+    const address = compilerExports.getWasmFromCpp(compilerExports.__heap_base, writeInput(source));
+    const size = new Uint32Array(compilerExports.memory.buffer)[(compilerExports.__heap_base.value + 3) >> 2];
+    const module = new WebAssembly.Module(new Uint8Array(compilerExports.memory.buffer, address, size));
+    return WebAssembly.Module.exports(module).filter(entry => entry.kind === "function").map(entry => entry.name);
+}
+
+//write text where the compiler reads its input, and return its length in bytes
+function writeInput(text) {
+    const bytes = new TextEncoder().encode(text);
+    new Uint8Array(compilerExports.memory.buffer).set(bytes, compilerExports.__heap_base.value);
+    return bytes.length;
+}
+
+function setExportRoots(context, names) {
+    compilerExports.useCompilerContext(context);
+    compilerExports.setExportRoots(compilerExports.__heap_base, writeInput(names));
+}
+
+test("keeps the state of each compiler context apart", async () => {
+    //the export roots and the error count last until the next compilation, so each context must keep its own
+    const first = compilerExports.createCompilerContext();
+    const second = compilerExports.createCompilerContext();
+    const counter = "int count;\nvoid main() {\n    count = 1;\n}\nvoid tick() {\n    count = count + 1;\n}\n";
+    const timer = "float time;\nvoid reset() {\n    time = 0.0f;\n}\nvoid update() {\n    time = time + 1.0f;\n}\n";
+    try {
+        setExportRoots(first, "tick");
+        setExportRoots(second, "reset");
+        expectEqual(compileInContext(first, counter).join(" "), "tick", "the exports of the first context");
+        expectEqual(compileInContext(second, timer).join(" "), "reset", "the exports of the second context");
+
+        output = "";
+        compileInContext(first, "void main() {\n    missing = 1;\n}\n");
+        expectEqual(compileInContext(second, timer).join(" "), "update", "the exports of the second context");
+        compilerExports.useCompilerContext(first);
+        expectEqual(compilerExports.getErrorCount(), 1, "the error count of the first context");
+        compilerExports.useCompilerContext(second);
+        expectEqual(compilerExports.getErrorCount(), 0, "the error count of the second context");
+    } finally {
+        compilerExports.destroyCompilerContext(first);
+        compilerExports.destroyCompilerContext(second);
+        compilerExports.useCompilerContext(0);
+    }
+});
+
+test("reuses destroyed compiler contexts", async compiler => {
+    const contexts = [];
+    try {
+        while (contexts.length < 1000) {
+            contexts.push(compiler.createContext());
+        }
+    } catch (error) {
+        expectEqual(error.message, "no more compiler contexts are available in this instance", "the error");
+    }
+    expectEqual(contexts.length, 64, "the number of contexts available");
+    for (const context of contexts) {
+        context.destroy();
+    }
+
+    //a context from the pool starts over rather than keeping the state of the one destroyed before it
+    const destroyed = compilerExports.createCompilerContext();
+    setExportRoots(destroyed, "tick");
+    compilerExports.destroyCompilerContext(destroyed);
+    const reused = compilerExports.createCompilerContext();
+    try {
+        expectEqual(reused, destroyed, "the address of the reused context");
+        const source = "int count;\nvoid main() {\n    count = 1;\n}\nvoid tick() {\n    count = count + 1;\n}\n";
+        expectEqual(compileInContext(reused, source).join(" "), "main", "the exports of the reused context");
+    } finally {
+        compilerExports.destroyCompilerContext(reused);
+        compilerExports.useCompilerContext(0);
+    }
+});
+
+const compiler = await getCompiler("cpp", imports);
+let failureCount = 0;
+for (const {name, body} of tests) {
+    try {
+        await body(compiler);
+        console.log(`ok ${name}`);
+    } catch (error) {
+        ++failureCount;
+        console.log(`FAIL ${name}: ${error.message}`);
+    }
+}
+
+console.log(`${tests.length - failureCount} of ${tests.length} tests passed`);
+process.exitCode = failureCount ? 1 : 0;